@@ -52,31 +52,90 @@ extern "C" {
     } imap_u128_t;
 
     typedef struct imap_node imap_node_t;
+    typedef struct imap_node imap_forest_t;
+    #if !defined(IMAP_WIDE_SLOTS)
     typedef imap_u32_t imap_slot_t;
+    #else
+    typedef imap_u64_t imap_slot_t;
+    #endif
     typedef struct imap_iter imap_iter_t;
+    typedef struct imap_cursor imap_cursor_t;
     typedef struct imap_pair imap_pair_t;
+    typedef struct imap_op imap_op_t;
+    typedef struct imap_pool imap_pool_t;
+    typedef struct imap_frozen imap_frozen_t;
+    typedef struct imap_frozen_iter imap_frozen_iter_t;
+    typedef struct imap_frozen_pair imap_frozen_pair_t;
     typedef int imap_dumpfn_t(void *ctx, const char *fmt, ...);
+    typedef int imap_scanfn_t(void *ctx, imap_u64_t x, imap_slot_t *slot);
 
     struct imap_node
     {
-        /* 64 bytes */
+        /* 64 bytes (128 bytes with IMAP_WIDE_SLOTS) */
         union
         {
+    #if !defined(IMAP_WIDE_SLOTS)
             imap_u32_t vec32[16];
-            imap_u64_t vec64[8];
-            imap_u128_t vec128[4];
+    #endif
+            imap_slot_t vecsl[16];
+            imap_u64_t vec64[2 * sizeof(imap_slot_t)];
+            imap_u128_t vec128[sizeof(imap_slot_t)];
         };
     };
     struct imap_iter
     {
-        imap_u32_t stack[16];
+        imap_slot_t stack[16];
+        imap_u32_t stackp;
+    };
+    struct imap_cursor
+    {
+        imap_slot_t slotstack[16 + 1];
+        imap_u32_t posnstack[16 + 1];
         imap_u32_t stackp;
+        imap_u64_t prfx;
     };
     struct imap_pair
     {
         imap_u64_t x;
         imap_slot_t *slot;
     };
+    struct imap_op
+    {
+        imap_u64_t x, y;
+        imap_u32_t op;
+    };
+    struct imap_pool
+    {
+        imap_node_t **trees;
+        imap_u32_t count, capacity, n;
+    };
+    struct imap_frozen_iter
+    {
+        imap_u64_t stack[16];
+        imap_u32_t stackp;
+    };
+    struct imap_frozen_pair
+    {
+        imap_u64_t x, y;
+        int valid;
+    };
+    enum
+    {
+        imap_op_assign = 0,
+        imap_op_remove = 1,
+    };
+    enum
+    {
+        imap_grow_pow2 = 0,
+        imap_grow_half = 1,
+        imap_grow_exact = 2,
+    };
+    enum
+    {
+        imap_layout_dfs = 0,
+        imap_layout_bfs = 1,
+        imap_layout_veb = 2,
+    };
 
     IMAP_DECLFUNC
     imap_node_t *imap_ensure(imap_node_t *tree, imap_u32_t n);
@@ -87,10 +146,70 @@ extern "C" {
     IMAP_DECLFUNC
     imap_node_t *imap_ensure128(imap_node_t *tree, imap_u32_t n);
     IMAP_DECLFUNC
+    imap_node_t *imap_ensure_inline(imap_node_t *tree, imap_u32_t n);
+    IMAP_DECLFUNC
+    imap_node_t *imap_ensure_resv(imap_node_t *tree, imap_u32_t n, imap_u64_t resvsize);
+    IMAP_DECLFUNC
     void imap_free(imap_node_t *tree);
     IMAP_DECLFUNC
+    void imap_clear(imap_node_t *tree);
+    IMAP_DECLFUNC
+    void imap_clear0(imap_node_t *tree);
+    IMAP_DECLFUNC
+    void imap_clear64(imap_node_t *tree);
+    IMAP_DECLFUNC
+    void imap_clear128(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_pool_t *imap_pool_create(imap_u32_t capacity, imap_u32_t n);
+    IMAP_DECLFUNC
+    void imap_pool_free(imap_pool_t *pool);
+    IMAP_DECLFUNC
+    imap_node_t *imap_pool_get(imap_pool_t *pool);
+    IMAP_DECLFUNC
+    void imap_pool_put(imap_pool_t *pool, imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_node_t *imap_setgrowth(imap_node_t *tree, imap_u32_t policy, imap_u64_t budget);
+    IMAP_DECLFUNC
+    imap_node_t *imap_setsparse(imap_node_t *tree, imap_u32_t enable);
+    IMAP_DECLFUNC
+    imap_node_t *imap_setjump(imap_node_t *tree, imap_u32_t depth);
+    IMAP_DECLFUNC
+    imap_node_t *imap_setcache(imap_node_t *tree, imap_u32_t count);
+    IMAP_DECLFUNC
+    imap_u32_t imap_cachestats(imap_node_t *tree, imap_u64_t *hits, imap_u64_t *misses);
+    IMAP_DECLFUNC
+    imap_node_t *imap_reserve_exact(imap_node_t *tree, const imap_u64_t *xs, const imap_u64_t *ys, imap_u32_t n);
+    IMAP_DECLFUNC
+    imap_node_t *imap_build_sorted(const imap_u64_t *xs, const imap_u64_t *ys, imap_u32_t n);
+    IMAP_DECLFUNC
+    imap_node_t *imap_compact(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_node_t *imap_compact0(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_node_t *imap_compact64(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_node_t *imap_compact128(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_node_t *imap_relayout(imap_node_t *tree, imap_u32_t policy);
+    IMAP_DECLFUNC
+    imap_node_t *imap_relayout0(imap_node_t *tree, imap_u32_t policy);
+    IMAP_DECLFUNC
+    imap_node_t *imap_relayout64(imap_node_t *tree, imap_u32_t policy);
+    IMAP_DECLFUNC
+    imap_node_t *imap_relayout128(imap_node_t *tree, imap_u32_t policy);
+    IMAP_DECLFUNC
+    int imap_compact_step(imap_node_t *tree, imap_u32_t budget);
+    IMAP_DECLFUNC
+    int imap_compact_step0(imap_node_t *tree, imap_u32_t budget);
+    IMAP_DECLFUNC
+    int imap_compact_step64(imap_node_t *tree, imap_u32_t budget);
+    IMAP_DECLFUNC
+    int imap_compact_step128(imap_node_t *tree, imap_u32_t budget);
+    IMAP_DECLFUNC
     imap_slot_t *imap_lookup(imap_node_t *tree, imap_u64_t x);
     IMAP_DECLFUNC
+    void imap_lookup_batch(imap_node_t *tree, const imap_u64_t *xs, imap_slot_t **out, imap_u32_t n);
+    IMAP_DECLFUNC
     imap_slot_t *imap_assign(imap_node_t *tree, imap_u64_t x);
     IMAP_DECLFUNC
     int imap_hasval(imap_node_t *tree, imap_slot_t *slot);
@@ -103,6 +222,8 @@ extern "C" {
     IMAP_DECLFUNC
     imap_u128_t imap_getval128(imap_node_t *tree, imap_slot_t *slot);
     IMAP_DECLFUNC
+    void imap_getval_batch(imap_node_t *tree, imap_slot_t **slots, imap_u64_t *ys, imap_u32_t n);
+    IMAP_DECLFUNC
     void imap_setval(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y);
     IMAP_DECLFUNC
     void imap_setval0(imap_node_t *tree, imap_slot_t *slot, imap_u32_t y);
@@ -119,10 +240,78 @@ extern "C" {
     IMAP_DECLFUNC
     void imap_remove(imap_node_t *tree, imap_u64_t x);
     IMAP_DECLFUNC
+    void imap_remove_range(imap_node_t *tree, imap_u64_t x0, imap_u64_t x1);
+    IMAP_DECLFUNC
+    void imap_prune(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_u64_t imap_prune_step(imap_node_t *tree, imap_u64_t x, imap_u32_t budget);
+    IMAP_DECLFUNC
+    imap_slot_t *imap_cursor_lookup(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_slot_t *imap_cursor_assign(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x);
+    IMAP_DECLFUNC
+    void imap_cursor_remove(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_node_t *imap_apply_batch(imap_node_t *tree, imap_op_t *ops, imap_u32_t n);
+    IMAP_DECLFUNC
+    imap_forest_t *imap_forest_ensure(imap_forest_t *forest, imap_u32_t n);
+    IMAP_DECLFUNC
+    void imap_forest_free(imap_forest_t *forest);
+    IMAP_DECLFUNC
+    imap_slot_t imap_forest_create(imap_forest_t *forest);
+    IMAP_DECLFUNC
+    void imap_forest_destroy(imap_forest_t *forest, imap_slot_t tree);
+    IMAP_DECLFUNC
+    imap_slot_t *imap_forest_lookup(imap_forest_t *forest, imap_slot_t tree, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_slot_t *imap_forest_assign(imap_forest_t *forest, imap_slot_t tree, imap_u64_t x);
+    IMAP_DECLFUNC
+    void imap_forest_remove(imap_forest_t *forest, imap_slot_t tree, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_u64_t imap_forest_memsize(imap_forest_t *forest, imap_slot_t tree);
+    IMAP_DECLFUNC
+    imap_frozen_t *imap_freeze(imap_node_t *tree);
+    IMAP_DECLFUNC
+    imap_frozen_t *imap_freeze_wide(imap_node_t *tree);
+    IMAP_DECLFUNC
+    void imap_frozen_free(imap_frozen_t *frozen);
+    IMAP_DECLFUNC
+    imap_u64_t imap_frozen_memsize(imap_frozen_t *frozen);
+    IMAP_DECLFUNC
+    int imap_frozen_lookup(imap_frozen_t *frozen, imap_u64_t x, imap_u64_t *py);
+    IMAP_DECLFUNC
+    imap_frozen_pair_t imap_frozen_locate(imap_frozen_t *frozen, imap_frozen_iter_t *iter, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_frozen_pair_t imap_frozen_iterate(imap_frozen_t *frozen, imap_frozen_iter_t *iter, int restart);
+    IMAP_DECLFUNC
+    imap_u32_t *imap_count_ensure(imap_node_t *tree, imap_u32_t *counts);
+    IMAP_DECLFUNC
+    void imap_count_free(imap_u32_t *counts);
+    IMAP_DECLFUNC
+    void imap_count_update(imap_node_t *tree, imap_u32_t *counts, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_u64_t imap_rank(imap_node_t *tree, imap_u32_t *counts, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_pair_t imap_select(imap_node_t *tree, imap_u32_t *counts, imap_u64_t k);
+    IMAP_DECLFUNC
+    imap_u64_t imap_count_range(imap_node_t *tree, imap_u32_t *counts, imap_u64_t x0, imap_u64_t x1);
+    IMAP_DECLFUNC
+    imap_pair_t imap_sample(imap_node_t *tree, imap_u32_t *counts, imap_u64_t r);
+    IMAP_DECLFUNC
     imap_pair_t imap_locate(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x);
     IMAP_DECLFUNC
     imap_pair_t imap_iterate(imap_node_t *tree, imap_iter_t *iter, int restart);
     IMAP_DECLFUNC
+    imap_pair_t imap_locate_rev(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x);
+    IMAP_DECLFUNC
+    imap_pair_t imap_iterate_rev(imap_node_t *tree, imap_iter_t *iter, int restart);
+    IMAP_DECLFUNC
+    imap_pair_t imap_locate_range(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x0, imap_u64_t x1);
+    IMAP_DECLFUNC
+    imap_pair_t imap_iterate_range(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x1);
+    IMAP_DECLFUNC
+    int imap_scan_range(imap_node_t *tree, imap_u64_t x0, imap_u64_t x1, imap_scanfn_t *scanfn, void *ctx);
+    IMAP_DECLFUNC
     void imap_dump(imap_node_t *tree, imap_dumpfn_t *dumpfn, void *ctx);
 
     static inline
@@ -132,6 +321,38 @@ extern "C" {
         return imap_locate(tree, &iterdata, x + 1);
     }
 
+    static inline
+    imap_pair_t imap_pred(imap_node_t *tree, imap_u64_t x)
+    {
+        imap_iter_t iterdata;
+        if (0 == x)
+        {
+            imap_pair_t pair = { 0 };
+            return pair;
+        }
+        return imap_locate_rev(tree, &iterdata, x - 1);
+    }
+
+    static inline
+    imap_pair_t imap_min(imap_node_t *tree)
+    {
+        imap_iter_t iterdata;
+        return imap_iterate(tree, &iterdata, 1);
+    }
+
+    static inline
+    imap_pair_t imap_max(imap_node_t *tree)
+    {
+        imap_iter_t iterdata;
+        return imap_iterate_rev(tree, &iterdata, 1);
+    }
+
+    static inline
+    void imap_cursor_reset(imap_cursor_t *cursor)
+    {
+        cursor->stackp = 0;
+    }
+
 #endif
 
 #if defined(IMAP_IMPLEMENTATION)
@@ -151,6 +372,17 @@ extern "C" {
     #define IMAP_MEMCPY(dst, src, siz)  (memcpy(dst, src, siz))
     #endif
 
+    #if !defined(IMAP_PREFETCH)
+    #if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    #include <xmmintrin.h>
+    #define IMAP_PREFETCH(p)            (_mm_prefetch((const char *)(p), _MM_HINT_T0))
+    #elif defined(__GNUC__)
+    #define IMAP_PREFETCH(p)            (__builtin_prefetch(p))
+    #else
+    #define IMAP_PREFETCH(p)            ((void)0)
+    #endif
+    #endif
+
     #if !defined(IMAP_ALIGNED_ALLOC) && !defined(IMAP_ALIGNED_FREE)
 
     static inline
@@ -176,6 +408,99 @@ extern "C" {
 
     #endif
 
+    #if defined(IMAP_USE_RESERVE) || defined(IMAP_USE_HUGEPAGE)
+
+    #include <sys/mman.h>
+
+    #define imap__hugepage_size__       (2ull * 1024 * 1024)
+    #define imap__hugepage_round__(s)   (((s) + imap__hugepage_size__ - 1) & ~(imap__hugepage_size__ - 1))
+
+    static inline
+    void *imap__map__(imap_u64_t size, int prot, int flags)
+    {
+        void *p;
+    #if defined(IMAP_USE_HUGEPAGE)
+        // over-map by one huge page and trim, so that the mapping starts at a 2MB boundary
+        imap_u64_t base, slop = imap__hugepage_size__;
+        p = mmap(0, size + slop, prot, flags, -1, 0);
+        if (MAP_FAILED == p)
+            return 0;
+        base = ((imap_u64_t)p + slop - 1) & ~(slop - 1);
+        if (base != (imap_u64_t)p)
+            munmap(p, base - (imap_u64_t)p);
+        munmap((void *)(base + size), (imap_u64_t)p + slop - base);
+        p = (void *)base;
+    #if defined(MADV_HUGEPAGE)
+        madvise(p, size, MADV_HUGEPAGE);
+    #endif
+    #else
+        p = mmap(0, size, prot, flags, -1, 0);
+        if (MAP_FAILED == p)
+            return 0;
+    #endif
+        return p;
+    }
+
+    #endif
+
+    #if defined(IMAP_USE_RESERVE)
+
+    #if !defined(IMAP_RESERVE_SIZE)
+    #define IMAP_RESERVE_SIZE           (imap__tree_maxsize__ < (1ull << 30) ? imap__tree_maxsize__ : (1ull << 30))
+    #endif
+
+    static inline
+    void *imap__reserve__(imap_u64_t resvsize, imap_u64_t size)
+    {
+        void *p = imap__map__(resvsize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE);
+        if (0 == p)
+            return 0;
+        if (0 != mprotect(p, size, PROT_READ | PROT_WRITE))
+        {
+            munmap(p, resvsize);
+            return 0;
+        }
+        return p;
+    }
+
+    static inline
+    int imap__commit__(void *p, imap_u64_t size)
+    {
+        return 0 == mprotect(p, size, PROT_READ | PROT_WRITE);
+    }
+
+    static inline
+    void imap__release__(void *p, imap_u64_t resvsize)
+    {
+        if (0 != p)
+            munmap(p, resvsize);
+    }
+
+    #endif
+
+    #if defined(IMAP_USE_HUGEPAGE) && !defined(IMAP_USE_RESERVE)
+
+    static inline
+    void *imap__hugepage_alloc__(imap_u64_t size)
+    {
+        void *p;
+    #if defined(MAP_HUGETLB)
+        // prefer preallocated huge pages; fall back to transparent huge pages if there are none
+        p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (MAP_FAILED != p)
+            return p;
+    #endif
+        return imap__map__(size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+    }
+
+    static inline
+    void imap__hugepage_free__(void *p, imap_u64_t size)
+    {
+        munmap(p, size);
+    }
+
+    #endif
+
     #if !defined(IMAP_DUMP_NODE)
     #define IMAP_DUMP_NODE(...)         (imap_dump_node(__VA_ARGS__))
     #endif
@@ -188,6 +513,12 @@ extern "C" {
         return _BitScanReverse64((unsigned long *)&x, x | 1), (unsigned long)x;
     }
 
+    static inline
+    imap_u32_t imap__popcnt16__(imap_u32_t x)
+    {
+        return __popcnt16((unsigned short)x);
+    }
+
     #elif defined(__GNUC__)
 
     static inline
@@ -196,6 +527,12 @@ extern "C" {
         return 63 - __builtin_clzll(x | 1);
     }
 
+    static inline
+    imap_u32_t imap__popcnt16__(imap_u32_t x)
+    {
+        return __builtin_popcount(x);
+    }
+
     #endif
 
     static inline
@@ -204,7 +541,49 @@ extern "C" {
         return 1ull << (imap__bsr__(x - 1) + 1);
     }
 
-    #if defined(IMAP_USE_SIMD)
+    #if defined(IMAP_WIDE_SLOTS)
+
+    static inline
+    imap_u64_t imap__extract_lo4_wide__(imap_slot_t vecsl[16])
+    {
+        imap_u64_t value = 0;
+        imap_u32_t dirn;
+        for (dirn = 0; 16 > dirn; dirn++)
+            value |= (vecsl[dirn] & 0xf) << (dirn << 2);
+        return value;
+    }
+
+    static inline
+    void imap__deposit_lo4_wide__(imap_slot_t vecsl[16], imap_u64_t value)
+    {
+        imap_u32_t dirn;
+        for (dirn = 0; 16 > dirn; dirn++)
+            vecsl[dirn] = (vecsl[dirn] & ~0xfull) | ((value >> (dirn << 2)) & 0xf);
+    }
+
+    static inline
+    imap_u32_t imap__popcnt_hi28_wide__(imap_slot_t vecsl[16], imap_slot_t *p)
+    {
+        imap_slot_t sval;
+        imap_u32_t pcnt = 0, dirn;
+        *p = 0;
+        for (dirn = 0; 16 > dirn; dirn++)
+        {
+            sval = vecsl[dirn];
+            if (sval & ~0xfull)
+            {
+                *p = sval;
+                pcnt++;
+            }
+        }
+        return pcnt;
+    }
+
+    #define imap__extract_lo4__         imap__extract_lo4_wide__
+    #define imap__deposit_lo4__         imap__deposit_lo4_wide__
+    #define imap__popcnt_hi28__         imap__popcnt_hi28_wide__
+
+    #elif defined(IMAP_USE_SIMD)
 
     #include <immintrin.h>
 
@@ -291,7 +670,7 @@ extern "C" {
     #if defined(_MSC_VER)
         return (imap_u32_t)__popcnt64(msk64);
     #elif defined(__GNUC__)
-        return __builtin_popcount(msk64);
+        return __builtin_popcountll(msk64);
     #endif
     #endif
     }
@@ -364,21 +743,147 @@ extern "C" {
 
     #endif
 
+    #if defined(IMAP_USE_SIMD)
+
+    #include <immintrin.h>
+
+    static inline
+    imap_u32_t imap__list_match_simd__(imap_u64_t keys[8], imap_u64_t x)
+    {
+    #if IMAP_USE_SIMD == 512
+        return _mm512_cmpeq_epu64_mask(_mm512_load_epi64(keys), _mm512_set1_epi64(x));
+    #else
+        __m256i xmm = _mm256_set1_epi64x(x);
+        __m256i cmplo = _mm256_cmpeq_epi64(_mm256_load_si256((__m256i *)keys), xmm);
+        __m256i cmphi = _mm256_cmpeq_epi64(_mm256_load_si256((__m256i *)(keys + 4)), xmm);
+        return
+            (imap_u32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmplo)) |
+            ((imap_u32_t)_mm256_movemask_pd(_mm256_castsi256_pd(cmphi)) << 4);
+    #endif
+    }
+
+    #define imap__list_match__          imap__list_match_simd__
+
+    #else
+
+    static inline
+    imap_u32_t imap__list_match_port__(imap_u64_t keys[8], imap_u64_t x)
+    {
+        imap_u32_t mask = 0, i;
+        for (i = 0; 8 > i; i++)
+            mask |= (imap_u32_t)(keys[i] == x) << i;
+        return mask;
+    }
+
+    #define imap__list_match__          imap__list_match_port__
+
+    #endif
+
     #define imap__tree_root__           0
-    #define imap__tree_resv__           1
+    #define imap__tree_ext__            1
     #define imap__tree_mark__           2
     #define imap__tree_size__           3
     #define imap__tree_nfre__           4
     #define imap__tree_vfre__           5
+    #if defined(IMAP_USE_RESERVE)
+    #define imap__tree_resv__           6
+    #define imap__tree_nslot__          7
+    #else
+    #define imap__tree_nslot__          6
+    #endif
+    #define imap__tree_vbase64__        ((imap__tree_nslot__ * sizeof(imap_slot_t) + 7) / 8)
+    #define imap__tree_vbase128__       ((imap__tree_nslot__ * sizeof(imap_slot_t) + 15) / 16)
+    #define imap__tree_maxsize__        ((imap_u64_t)sizeof(imap_u64_t) << imap__slot_sbits__)
+
+    #define imap__node_nval64__         (sizeof(imap_node_t) / sizeof(imap_u64_t))
+    #define imap__node_nval128__        (sizeof(imap_node_t) / sizeof(imap_u128_t))
+    #define imap__tree_nhead64__        (imap__node_nval64__ - imap__tree_vbase64__)
+    #define imap__tree_nhead128__       (imap__node_nval128__ - imap__tree_vbase128__)
+    #define imap__small_size__          ((sizeof(imap_u64_t) + 2 * sizeof(imap_slot_t) + 15) & ~15)
+    #define imap__node_nsmall__         (sizeof(imap_node_t) / imap__small_size__)
+    #define imap__list_max__            8
+    #define imap__list_size__           \
+        ((imap__list_max__ * (sizeof(imap_u64_t) + sizeof(imap_slot_t)) + sizeof(imap_node_t) - 1) & \
+            ~(sizeof(imap_node_t) - 1))
+
+    #define imap__batch_group__         16
+
+    #define imap__frozen_tinner__       1
+    #define imap__frozen_tleaf__        2
+    #define imap__frozen_tpair__        3
+    #define imap__frozen_root_offset__  8
+    #define imap__frozen_nodes__        16
+    #define imap__frozen_leaf_header__  8
+    #define imap__frozen_leaf_base__    12
+    #define imap__frozen_wsize__(h)     ((1u << (((h) >> 16) & 7)) >> 1)
+    #define imap__frozen_bsize__(h)     ((1u << (((h) >> 19) & 7)) >> 1)
+    #define imap__frozen_pos__(h)       (((h) >> 16) & 0xf)
+    #define imap__frozen_wide__         0x100000
+    #define imap__frozen_entry__(ref, dirn) (((imap_u64_t)(ref) << 9) | (dirn))
+
+    #define imap__ext_grow__            0
+    #define imap__ext_budget__          1
+    #define imap__ext_cmpt__            2
+    #define imap__ext_jump__            3
+    #define imap__ext_lcache__          4
+    #define imap__ext_sparse__          5
+    #define imap__ext_cfre__            6
+    #define imap__ext_sfre__            7
+
+    #define imap__fre_node__            0
+    #define imap__fre_val__             1
+    #define imap__fre_cell__            2
+    #define imap__fre_small__           3
+
+    #define imap__cmpt_dead__           0
+    #define imap__cmpt_old__            4
+    #define imap__cmpt_x__              (sizeof(imap_slot_t) + 0)
+    #define imap__cmpt_limit__          (sizeof(imap_slot_t) + 1)
+    #define imap__cmpt_mark__           (sizeof(imap_slot_t) + 2)
+    #define imap__cmpt_count__          (sizeof(imap_slot_t) + 3)
+    #define imap__cmpt_phase__          7
+    #define imap__cmpt_measure__        1
+    #define imap__cmpt_sort__           2
+    #define imap__cmpt_evacuate__       3
+    #define imap__cmpt_release__        4
+    #define imap__cmpt_drain__          5
+
+    #define imap__jump_prefix__         0
+    #define imap__jump_hmask__          1
+    #define imap__jump_root__           2
+    #define imap__jump_posn__           3
+    #define imap__jump_levels__         4
+    #define imap__jump_index__          5
+    #define imap__jump_depth__          6
+    #define imap__jump_maxdepth__       4
+    #define imap__jump_base__(level)    ((((imap_u64_t)1 << ((level) << 2)) - 16) / 15)
+
+    #define imap__lcache_hits__         0
+    #define imap__lcache_misses__       1
+    #define imap__lcache_shift__        2
+    #define imap__lcache_count__        3
+    #define imap__lcache_mincount__     8
+    #define imap__lcache_maxcount__     65536
+    #define imap__lcache_empty__        1
 
     #define imap__prefix_pos__          0xf
     #define imap__slot_pmask__          0x0000000f
     #define imap__slot_node__           0x00000010
     #define imap__slot_scalar__         0x00000020
-    #define imap__slot_value__          0xffffffe0
+    #define imap__slot_cell__           0x00000020
+    #define imap__slot_small__          0x00000040
+    #define imap__slot_value__          ((imap_slot_t)~0x1full)
     #define imap__slot_shift__          6
-    #define imap__slot_sbits__          (32 - imap__slot_shift__)
+    #define imap__slot_sbits__          (8 * sizeof(imap_slot_t) - imap__slot_shift__)
     #define imap__slot_boxed__(sval)    (!((sval) & imap__slot_scalar__) && ((sval) >> imap__slot_shift__))
+    #define imap__slot_iscell__(sval)   \
+        (((sval) & (imap__slot_node__ | imap__slot_cell__ | imap__slot_small__)) == (imap__slot_node__ | imap__slot_cell__))
+    #define imap__slot_issmall__(sval)  \
+        (((sval) & (imap__slot_node__ | imap__slot_cell__ | imap__slot_small__)) == \
+            (imap__slot_node__ | imap__slot_cell__ | imap__slot_small__))
+    #define imap__slot_isinner__(sval)  (((sval) & imap__slot_node__) && !imap__slot_iscell__(sval))
+    #define imap__slot_islist__(sval)   \
+        (((sval) & ~imap__slot_pmask__) == imap__slot_cell__)
 
     #ifdef __cplusplus
     #define imap__node_zero__           (imap_node_t{ { { 0 } } })
@@ -391,549 +896,4632 @@ extern "C" {
     #endif
 
     static inline
-    imap_u32_t imap__alloc_node__(imap_node_t *tree)
+    int imap__cmpt_ingap__(imap_node_t *ctrl, imap_u64_t offset)
+    {
+        return (ctrl->vec64[imap__cmpt_limit__] & ~(imap_u64_t)imap__cmpt_phase__) <= offset &&
+            offset < ctrl->vec64[imap__cmpt_mark__];
+    }
+
+    static inline
+    imap_slot_t imap__alloc_node__(imap_node_t *tree)
     {
-        imap_u32_t mark = tree->vec32[imap__tree_nfre__];
+        imap_slot_t mark = tree->vecsl[imap__tree_nfre__];
         if (mark)
-            tree->vec32[imap__tree_nfre__] = *(imap_u32_t *)((imap_u8_t *)tree + mark);
+            tree->vecsl[imap__tree_nfre__] = *(imap_slot_t *)((imap_u8_t *)tree + mark);
         else
         {
-            mark = tree->vec32[imap__tree_mark__];
-            IMAP_ASSERT(mark + sizeof(imap_node_t) <= tree->vec32[imap__tree_size__]);
-            tree->vec32[imap__tree_mark__] = mark + sizeof(imap_node_t);
+            mark = tree->vecsl[imap__tree_mark__];
+            IMAP_ASSERT(mark + sizeof(imap_node_t) <= tree->vecsl[imap__tree_size__]);
+            tree->vecsl[imap__tree_mark__] = mark + sizeof(imap_node_t);
         }
         return mark;
     }
 
     static inline
-    void imap__free_node__(imap_node_t *tree, imap_u32_t mark)
+    imap_node_t *imap__node__(imap_node_t *tree, imap_slot_t val)
     {
-        *(imap_u32_t *)((imap_u8_t *)tree + mark) = tree->vec32[imap__tree_nfre__];
-        tree->vec32[imap__tree_nfre__] = mark;
+        return (imap_node_t *)((imap_u8_t *)tree + val);
     }
 
     static inline
-    imap_node_t *imap__node__(imap_node_t *tree, imap_u32_t val)
+    imap_slot_t imap__ext_get__(imap_node_t *tree, imap_u32_t field)
     {
-        return (imap_node_t *)((imap_u8_t *)tree + val);
+        // optional settings live in an extension node that is only allocated once one of them is used
+        imap_slot_t ext = tree->vecsl[imap__tree_ext__];
+        return ext ? imap__node__(tree, ext)->vecsl[field] : 0;
     }
 
     static inline
-    imap_u64_t imap__node_prefix__(imap_node_t *node)
+    imap_slot_t *imap__ext_slot__(imap_node_t *tree, imap_u32_t field)
     {
-        return imap__extract_lo4__(node->vec32);
+        IMAP_ASSERT(0 != tree->vecsl[imap__tree_ext__]);
+        return &imap__node__(tree, tree->vecsl[imap__tree_ext__])->vecsl[field];
     }
 
     static inline
-    void imap__node_setprefix__(imap_node_t *node, imap_u64_t prefix)
+    void imap__ext_alloc__(imap_node_t *tree)
     {
-        imap__deposit_lo4__(node->vec32, prefix);
+        // carve an empty extension node; the caller has made room for it
+        imap_slot_t ext = imap__alloc_node__(tree);
+        *imap__node__(tree, ext) = imap__node_zero__;
+        tree->vecsl[imap__tree_ext__] = ext;
     }
 
     static inline
-    imap_u32_t imap__node_pos__(imap_node_t *node)
+    imap_slot_t *imap__fre_list__(imap_node_t *tree, imap_u32_t list)
     {
-        return node->vec32[0] & 0xf;
+        // nodes and value cells are listed in the header; cells and small nodes are only carved
+        // by sparse trees and are listed in the extension node
+        return imap__fre_cell__ > list ?
+            &tree->vecsl[imap__tree_nfre__ + list] : imap__ext_slot__(tree, imap__ext_cfre__ + list - imap__fre_cell__);
     }
 
     static inline
-    imap_u32_t imap__node_popcnt__(imap_node_t *node, imap_u32_t *p)
+    imap_slot_t *imap__free_head__(imap_node_t *tree, imap_u32_t list, imap_u64_t offset)
     {
-        return imap__popcnt_hi28__(node->vec32, p);
+        // while a compaction pass evacuates the top of the tree, memory freed there is set aside
+        // on lists of the pass so that it is never handed out again
+        imap_slot_t cmpt = imap__ext_get__(tree, imap__ext_cmpt__);
+        imap_node_t *ctrl;
+        if (cmpt)
+        {
+            ctrl = (imap_node_t *)((imap_u8_t *)tree + cmpt);
+            if (imap__cmpt_ingap__(ctrl, offset))
+                return &ctrl->vecsl[imap__cmpt_dead__ + list];
+        }
+        return imap__fre_list__(tree, list);
     }
 
     static inline
-    imap_u64_t imap__xpfx__(imap_u64_t x, imap_u32_t pos)
+    imap_u64_t imap__node_prefix__(imap_node_t *node)
     {
-        return x & (~0xfull << (pos << 2));
+        return imap__extract_lo4__(node->vecsl);
     }
 
     static inline
-    imap_u32_t imap__xpos__(imap_u64_t x)
+    imap_u64_t *imap__lcache_entry__(imap_node_t *tree, imap_slot_t lcache, imap_u64_t prfx)
     {
-        return imap__bsr__(x) >> 2;
+        // the cache is direct-mapped: a position 0 prefix is hashed to a single entry of its key and node mark
+        imap_u64_t *chdr = imap__node__(tree, lcache)->vec64;
+        return (imap_u64_t *)((imap_u8_t *)tree + lcache + sizeof(imap_node_t)) +
+            2 * ((prfx * 0x9e3779b97f4a7c15ull) >> chdr[imap__lcache_shift__]);
     }
 
     static inline
-    imap_u32_t imap__xdir__(imap_u64_t x, imap_u32_t pos)
+    void imap__lcache_evict__(imap_node_t *tree, imap_slot_t lcache, imap_slot_t mark)
     {
-        return (x >> (pos << 2)) & 0xf;
+        // a node that is cached is a position 0 node whose entry is found from its prefix;
+        // any other node (or memory that is not a node) cannot match the mark of that entry
+        imap_u64_t *entry = imap__lcache_entry__(tree, lcache, imap__node_prefix__(imap__node__(tree, mark)));
+        if (entry[1] == mark)
+        {
+            entry[0] = imap__lcache_empty__;
+            entry[1] = 0;
+        }
     }
 
     static inline
-    imap_u32_t imap__alloc_val__(imap_node_t *tree)
+    void imap__free_node__(imap_node_t *tree, imap_slot_t mark)
     {
-        imap_u32_t mark = imap__alloc_node__(tree);
-        imap_node_t *node = imap__node__(tree, mark);
-        mark <<= 3;
-        tree->vec32[imap__tree_vfre__] = mark;
-        node->vec64[0] = mark + (1 << imap__slot_shift__);
-        node->vec64[1] = mark + (2 << imap__slot_shift__);
-        node->vec64[2] = mark + (3 << imap__slot_shift__);
-        node->vec64[3] = mark + (4 << imap__slot_shift__);
-        node->vec64[4] = mark + (5 << imap__slot_shift__);
-        node->vec64[5] = mark + (6 << imap__slot_shift__);
-        node->vec64[6] = mark + (7 << imap__slot_shift__);
-        node->vec64[7] = 0;
-        return mark;
+        imap_slot_t lcache = imap__ext_get__(tree, imap__ext_lcache__);
+        imap_slot_t *head = imap__free_head__(tree, imap__fre_node__, mark);
+        if (lcache)
+            imap__lcache_evict__(tree, lcache, mark);
+        *(imap_slot_t *)((imap_u8_t *)tree + mark) = *head;
+        *head = mark;
     }
 
     static inline
-    imap_u32_t imap__alloc_val128__(imap_node_t *tree)
+    void imap__node_setprefix__(imap_node_t *node, imap_u64_t prefix)
     {
-        imap_u32_t mark = imap__alloc_node__(tree);
-        imap_node_t *node = imap__node__(tree, mark);
-        mark <<= 3;
-        tree->vec32[imap__tree_vfre__] = mark;
-        node->vec128[0].v[0] = mark + (2 << imap__slot_shift__);
-        node->vec128[1].v[0] = mark + (4 << imap__slot_shift__);
-        node->vec128[2].v[0] = mark + (6 << imap__slot_shift__);
-        node->vec128[3].v[0] = 0;
-        return mark;
+        imap__deposit_lo4__(node->vecsl, prefix);
     }
 
     static inline
-    imap_node_t *imap__ensure__(imap_node_t *tree, imap_u32_t n, imap_u32_t ysize)
+    imap_u32_t imap__node_pos__(imap_node_t *node)
+    {
+        return node->vecsl[0] & 0xf;
+    }
+
+    static inline
+    imap_u32_t imap__node_popcnt__(imap_node_t *node, imap_slot_t *p)
+    {
+        return imap__popcnt_hi28__(node->vecsl, p);
+    }
+
+    static inline
+    imap_u64_t imap__xpfx__(imap_u64_t x, imap_u32_t pos)
+    {
+        return x & (~0xfull << (pos << 2));
+    }
+
+    static inline
+    imap_u32_t imap__xpos__(imap_u64_t x)
+    {
+        return imap__bsr__(x) >> 2;
+    }
+
+    static inline
+    imap_u32_t imap__xdir__(imap_u64_t x, imap_u32_t pos)
+    {
+        return (x >> (pos << 2)) & 0xf;
+    }
+
+    static inline
+    imap_u32_t imap__xdir8__(imap_u64_t x, imap_u32_t pos)
+    {
+        // the digits of x at positions pos and pos - 1, which a wide node consumes together
+        return (x >> ((pos - 1) << 2)) & 0xff;
+    }
+
+    static inline
+    imap_slot_t imap__alloc_val__(imap_node_t *tree)
+    {
+        imap_slot_t mark = imap__alloc_node__(tree);
+        imap_node_t *node = imap__node__(tree, mark);
+        imap_u32_t i;
+        mark <<= 3;
+        tree->vecsl[imap__tree_vfre__] = mark;
+        for (i = 0; imap__node_nval64__ - 1 > i; i++)
+            node->vec64[i] = mark + ((imap_slot_t)(i + 1) << imap__slot_shift__);
+        node->vec64[i] = 0;
+        return mark;
+    }
+
+    static inline
+    imap_slot_t imap__alloc_val128__(imap_node_t *tree)
+    {
+        imap_slot_t mark = imap__alloc_node__(tree);
+        imap_node_t *node = imap__node__(tree, mark);
+        imap_u32_t i;
+        mark <<= 3;
+        tree->vecsl[imap__tree_vfre__] = mark;
+        for (i = 0; imap__node_nval128__ - 1 > i; i++)
+            node->vec128[i].v[0] = mark + ((imap_slot_t)(2 * i + 2) << imap__slot_shift__);
+        node->vec128[i].v[0] = 0;
+        return mark;
+    }
+
+    static inline
+    void imap__free_val__(imap_node_t *tree, imap_slot_t sval)
+    {
+        imap_slot_t *head = imap__free_head__(tree, imap__fre_val__,
+            (imap_u64_t)(sval >> imap__slot_shift__) * sizeof(imap_u64_t));
+        tree->vec64[sval >> imap__slot_shift__] = *head;
+        *head = sval & imap__slot_value__;
+    }
+
+    static inline
+    imap_u64_t *imap__cell__(imap_node_t *tree, imap_slot_t sval)
+    {
+        return &tree->vec64[sval >> imap__slot_shift__];
+    }
+
+    static inline
+    imap_slot_t *imap__cell_slot__(imap_node_t *tree, imap_slot_t sval)
+    {
+        return &tree->vecsl[((sval >> imap__slot_shift__) + 1) * (sizeof(imap_u64_t) / sizeof(imap_slot_t))];
+    }
+
+    static inline
+    imap_slot_t imap__alloc_cell__(imap_node_t *tree, imap_u64_t x)
+    {
+        // a cell is a 16-byte key/value pair that stands in for a position 0 node with a single value;
+        // cells are carved from nodes and referenced by a node slot with the cell bit set
+        imap_slot_t *head = imap__ext_slot__(tree, imap__ext_cfre__);
+        imap_slot_t cval = *head, mark;
+        imap_node_t *node;
+        imap_u32_t i;
+        if (!cval)
+        {
+            mark = imap__alloc_node__(tree);
+            node = imap__node__(tree, mark);
+            cval = mark << 3;
+            for (i = 0; imap__node_nval128__ - 1 > i; i++)
+                node->vec128[i].v[0] = cval + ((imap_slot_t)(2 * i + 2) << imap__slot_shift__);
+            node->vec128[i].v[0] = 0;
+        }
+        *head = (imap_slot_t)tree->vec64[cval >> imap__slot_shift__];
+        cval |= imap__slot_node__ | imap__slot_cell__;
+        *imap__cell__(tree, cval) = x;
+        *imap__cell_slot__(tree, cval) = 0;
+        return cval;
+    }
+
+    static inline
+    void imap__free_cell__(imap_node_t *tree, imap_slot_t cval)
+    {
+        imap_slot_t *head = imap__free_head__(tree, imap__fre_cell__,
+            (imap_u64_t)(cval >> imap__slot_shift__) * sizeof(imap_u64_t));
+        *imap__cell__(tree, cval) = *head;
+        *head = cval & ~(imap_slot_t)((1 << imap__slot_shift__) - 1);
+    }
+
+    static inline
+    imap_u64_t *imap__small__(imap_node_t *tree, imap_slot_t sval)
+    {
+        return &tree->vec64[(sval >> imap__slot_shift__) & ~(imap_slot_t)1];
+    }
+
+    static inline
+    imap_slot_t *imap__small_slots__(imap_node_t *tree, imap_slot_t sval)
+    {
+        return &tree->vecsl[(((sval >> imap__slot_shift__) & ~(imap_slot_t)1) + 1) *
+            (sizeof(imap_u64_t) / sizeof(imap_slot_t))];
+    }
+
+    static inline
+    imap_slot_t *imap__small_slot__(imap_node_t *tree, imap_slot_t sval, imap_u32_t dirn)
+    {
+        imap_slot_t *slots = imap__small_slots__(tree, sval);
+        if ((slots[0] & imap__slot_pmask__) == dirn)
+            return &slots[0];
+        if ((slots[1] & imap__slot_pmask__) == dirn)
+            return &slots[1];
+        return 0;
+    }
+
+    static inline
+    imap_slot_t imap__alloc_small__(imap_node_t *tree, imap_u64_t prfx,
+        imap_u32_t dir0, imap_slot_t sval0, imap_u32_t dir1, imap_slot_t sval1)
+    {
+        // a small node is an internal node with two children: a prefix word followed by two slots
+        // that keep their direction in the low bits; small nodes are carved from nodes like cells
+        // and are referenced by a node slot with the cell and small bits set
+        imap_slot_t *head = imap__ext_slot__(tree, imap__ext_sfre__);
+        imap_slot_t sval = *head, mark, *slots;
+        imap_node_t *node;
+        imap_u32_t i;
+        if (!sval)
+        {
+            mark = imap__alloc_node__(tree);
+            node = imap__node__(tree, mark);
+            sval = mark << 3;
+            for (i = 0; imap__node_nsmall__ - 1 > i; i++)
+                node->vec64[i * (imap__small_size__ / 8)] =
+                    sval + ((imap_slot_t)((i + 1) * (imap__small_size__ / 8)) << imap__slot_shift__);
+            node->vec64[i * (imap__small_size__ / 8)] = 0;
+        }
+        *head = (imap_slot_t)*imap__small__(tree, sval);
+        sval |= imap__slot_node__ | imap__slot_cell__ | imap__slot_small__;
+        *imap__small__(tree, sval) = prfx;
+        slots = imap__small_slots__(tree, sval);
+        if (dir0 > dir1)
+        {
+            slots[0] = (sval1 & ~imap__slot_pmask__) | dir1;
+            slots[1] = (sval0 & ~imap__slot_pmask__) | dir0;
+        }
+        else
+        {
+            slots[0] = (sval0 & ~imap__slot_pmask__) | dir0;
+            slots[1] = (sval1 & ~imap__slot_pmask__) | dir1;
+        }
+        return sval;
+    }
+
+    static inline
+    void imap__free_small__(imap_node_t *tree, imap_slot_t sval)
+    {
+        imap_slot_t *head = imap__free_head__(tree, imap__fre_small__,
+            (imap_u64_t)((sval >> imap__slot_shift__) & ~(imap_slot_t)1) * sizeof(imap_u64_t));
+        *imap__small__(tree, sval) = *head;
+        *head = sval & ~(imap_slot_t)((2 << imap__slot_shift__) - 1);
+    }
+
+    static inline
+    imap_u64_t imap__inner_offset__(imap_slot_t sval)
+    {
+        return sval & imap__slot_cell__ ?
+            (imap_u64_t)((sval >> imap__slot_shift__) & ~(imap_slot_t)1) * sizeof(imap_u64_t) :
+            (imap_u64_t)(sval & imap__slot_value__);
+    }
+
+    static inline
+    imap_u64_t imap__inner_prefix__(imap_node_t *tree, imap_slot_t sval)
+    {
+        // prefix and position of an internal node of either kind
+        return sval & imap__slot_cell__ ?
+            *imap__small__(tree, sval) : imap__node_prefix__(imap__node__(tree, sval & imap__slot_value__));
+    }
+
+    static inline
+    imap_u32_t imap__inner_pos__(imap_node_t *tree, imap_slot_t sval)
+    {
+        return sval & imap__slot_cell__ ?
+            (imap_u32_t)(*imap__small__(tree, sval) & imap__prefix_pos__) : imap__node_pos__(imap__node__(tree, sval & imap__slot_value__));
+    }
+
+    static inline
+    imap_slot_t *imap__inner_slot__(imap_node_t *tree, imap_slot_t sval, imap_u32_t dirn)
+    {
+        return sval & imap__slot_cell__ ?
+            imap__small_slot__(tree, sval, dirn) : &imap__node__(tree, sval & imap__slot_value__)->vecsl[dirn];
+    }
+
+    static inline
+    imap_u64_t *imap__list_keys__(imap_node_t *tree)
+    {
+        // a list is a sorted array of up to 8 keys followed by their slots; it is stored right after
+        // the header node and is referenced by a root slot with the cell bit set and the key count in the low bits
+        return imap__node__(tree, sizeof(imap_node_t))->vec64;
+    }
+
+    static inline
+    imap_slot_t *imap__list_slots__(imap_node_t *tree)
+    {
+        return (imap_slot_t *)((imap_u8_t *)tree + sizeof(imap_node_t) + imap__list_max__ * sizeof(imap_u64_t));
+    }
+
+    static inline
+    imap_u32_t imap__list_find__(imap_node_t *tree, imap_slot_t lval, imap_u64_t x)
+    {
+        // returns the index of x or the list count if x is not in the list
+        imap_u32_t count = lval & imap__slot_pmask__;
+        imap_u32_t mask = imap__list_match__(imap__list_keys__(tree), x) & ((1u << count) - 1);
+        return mask ? imap__bsr__(mask) : count;
+    }
+
+    static inline
+    imap_u32_t imap__list_lower__(imap_node_t *tree, imap_slot_t lval, imap_u64_t x)
+    {
+        // returns the index of the first key that is not less than x
+        imap_u64_t *keys = imap__list_keys__(tree);
+        imap_u32_t count = lval & imap__slot_pmask__, i;
+        for (i = 0; count > i && keys[i] < x; i++)
+            ;
+        return i;
+    }
+
+    static inline
+    imap_u64_t imap__jump_size__(imap_u32_t depth)
+    {
+        // a header node followed by the entries of all levels, rounded up to whole nodes
+        return sizeof(imap_node_t) + ((imap__jump_base__(depth + 1) * sizeof(imap_slot_t) + sizeof(imap_node_t) - 1) &
+            ~(imap_u64_t)(sizeof(imap_node_t) - 1));
+    }
+
+    static inline
+    imap_u32_t imap__jump_depth_of__(imap_node_t *tree)
+    {
+        return (imap_u32_t)imap__node__(tree, imap__ext_get__(tree, imap__ext_jump__))->vec64[imap__jump_depth__];
+    }
+
+    static inline
+    imap_slot_t *imap__jump_entries__(imap_node_t *tree, imap_slot_t jump)
+    {
+        return (imap_slot_t *)((imap_u8_t *)tree + jump + sizeof(imap_node_t));
+    }
+
+    static inline
+    imap_u64_t imap__jump_digits__(imap_u64_t x, imap_u32_t posn, imap_u32_t level)
+    {
+        // the index of x within a level: its level digits from position posn down
+        return (x >> ((posn - level + 1) << 2)) & (((imap_u64_t)1 << (level << 2)) - 1);
+    }
+
+    static inline
+    void imap__jump_fill__(imap_node_t *tree, imap_slot_t jump, imap_u32_t level, imap_u64_t index)
+    {
+        // recompute an entry and all entries below it, one level at a time; an entry references the node
+        // in the direction of its last digit if its parent entry (or the root) does and the node is a full node
+        // at the next position down, otherwise it is 0
+        imap_u64_t *jhdr = imap__node__(tree, jump)->vec64;
+        imap_slot_t *entries = imap__jump_entries__(tree, jump);
+        imap_slot_t pval, sval;
+        imap_u32_t posn = (imap_u32_t)jhdr[imap__jump_posn__], levels = (imap_u32_t)jhdr[imap__jump_levels__];
+        imap_u64_t i, n;
+        for (n = 1; levels >= level; level++, index <<= 4, n <<= 4)
+            for (i = index; index + n > i; i++)
+            {
+                pval = 1 == level ? (imap_slot_t)jhdr[imap__jump_root__] : entries[imap__jump_base__(level - 1) + (i >> 4)];
+                sval = pval ? imap__node__(tree, pval & imap__slot_value__)->vecsl[i & 15] : 0;
+                if ((sval & (imap__slot_node__ | imap__slot_cell__)) != imap__slot_node__ ||
+                    imap__node_pos__(imap__node__(tree, sval & imap__slot_value__)) != posn - level)
+                    sval = 0;
+                entries[imap__jump_base__(level) + i] = sval & ~imap__slot_pmask__;
+            }
+    }
+
+    static inline
+    void imap__jump_build__(imap_node_t *tree, imap_slot_t jump)
+    {
+        // the table is in use when the root is a full node above position 0; otherwise its prefix matches no key
+        imap_u64_t *jhdr = imap__node__(tree, jump)->vec64;
+        imap_slot_t sval = tree->vecsl[imap__tree_root__];
+        imap_u32_t posn, levels, dirn;
+        jhdr[imap__jump_root__] = sval;
+        jhdr[imap__jump_prefix__] = 1;
+        jhdr[imap__jump_hmask__] = 0;
+        if ((sval & (imap__slot_node__ | imap__slot_cell__)) != imap__slot_node__)
+            return;
+        posn = imap__node_pos__(imap__node__(tree, sval & imap__slot_value__));
+        levels = (imap_u32_t)jhdr[imap__jump_depth__];
+        levels = posn < levels ? posn : levels;
+        if (0 == levels)
+            return;
+        jhdr[imap__jump_posn__] = posn;
+        jhdr[imap__jump_levels__] = levels;
+        jhdr[imap__jump_index__] = imap__jump_base__(levels);
+        for (dirn = 0; 16 > dirn; dirn++)
+            imap__jump_fill__(tree, jump, 1, dirn);
+        jhdr[imap__jump_hmask__] = 15 == posn ? 0 : ~0ull << ((posn + 1) << 2);
+        jhdr[imap__jump_prefix__] = imap__node_prefix__(imap__node__(tree, sval & imap__slot_value__)) &
+            jhdr[imap__jump_hmask__];
+    }
+
+    static inline
+    void imap__jump_alloc__(imap_node_t *tree, imap_u32_t depth)
+    {
+        // carve a jump table at the mark; the caller has made room for it
+        imap_slot_t jump = tree->vecsl[imap__tree_mark__];
+        IMAP_ASSERT(jump + imap__jump_size__(depth) <= tree->vecsl[imap__tree_size__]);
+        tree->vecsl[imap__tree_mark__] = (imap_slot_t)(jump + imap__jump_size__(depth));
+        *imap__ext_slot__(tree, imap__ext_jump__) = jump;
+        imap__node__(tree, jump)->vec64[imap__jump_depth__] = depth;
+        imap__jump_build__(tree, jump);
+    }
+
+    static inline
+    void imap__jump_free__(imap_node_t *tree, imap_slot_t jump)
+    {
+        imap_u64_t size = imap__jump_size__((imap_u32_t)imap__node__(tree, jump)->vec64[imap__jump_depth__]);
+        imap_slot_t mark;
+        if (jump + size == tree->vecsl[imap__tree_mark__])
+            tree->vecsl[imap__tree_mark__] = jump;
+        else
+            for (mark = jump; jump + size > mark; mark += sizeof(imap_node_t))
+                imap__free_node__(tree, mark);
+    }
+
+    static inline
+    void imap__jump_update__(imap_node_t *tree, imap_u64_t x, imap_u32_t posn)
+    {
+        // the link to the subtree of x whose node is at position posn has changed:
+        // refresh the entries that may lead through it; a new root rebuilds the table
+        imap_slot_t jump = imap__ext_get__(tree, imap__ext_jump__);
+        imap_u64_t *jhdr;
+        imap_u32_t rpos, level;
+        if (!jump)
+            return;
+        jhdr = imap__node__(tree, jump)->vec64;
+        if (tree->vecsl[imap__tree_root__] != jhdr[imap__jump_root__])
+        {
+            imap__jump_build__(tree, jump);
+            return;
+        }
+        if ((x & jhdr[imap__jump_hmask__]) != jhdr[imap__jump_prefix__])
+            return;
+        rpos = (imap_u32_t)jhdr[imap__jump_posn__];
+        if (posn >= rpos)
+        {
+            imap__jump_build__(tree, jump);
+            return;
+        }
+        level = rpos - posn;
+        if (level <= jhdr[imap__jump_levels__])
+            imap__jump_fill__(tree, jump, level, imap__jump_digits__(x, rpos, level));
+    }
+
+    static inline
+    imap_slot_t *imap__jump_slot__(imap_node_t *tree, imap_u64_t x)
+    {
+        // the entry for x in the deepest level of the jump table, which acts as the slot that references
+        // the node where a descent for x can start; 0 if the table does not cover x
+        imap_slot_t jump = imap__ext_get__(tree, imap__ext_jump__);
+        imap_u64_t *jhdr;
+        imap_slot_t *entry;
+        if (!jump)
+            return 0;
+        jhdr = imap__node__(tree, jump)->vec64;
+        if ((x & jhdr[imap__jump_hmask__]) != jhdr[imap__jump_prefix__])
+            return 0;
+        entry = imap__jump_entries__(tree, jump) + jhdr[imap__jump_index__] +
+            imap__jump_digits__(x, (imap_u32_t)jhdr[imap__jump_posn__], (imap_u32_t)jhdr[imap__jump_levels__]);
+        return *entry ? entry : 0;
+    }
+
+    static inline
+    imap_slot_t *imap__jump_path__(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x)
+    {
+        // push the root and the nodes of the jump table above the deepest one onto an iterator stack,
+        // as a descent for x would; the table must cover x
+        imap_slot_t jump = imap__ext_get__(tree, imap__ext_jump__);
+        imap_u64_t *jhdr = imap__node__(tree, jump)->vec64;
+        imap_slot_t *entries = imap__jump_entries__(tree, jump);
+        imap_u32_t posn = (imap_u32_t)jhdr[imap__jump_posn__], levels = (imap_u32_t)jhdr[imap__jump_levels__];
+        imap_u32_t level;
+        iter->stack[iter->stackp++] = ((imap_slot_t)jhdr[imap__jump_root__] & imap__slot_value__) |
+            (imap__xdir__(x, posn) + 1);
+        for (level = 1; levels > level; level++)
+            iter->stack[iter->stackp++] =
+                (entries[imap__jump_base__(level) + imap__jump_digits__(x, posn, level)] & imap__slot_value__) |
+                (imap__xdir__(x, posn - level) + 1);
+        return imap__jump_slot__(tree, x);
+    }
+
+    static inline
+    imap_u64_t imap__lcache_size__(imap_u32_t count)
+    {
+        // a header node followed by the entries, rounded up to whole nodes
+        return sizeof(imap_node_t) + ((count * 2 * sizeof(imap_u64_t) + sizeof(imap_node_t) - 1) &
+            ~(imap_u64_t)(sizeof(imap_node_t) - 1));
+    }
+
+    static inline
+    imap_u32_t imap__lcache_count_of__(imap_node_t *tree)
+    {
+        return (imap_u32_t)imap__node__(tree, imap__ext_get__(tree, imap__ext_lcache__))->vec64[imap__lcache_count__];
+    }
+
+    static inline
+    void imap__lcache_alloc__(imap_node_t *tree, imap_u32_t count, imap_u64_t hits, imap_u64_t misses)
+    {
+        // carve an empty cache at the mark; the caller has made room for it
+        imap_slot_t lcache = tree->vecsl[imap__tree_mark__];
+        imap_u64_t *chdr = imap__node__(tree, lcache)->vec64, *entry;
+        imap_u32_t i;
+        IMAP_ASSERT(lcache + imap__lcache_size__(count) <= tree->vecsl[imap__tree_size__]);
+        tree->vecsl[imap__tree_mark__] = (imap_slot_t)(lcache + imap__lcache_size__(count));
+        *imap__ext_slot__(tree, imap__ext_lcache__) = lcache;
+        chdr[imap__lcache_hits__] = hits;
+        chdr[imap__lcache_misses__] = misses;
+        chdr[imap__lcache_shift__] = 64 - imap__bsr__(count);
+        chdr[imap__lcache_count__] = count;
+        entry = (imap_u64_t *)((imap_u8_t *)tree + lcache + sizeof(imap_node_t));
+        for (i = 0; count > i; i++, entry += 2)
+        {
+            entry[0] = imap__lcache_empty__;
+            entry[1] = 0;
+        }
+    }
+
+    static inline
+    void imap__lcache_free__(imap_node_t *tree, imap_slot_t lcache)
+    {
+        imap_u64_t size = imap__lcache_size__((imap_u32_t)imap__node__(tree, lcache)->vec64[imap__lcache_count__]);
+        imap_slot_t mark;
+        if (lcache + size == tree->vecsl[imap__tree_mark__])
+            tree->vecsl[imap__tree_mark__] = lcache;
+        else
+            for (mark = lcache; lcache + size > mark; mark += sizeof(imap_node_t))
+                imap__free_node__(tree, mark);
+    }
+
+    static inline
+    void imap__lcache_copy__(imap_node_t *newtree, imap_node_t *tree)
+    {
+        // a rebuilt tree gets an empty cache of the same size that keeps counting
+        imap_u64_t *chdr;
+        if (!imap__ext_get__(tree, imap__ext_lcache__))
+            return;
+        chdr = imap__node__(tree, imap__ext_get__(tree, imap__ext_lcache__))->vec64;
+        imap__lcache_alloc__(newtree, (imap_u32_t)chdr[imap__lcache_count__],
+            chdr[imap__lcache_hits__], chdr[imap__lcache_misses__]);
+    }
+
+    static inline
+    imap_node_t *imap__tree_alloc__(imap_u64_t size)
+    {
+    #if defined(IMAP_USE_HUGEPAGE) && !defined(IMAP_USE_RESERVE)
+        // trees of at least one huge page are mapped directly in whole huge pages
+        if (imap__hugepage_size__ <= size)
+            return (imap_node_t *)imap__hugepage_alloc__(imap__hugepage_round__(size));
+    #endif
+        return (imap_node_t *)IMAP_ALIGNED_ALLOC(sizeof(imap_node_t), size);
+    }
+
+    static inline
+    void imap__tree_free__(imap_node_t *tree)
+    {
+    #if defined(IMAP_USE_HUGEPAGE) && !defined(IMAP_USE_RESERVE)
+        if (0 != tree && imap__hugepage_size__ <= tree->vecsl[imap__tree_size__])
+        {
+            imap__hugepage_free__(tree, imap__hugepage_round__(tree->vecsl[imap__tree_size__]));
+            return;
+        }
+    #endif
+        IMAP_ALIGNED_FREE(tree);
+    }
+
+    static inline
+    imap_u64_t imap__growsize__(imap_node_t *tree, imap_u64_t newmark)
+    {
+        imap_u64_t newsize, budget;
+        if (0 == tree)
+            return imap__ceilpow2__(newmark);
+        switch (imap__ext_get__(tree, imap__ext_grow__))
+        {
+        case imap_grow_half:
+            newsize = tree->vecsl[imap__tree_size__];
+            newsize += newsize / 2;
+            newsize = newsize < newmark ? newmark : newsize;
+            break;
+        case imap_grow_exact:
+            newsize = newmark + newmark / 8;
+            break;
+        default:
+            newsize = imap__ceilpow2__(newmark);
+            break;
+        }
+        newsize = (newsize + sizeof(imap_node_t) - 1) & ~(imap_u64_t)(sizeof(imap_node_t) - 1);
+        // a budget caps growth; growth that cannot fit within the budget fails
+        budget = imap__ext_get__(tree, imap__ext_budget__);
+        if (0 != budget && budget < newsize)
+            newsize = budget < newmark ? 0 : budget;
+        return newsize;
+    }
+
+    static inline
+    void imap__tree_init__(imap_node_t *tree, imap_u32_t ysize)
+    {
+        // the header fields are followed by value cells that start out on the value free list
+        imap_u32_t i;
+        *tree = imap__node_zero__;
+        tree->vecsl[imap__tree_mark__] = sizeof(imap_node_t);
+        if (sizeof(imap_u64_t) == ysize)
+        {
+            tree->vecsl[imap__tree_vfre__] = (imap_slot_t)imap__tree_vbase64__ << imap__slot_shift__;
+            for (i = imap__tree_vbase64__; imap__node_nval64__ - 1 > i; i++)
+                tree->vec64[i] = (imap_slot_t)(i + 1) << imap__slot_shift__;
+        }
+        else
+        if (sizeof(imap_u128_t) == ysize && imap__tree_nhead128__)
+        {
+            // only runs when the header has room for 128-bit value cells
+            tree->vecsl[imap__tree_vfre__] = (imap_slot_t)(2 * imap__tree_vbase128__) << imap__slot_shift__;
+            for (i = imap__tree_vbase128__; imap__node_nval128__ - 1 > i; i++)
+                tree->vec128[i].v[0] = (imap_slot_t)(2 * i + 2) << imap__slot_shift__;
+        }
+    }
+
+    static inline
+    imap_node_t *imap__create__(imap_u64_t newsize64, imap_u32_t ysize, imap_u64_t resvsize)
+    {
+        // a new tree; with IMAP_USE_RESERVE it reserves resvsize bytes (at least its size) to grow into
+        imap_node_t *newtree;
+        imap_slot_t newsize;
+        if (0 == newsize64 || imap__tree_maxsize__ < newsize64)
+            return 0;
+        newsize = (imap_slot_t)newsize64;
+    #if defined(IMAP_USE_RESERVE)
+        resvsize = imap__tree_maxsize__ < resvsize ? imap__tree_maxsize__ : resvsize;
+        resvsize = newsize64 < resvsize ? resvsize : newsize64;
+        newtree = (imap_node_t *)imap__reserve__(resvsize, newsize);
+    #else
+        (void)resvsize;
+        newtree = imap__tree_alloc__(newsize);
+    #endif
+        if (!newtree)
+            return newtree;
+        imap__tree_init__(newtree, ysize);
+    #if defined(IMAP_USE_RESERVE)
+        newtree->vecsl[imap__tree_resv__] = (imap_slot_t)resvsize;
+    #endif
+        newtree->vecsl[imap__tree_size__] = newsize;
+        return newtree;
+    }
+
+    static inline
+    imap_node_t *imap__resize__(imap_node_t *tree, imap_u64_t newsize64, imap_u32_t ysize)
+    {
+    #if !defined(IMAP_USE_RESERVE)
+        imap_node_t *newtree;
+    #endif
+        imap_slot_t newsize;
+        if (0 == newsize64 || imap__tree_maxsize__ < newsize64)
+            return 0;
+        newsize = (imap_slot_t)newsize64;
+    #if defined(IMAP_USE_RESERVE)
+        if (0 == tree)
+            return imap__create__(newsize64, ysize, IMAP_RESERVE_SIZE);
+        // commit more of the reserved range in place: the tree never moves
+        if (tree->vecsl[imap__tree_resv__] < newsize || !imap__commit__(tree, newsize))
+            return 0;
+        tree->vecsl[imap__tree_size__] = newsize;
+        return tree;
+    #else
+        if (0 == tree)
+            return imap__create__(newsize64, ysize, 0);
+        newtree = imap__tree_alloc__(newsize);
+        if (!newtree)
+            return newtree;
+        IMAP_MEMCPY(newtree, tree, tree->vecsl[imap__tree_mark__]);
+        imap__tree_free__(tree);
+        newtree->vecsl[imap__tree_size__] = newsize;
+        return newtree;
+    #endif
+    }
+
+    static inline
+    void imap__unlist__(imap_node_t *tree)
+    {
+        // move the keys of a list into the tree; the list nodes are freed first and reused by the tree,
+        // while boxed values stay where they are
+        imap_u64_t keys[imap__list_max__];
+        imap_slot_t svals[imap__list_max__];
+        imap_slot_t lval, mark;
+        imap_u32_t count, i;
+        lval = tree->vecsl[imap__tree_root__];
+        count = lval & imap__slot_pmask__;
+        for (i = 0; count > i; i++)
+        {
+            keys[i] = imap__list_keys__(tree)[i];
+            svals[i] = imap__list_slots__(tree)[i];
+        }
+        for (mark = sizeof(imap_node_t) + imap__list_size__; sizeof(imap_node_t) < mark;)
+            imap__free_node__(tree, mark -= sizeof(imap_node_t));
+        tree->vecsl[imap__tree_root__] = 0;
+        for (i = 0; count > i; i++)
+            if (svals[i] & imap__slot_value__)
+                *imap_assign(tree, keys[i]) |= svals[i] & ~imap__slot_pmask__;
+    }
+
+    static inline
+    imap_node_t *imap__ensure__(imap_node_t *tree, imap_u32_t n, imap_u32_t ysize, int list)
+    {
+        imap_u64_t newmark, oldsize, nkey;
+        imap_u32_t hasnfre, hasvfre, i;
+        imap_slot_t lval;
+        if (0 == n)
+            return tree;
+        nkey = n;
+        if (0 == tree)
+        {
+            hasnfre = 0;
+            hasvfre = 1;
+            newmark = sizeof(imap_node_t);
+            oldsize = 0;
+            if (list && imap__list_max__ >= n)
+            {
+                // a new list is allocated at its exact size; it needs no nodes until it overflows
+                newmark += imap__list_size__ + (imap_u64_t)(n - hasvfre) * ysize;
+                newmark = (newmark + sizeof(imap_node_t) - 1) & ~(imap_u64_t)(sizeof(imap_node_t) - 1);
+                tree = imap__resize__(0, newmark, ysize);
+                if (!tree)
+                    return tree;
+                for (i = 0; imap__list_max__ > i; i++)
+                {
+                    imap__list_keys__(tree)[i] = 0;
+                    imap__list_slots__(tree)[i] = 0;
+                }
+                tree->vecsl[imap__tree_root__] = imap__slot_cell__;
+                tree->vecsl[imap__tree_mark__] += imap__list_size__;
+                return tree;
+            }
+        }
+        else
+        {
+            hasnfre = !!tree->vecsl[imap__tree_nfre__];
+            hasvfre = !!tree->vecsl[imap__tree_vfre__];
+            newmark = tree->vecsl[imap__tree_mark__];
+            oldsize = tree->vecsl[imap__tree_size__];
+            lval = tree->vecsl[imap__tree_root__];
+            if (imap__slot_islist__(lval))
+            {
+                // a list with room for n more keys only needs value cells; a list that would overflow
+                // is turned into a tree, which needs nodes for the keys of the list as well
+                if ((lval & imap__slot_pmask__) + nkey <= imap__list_max__)
+                    nkey = 0;
+                else
+                    nkey += lval & imap__slot_pmask__;
+            }
+        }
+        newmark += (imap_u64_t)(nkey * 2 - (nkey ? hasnfre : 0)) * sizeof(imap_node_t) +
+            (imap_u64_t)(n - hasvfre) * ysize;
+        if (newmark > oldsize)
+        {
+            tree = imap__resize__(tree, imap__growsize__(tree, newmark), ysize);
+            if (!tree)
+                return tree;
+        }
+        if (nkey && imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+            imap__unlist__(tree);
+        return tree;
+    }
+
+    static inline
+    imap_node_t *imap__ext_ensure__(imap_node_t *tree, imap_u64_t nbyte)
+    {
+        // make room for nbyte at the mark, along with the extension node if the tree does not have one yet
+        imap_u64_t newmark = tree->vecsl[imap__tree_mark__] + nbyte;
+        if (!tree->vecsl[imap__tree_ext__])
+            newmark += sizeof(imap_node_t);
+        if (newmark > tree->vecsl[imap__tree_size__])
+        {
+            tree = imap__resize__(tree, imap__growsize__(tree, newmark), 0);
+            if (!tree)
+                return tree;
+        }
+        if (!tree->vecsl[imap__tree_ext__])
+            imap__ext_alloc__(tree);
+        return tree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_ensure(imap_node_t *tree, imap_u32_t n)
+    {
+        return imap__ensure__(tree, n, sizeof(imap_u64_t), 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_ensure0(imap_node_t *tree, imap_u32_t n)
+    {
+        return imap__ensure__(tree, n, 0, 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_ensure64(imap_node_t *tree, imap_u32_t n)
+    {
+        return imap__ensure__(tree, n, sizeof(imap_u64_t), 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_ensure128(imap_node_t *tree, imap_u32_t n)
+    {
+        return imap__ensure__(tree, n, sizeof(imap_u128_t), 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_ensure_inline(imap_node_t *tree, imap_u32_t n)
+    {
+        return imap__ensure__(tree, n, sizeof(imap_u64_t), 1);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_ensure_resv(imap_node_t *tree, imap_u32_t n, imap_u64_t resvsize)
+    {
+        if (0 == tree)
+        {
+            tree = imap__create__(sizeof(imap_node_t), sizeof(imap_u64_t), resvsize);
+            if (!tree)
+                return tree;
+        }
+        return imap__ensure__(tree, n, sizeof(imap_u64_t), 0);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_free(imap_node_t *tree)
+    {
+    #if defined(IMAP_USE_RESERVE)
+        if (0 != tree)
+            imap__release__(tree, tree->vecsl[imap__tree_resv__]);
+    #else
+        imap__tree_free__(tree);
+    #endif
+    }
+
+    static inline
+    void imap__clear__(imap_node_t *tree, imap_u32_t ysize)
+    {
+        // reset the header and keep the allocation along with its growth settings
+        imap_slot_t size, grow, budget, sparse;
+    #if defined(IMAP_USE_RESERVE)
+        imap_slot_t resv = tree->vecsl[imap__tree_resv__];
+    #endif
+        size = tree->vecsl[imap__tree_size__];
+        grow = imap__ext_get__(tree, imap__ext_grow__);
+        budget = imap__ext_get__(tree, imap__ext_budget__);
+        sparse = imap__ext_get__(tree, imap__ext_sparse__);
+        imap__tree_init__(tree, ysize);
+    #if defined(IMAP_USE_RESERVE)
+        tree->vecsl[imap__tree_resv__] = resv;
+    #endif
+        tree->vecsl[imap__tree_size__] = size;
+        if (grow || budget || sparse)
+        {
+            // the extension node is carved again right after the header, where the tree had room for it
+            imap__ext_alloc__(tree);
+            *imap__ext_slot__(tree, imap__ext_grow__) = grow;
+            *imap__ext_slot__(tree, imap__ext_budget__) = budget;
+            *imap__ext_slot__(tree, imap__ext_sparse__) = sparse;
+        }
+    }
+
+    IMAP_DEFNFUNC
+    void imap_clear(imap_node_t *tree)
+    {
+        imap__clear__(tree, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    void imap_clear0(imap_node_t *tree)
+    {
+        imap__clear__(tree, 0);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_clear64(imap_node_t *tree)
+    {
+        imap__clear__(tree, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    void imap_clear128(imap_node_t *tree)
+    {
+        imap__clear__(tree, sizeof(imap_u128_t));
+    }
+
+    IMAP_DEFNFUNC
+    imap_pool_t *imap_pool_create(imap_u32_t capacity, imap_u32_t n)
+    {
+        // the pool and its array of trees are a single allocation; trees are created up front
+        imap_pool_t *pool;
+        imap_node_t *tree;
+        pool = (imap_pool_t *)IMAP_MALLOC(sizeof(imap_pool_t) + capacity * sizeof(imap_node_t *));
+        if (!pool)
+            return pool;
+        pool->trees = (imap_node_t **)((imap_u8_t *)pool + sizeof(imap_pool_t));
+        pool->count = 0;
+        pool->capacity = capacity;
+        pool->n = n ? n : 1;
+        while (pool->count < capacity)
+        {
+            tree = imap_ensure(0, n);
+            if (!tree)
+            {
+                imap_pool_free(pool);
+                return 0;
+            }
+            pool->trees[pool->count++] = tree;
+        }
+        return pool;
+    }
+
+    IMAP_DEFNFUNC
+    void imap_pool_free(imap_pool_t *pool)
+    {
+        while (pool->count)
+            imap_free(pool->trees[--pool->count]);
+        IMAP_FREE(pool);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_pool_get(imap_pool_t *pool)
+    {
+        // an empty pool falls back to a new tree
+        if (pool->count)
+            return pool->trees[--pool->count];
+        return imap_ensure(0, pool->n);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_pool_put(imap_pool_t *pool, imap_node_t *tree)
+    {
+        if (pool->count < pool->capacity)
+        {
+            imap_clear(tree);
+            pool->trees[pool->count++] = tree;
+        }
+        else
+            imap_free(tree);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_setgrowth(imap_node_t *tree, imap_u32_t policy, imap_u64_t budget)
+    {
+        if (imap__tree_maxsize__ < budget)
+            budget = imap__tree_maxsize__;
+        // the default settings need no extension node
+        if (!tree->vecsl[imap__tree_ext__] && imap_grow_pow2 == policy && 0 == budget)
+            return tree;
+        tree = imap__ext_ensure__(tree, 0);
+        if (!tree)
+            return tree;
+        *imap__ext_slot__(tree, imap__ext_grow__) = policy;
+        *imap__ext_slot__(tree, imap__ext_budget__) = (imap_slot_t)(budget & ~(imap_u64_t)(sizeof(imap_node_t) - 1));
+        return tree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_setsparse(imap_node_t *tree, imap_u32_t enable)
+    {
+        // the layout is chosen while the tree has no keys, so that every leaf and internal node follows it
+        IMAP_ASSERT(!(tree->vecsl[imap__tree_root__] & imap__slot_value__));
+        if (!tree->vecsl[imap__tree_ext__] && !enable)
+            return tree;
+        tree = imap__ext_ensure__(tree, 0);
+        if (!tree)
+            return tree;
+        *imap__ext_slot__(tree, imap__ext_sparse__) = !!enable;
+        return tree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_setjump(imap_node_t *tree, imap_u32_t depth)
+    {
+        imap_slot_t jump = imap__ext_get__(tree, imap__ext_jump__);
+        // moving nodes would leave the table behind
+        IMAP_ASSERT(!imap__ext_get__(tree, imap__ext_cmpt__));
+        depth = imap__jump_maxdepth__ < depth ? imap__jump_maxdepth__ : depth;
+        if (jump && depth == imap__node__(tree, jump)->vec64[imap__jump_depth__])
+            return tree;
+        if (depth)
+        {
+            // the new table is carved before the old one is freed, so that failure leaves the tree as it was
+            tree = imap__ext_ensure__(tree, imap__jump_size__(depth));
+            if (!tree)
+                return tree;
+            imap__jump_alloc__(tree, depth);
+        }
+        else if (jump)
+            *imap__ext_slot__(tree, imap__ext_jump__) = 0;
+        if (jump)
+            imap__jump_free__(tree, jump);
+        return tree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_setcache(imap_node_t *tree, imap_u32_t count)
+    {
+        imap_slot_t lcache = imap__ext_get__(tree, imap__ext_lcache__);
+        // moving nodes would leave the cache behind
+        IMAP_ASSERT(!imap__ext_get__(tree, imap__ext_cmpt__));
+        if (count)
+        {
+            count = imap__lcache_maxcount__ < count ? imap__lcache_maxcount__ : count;
+            count = imap__lcache_mincount__ > count ? imap__lcache_mincount__ : count;
+            count = (imap_u32_t)imap__ceilpow2__(count);
+        }
+        if (lcache && count == imap__node__(tree, lcache)->vec64[imap__lcache_count__])
+            return tree;
+        if (count)
+        {
+            // the new cache is carved before the old one is freed, so that failure leaves the tree as it was
+            tree = imap__ext_ensure__(tree, imap__lcache_size__(count));
+            if (!tree)
+                return tree;
+            imap__lcache_alloc__(tree, count, 0, 0);
+        }
+        else if (lcache)
+            *imap__ext_slot__(tree, imap__ext_lcache__) = 0;
+        if (lcache)
+            imap__lcache_free__(tree, lcache);
+        return tree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_u32_t imap_cachestats(imap_node_t *tree, imap_u64_t *hits, imap_u64_t *misses)
+    {
+        imap_slot_t lcache = imap__ext_get__(tree, imap__ext_lcache__);
+        imap_u64_t *chdr;
+        if (!lcache)
+        {
+            *hits = *misses = 0;
+            return 0;
+        }
+        chdr = imap__node__(tree, lcache)->vec64;
+        *hits = chdr[imap__lcache_hits__];
+        *misses = chdr[imap__lcache_misses__];
+        return (imap_u32_t)chdr[imap__lcache_count__];
+    }
+
+    static inline
+    void imap__reserve_child__(imap_u32_t *pntre, imap_u32_t *pnbat, imap_u32_t *times, imap_u32_t ptree, imap_u32_t ptime)
+    {
+        // add a closed child subtree to an open internal node: children with tree keys exist before the batch
+        // is assigned; the other children appear at the batch index of their first key
+        if (ptree)
+            ++*pntre;
+        else
+        {
+            if (3 > *pnbat)
+                times[*pnbat] = ptime;
+            ++*pnbat;
+        }
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_reserve_exact(imap_node_t *tree, const imap_u64_t *xs, const imap_u64_t *ys, imap_u32_t n)
+    {
+        imap_iter_t iterdata, *iter = &iterdata;
+        imap_pair_t pair;
+        imap_u32_t posnstack[16], ntrestack[16], nbatstack[16], timestack[16][3];
+        imap_slot_t tsvals[16];
+        imap_u32_t stackp, tmask, umask, dirn, diff, last, gtree, gtime, ptree, ptime, sparse, i, k;
+        imap_u8_t *events;
+        imap_node_t *oldtree = tree, *newtree;
+        imap_slot_t mark, sval;
+        imap_u64_t tnode, unode, nboxd, ncell, nfcel, peak, nsmal, speak, nfree, g, uprev, newmark, budget;
+        if (0 == tree)
+        {
+            tree = imap__resize__(0, sizeof(imap_node_t), sizeof(imap_u64_t));
+            if (!tree)
+                return tree;
+        }
+        else if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+        {
+            // a list with room for the batch only needs value cells; otherwise it is first turned into a tree
+            nsmal = tree->vecsl[imap__tree_root__] & imap__slot_pmask__;
+            if (nsmal + n <= imap__list_max__)
+                return imap__ensure__(tree, n, sizeof(imap_u64_t), 0);
+            newmark = tree->vecsl[imap__tree_mark__] + nsmal * 2 * sizeof(imap_node_t);
+            if (newmark > tree->vecsl[imap__tree_size__])
+            {
+                budget = imap__ext_get__(tree, imap__ext_budget__);
+                newtree = 0 == budget || newmark <= budget ? imap__resize__(tree, newmark, sizeof(imap_u64_t)) : 0;
+                if (!newtree)
+                    return newtree;
+                tree = oldtree = newtree;
+            }
+            imap__unlist__(tree);
+        }
+        // in a sparse tree small nodes are created and grown into nodes as the batch is assigned; record these
+        // events by batch index (there is at most one per key), so that the peak number of small nodes is known
+        sparse = !!imap__ext_get__(tree, imap__ext_sparse__);
+        events = 0;
+        if (sparse && n)
+        {
+            events = (imap_u8_t *)IMAP_MALLOC(n);
+            if (!events)
+            {
+                if (!oldtree)
+                    imap_free(tree);
+                return 0;
+            }
+            for (i = 0; n > i; i++)
+                events[i] = 0;
+        }
+        // walk the position 0 groups of the union of the tree and batch keys in ascending order;
+        // the tree shape depends only on its keys, so the difference in node counts is exact
+        tnode = unode = nboxd = 0;
+        ncell = nfcel = peak = 0;
+        stackp = gtree = gtime = ptree = ptime = 0;
+        g = uprev = ~0ull;
+        pair = imap_iterate(tree, iter, 1);
+        for (i = 0;;)
+        {
+            last = !pair.slot && n <= i;
+            if (!last)
+            {
+                g = (pair.slot && (n <= i || pair.x <= xs[i]) ? pair.x : xs[i]) & ~0xfull;
+                for (tmask = 0; pair.slot && (pair.x & ~0xfull) == g; pair = imap_iterate(tree, iter, 0))
+                {
+                    dirn = pair.x & 0xf;
+                    tmask |= 1 << dirn;
+                    tsvals[dirn] = *pair.slot;
+                }
+                gtree = !!tmask;
+                gtime = i;
+                for (umask = tmask; n > i && (xs[i] & ~0xfull) == g; i++)
+                {
+                    IMAP_ASSERT(0 == i || xs[i - 1] <= xs[i]);
+                    dirn = xs[i] & 0xf;
+                    umask |= 1 << dirn;
+                    // a batch key with a large value needs a value cell, unless it already has one
+                    if ((n == i + 1 || xs[i + 1] != xs[i]) && ys && ys[i] >= ((imap_u64_t)1 << imap__slot_sbits__) &&
+                        !((tmask >> dirn) & 1 && imap__slot_boxed__(tsvals[dirn])))
+                        nboxd++;
+                }
+                // in a sparse tree a group with a single key is a cell; any other group is a position 0 node
+                tnode += sparse ? !!(tmask & (tmask - 1)) : !!tmask;
+                unode += sparse ? !!(umask & (umask - 1)) : !!umask;
+                // track the peak number of cells in use while the batch is assigned in ascending order:
+                // a new group takes a cell and its second key returns it
+                if (sparse && !tmask)
+                {
+                    ncell++;
+                    if (ncell > nfcel && ncell - nfcel > peak)
+                        peak = ncell - nfcel;
+                    if (umask & (umask - 1))
+                        nfcel++;
+                }
+                else if (sparse && !(tmask & (tmask - 1)) && umask != tmask)
+                    nfcel++;
+            }
+            if (~0ull != uprev)
+            {
+                // close the open internal nodes below the position where this group branches off;
+                // in a sparse tree an internal node with two children is a small node
+                diff = last ? 16 : imap__xpos__(g ^ uprev);
+                while (stackp && posnstack[stackp - 1] < diff)
+                {
+                    k = --stackp;
+                    imap__reserve_child__(&ntrestack[k], &nbatstack[k], timestack[k], ptree, ptime);
+                    tnode += 2 + sparse <= ntrestack[k];
+                    unode += 2 + sparse <= ntrestack[k] + nbatstack[k];
+                    if (sparse && 2 > ntrestack[k])
+                        events[timestack[k][1 - ntrestack[k]]] = 1;
+                    if (sparse && 3 > ntrestack[k] && 3 <= ntrestack[k] + nbatstack[k])
+                        events[timestack[k][2 - ntrestack[k]]] = 2;
+                    ptree = 0 != ntrestack[k];
+                    ptime = timestack[k][0];
+                }
+                if (last)
+                    break;
+                if (!stackp || posnstack[stackp - 1] != diff)
+                {
+                    posnstack[stackp] = diff;
+                    ntrestack[stackp] = nbatstack[stackp] = 0;
+                    stackp++;
+                }
+                imap__reserve_child__(&ntrestack[stackp - 1], &nbatstack[stackp - 1], timestack[stackp - 1],
+                    ptree, ptime);
+            }
+            else if (last)
+                break;
+            ptree = gtree;
+            ptime = gtime;
+            uprev = g;
+        }
+        // small nodes of the tree that grow may be freed before any are created; bias the count by n
+        for (nsmal = speak = n, i = 0; events && n > i; i++)
+        {
+            nsmal += 1 == events[i];
+            nsmal -= 2 == events[i];
+            if (nsmal > speak)
+                speak = nsmal;
+        }
+        speak -= n;
+        if (events)
+            IMAP_FREE(events);
+        // free nodes, free cells, free small nodes and free value cells are reused before the tree grows
+        nfree = 0;
+        for (mark = tree->vecsl[imap__tree_nfre__]; mark; mark = *(imap_slot_t *)((imap_u8_t *)tree + mark))
+            nfree++;
+        for (sval = imap__ext_get__(tree, imap__ext_cfre__); sval && peak; sval = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__])
+            peak--;
+        for (sval = imap__ext_get__(tree, imap__ext_sfre__); sval && speak; sval = (imap_slot_t)*imap__small__(tree, sval))
+            speak--;
+        for (sval = tree->vecsl[imap__tree_vfre__]; sval && nboxd; sval = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__])
+            nboxd--;
+        unode += (peak + imap__node_nval128__ - 1) / imap__node_nval128__;
+        unode += (speak + imap__node_nsmall__ - 1) / imap__node_nsmall__;
+        unode += (nboxd + imap__node_nval64__ - 1) / imap__node_nval64__;
+        newmark = tree->vecsl[imap__tree_mark__];
+        if (unode - tnode > nfree)
+            newmark += (unode - tnode - nfree) * sizeof(imap_node_t);
+        if (newmark <= tree->vecsl[imap__tree_size__])
+            return tree;
+        budget = imap__ext_get__(tree, imap__ext_budget__);
+        newtree = 0 == budget || newmark <= budget ? imap__resize__(tree, newmark, sizeof(imap_u64_t)) : 0;
+        if (!newtree && !oldtree)
+            imap_free(tree);
+        return newtree;
+    }
+
+    static inline
+    imap_u32_t imap__count_sorted__(imap_u32_t *posnstack, imap_u32_t *pstackp, imap_u64_t prev, imap_u64_t x, int first)
+    {
+        // number of nodes that x adds to a tree built from keys in ascending order (prev is the previous key)
+        imap_u32_t stackp = *pstackp, diff, nnode = 1;
+        if (!first)
+        {
+            if (!((x ^ prev) & ~0xfull))
+                return 0;
+            diff = imap__xpos__(x ^ prev);
+            while (stackp && posnstack[stackp - 1] < diff)
+                stackp--;
+            if (!stackp || posnstack[stackp - 1] != diff)
+                posnstack[stackp++] = diff, nnode++;
+        }
+        *pstackp = stackp;
+        return nnode;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_build_sorted(const imap_u64_t *xs, const imap_u64_t *ys, imap_u32_t n)
+    {
+        imap_node_t nodestack[16];
+        imap_u64_t prfxstack[16];
+        imap_u32_t posnstack[16];
+        imap_u32_t stackp;
+        imap_node_t *tree, *node;
+        imap_slot_t mark, sval;
+        imap_u32_t nnode, nboxd, posn, diff, i;
+        imap_u64_t x, newmark;
+        // first pass: count the nodes and boxed values that the second pass will allocate
+        stackp = nnode = nboxd = 0;
+        for (i = 0; n > i; i++)
+        {
+            x = xs[i];
+            IMAP_ASSERT(0 == i || xs[i - 1] <= x);
+            nnode += imap__count_sorted__(posnstack, &stackp, 0 != i ? xs[i - 1] : 0, x, 0 == i);
+            if (ys[i] >= ((imap_u64_t)1 << imap__slot_sbits__) && (0 == i || x != xs[i - 1] || ys[i - 1] < ((imap_u64_t)1 << imap__slot_sbits__)))
+                nboxd++;
+        }
+        // the header node has room for a few values; every external node is filled with values
+        newmark = (1 + nnode) * sizeof(imap_node_t);
+        if (imap__tree_nhead64__ < nboxd)
+            newmark += (nboxd - imap__tree_nhead64__ + imap__node_nval64__ - 1) / imap__node_nval64__ *
+                sizeof(imap_node_t);
+        tree = imap__resize__(0, imap__growsize__(0, newmark), sizeof(imap_u64_t));
+        if (!tree)
+            return tree;
+        // second pass: emit position 0 nodes in key order and internal nodes as soon as they are complete
+        stackp = sval = 0;
+        node = 0;
+        for (i = 0; n > i; i++)
+        {
+            x = xs[i];
+            if (0 == i || ((x ^ xs[i - 1]) & ~0xfull))
+            {
+                if (0 != i)
+                {
+                    diff = imap__xpos__(x ^ xs[i - 1]);
+                    while (stackp && posnstack[stackp - 1] < diff)
+                    {
+                        posn = posnstack[--stackp];
+                        nodestack[stackp].vecsl[imap__xdir__(xs[i - 1], posn)] = sval;
+                        mark = imap__alloc_node__(tree);
+                        node = imap__node__(tree, mark);
+                        *node = nodestack[stackp];
+                        imap__node_setprefix__(node, prfxstack[stackp]);
+                        sval = imap__slot_node__ | mark;
+                    }
+                    if (!stackp || posnstack[stackp - 1] != diff)
+                    {
+                        nodestack[stackp] = imap__node_zero__;
+                        prfxstack[stackp] = imap__xpfx__(xs[i - 1], diff) | diff;
+                        posnstack[stackp++] = diff;
+                    }
+                    nodestack[stackp - 1].vecsl[imap__xdir__(xs[i - 1], diff)] = sval;
+                }
+                mark = imap__alloc_node__(tree);
+                node = imap__node__(tree, mark);
+                *node = imap__node_zero__;
+                imap__node_setprefix__(node, x & ~0xfull);
+                sval = imap__slot_node__ | mark;
+            }
+            imap_setval(tree, &node->vecsl[x & 0xfull], ys[i]);
+        }
+        while (stackp)
+        {
+            posn = posnstack[--stackp];
+            nodestack[stackp].vecsl[imap__xdir__(xs[n - 1], posn)] = sval;
+            mark = imap__alloc_node__(tree);
+            node = imap__node__(tree, mark);
+            *node = nodestack[stackp];
+            imap__node_setprefix__(node, prfxstack[stackp]);
+            sval = imap__slot_node__ | mark;
+        }
+        tree->vecsl[imap__tree_root__] = (tree->vecsl[imap__tree_root__] & imap__slot_pmask__) | sval;
+        return tree;
+    }
+
+    static inline
+    void imap__compact_count__(imap_node_t *tree, imap_slot_t sval,
+        imap_u32_t *pnnode, imap_u32_t *pnsmal, imap_u32_t *pncell, imap_u32_t *pnboxd)
+    {
+        imap_slot_t *slot;
+        imap_u32_t dirn;
+        if (imap__slot_iscell__(sval))
+        {
+            ++*pncell;
+            if (imap__slot_boxed__(*imap__cell_slot__(tree, sval)))
+                ++*pnboxd;
+            return;
+        }
+        if (sval & imap__slot_cell__)
+            ++*pnsmal;
+        else
+            ++*pnnode;
+        for (dirn = 0; 16 > dirn; dirn++)
+        {
+            slot = imap__inner_slot__(tree, sval, dirn);
+            if (!slot)
+                continue;
+            if (*slot & imap__slot_node__)
+                imap__compact_count__(tree, *slot, pnnode, pnsmal, pncell, pnboxd);
+            else if (imap__slot_boxed__(*slot))
+                ++*pnboxd;
+        }
+    }
+
+    static inline
+    imap_slot_t imap__compact_copyval__(imap_node_t *newtree, imap_node_t *tree, imap_slot_t sval, imap_u32_t ysize)
+    {
+        imap_slot_t newsval;
+        if (!imap__slot_boxed__(sval))
+            return sval & ~imap__slot_pmask__;
+        // boxed values are allocated right after the leaf that references them
+        newsval = newtree->vecsl[imap__tree_vfre__];
+        if (sizeof(imap_u128_t) == ysize)
+        {
+            if (!newsval)
+                newsval = imap__alloc_val128__(newtree);
+            newtree->vecsl[imap__tree_vfre__] =
+                (imap_slot_t)newtree->vec128[newsval >> (imap__slot_shift__ + 1)].v[0];
+            newtree->vec128[newsval >> (imap__slot_shift__ + 1)] =
+                tree->vec128[sval >> (imap__slot_shift__ + 1)];
+        }
+        else
+        {
+            if (!newsval)
+                newsval = imap__alloc_val__(newtree);
+            newtree->vecsl[imap__tree_vfre__] = (imap_slot_t)newtree->vec64[newsval >> imap__slot_shift__];
+            newtree->vec64[newsval >> imap__slot_shift__] = tree->vec64[sval >> imap__slot_shift__];
+        }
+        return newsval;
+    }
+
+    static inline
+    imap_slot_t imap__compact_copy__(imap_node_t *newtree, imap_node_t *tree, imap_slot_t sval, imap_u32_t ysize)
+    {
+        imap_node_t *node, *newnode;
+        imap_slot_t *slots, *newslots;
+        imap_slot_t newmark, newsval;
+        imap_u32_t dirn;
+        if (imap__slot_iscell__(sval))
+        {
+            newsval = imap__alloc_cell__(newtree, *imap__cell__(tree, sval));
+            *imap__cell_slot__(newtree, newsval) =
+                imap__compact_copyval__(newtree, tree, *imap__cell_slot__(tree, sval), ysize);
+            return newsval;
+        }
+        if (sval & imap__slot_cell__)
+        {
+            // like the children of a node, the children of a small node are copied after it
+            slots = imap__small_slots__(tree, sval);
+            newsval = imap__alloc_small__(newtree, *imap__small__(tree, sval),
+                slots[0] & imap__slot_pmask__, 0, slots[1] & imap__slot_pmask__, 0);
+            newslots = imap__small_slots__(newtree, newsval);
+            newslots[0] |= imap__compact_copy__(newtree, tree, slots[0] & ~imap__slot_pmask__, ysize);
+            newslots[1] |= imap__compact_copy__(newtree, tree, slots[1] & ~imap__slot_pmask__, ysize);
+            return newsval;
+        }
+        node = imap__node__(tree, sval & imap__slot_value__);
+        newmark = imap__alloc_node__(newtree);
+        newnode = imap__node__(newtree, newmark);
+        *newnode = *node;
+        for (dirn = 0; 16 > dirn; dirn++)
+        {
+            sval = node->vecsl[dirn];
+            if (sval & imap__slot_node__)
+                newsval = imap__compact_copy__(newtree, tree, sval & ~imap__slot_pmask__, ysize);
+            else if (imap__slot_boxed__(sval))
+                newsval = imap__compact_copyval__(newtree, tree, sval, ysize);
+            else
+                continue;
+            newnode->vecsl[dirn] = (sval & imap__slot_pmask__) | newsval;
+        }
+        return imap__slot_node__ | newmark;
+    }
+
+    static inline
+    imap_node_t *imap__compact_alloc__(imap_node_t *tree, imap_u32_t ysize)
+    {
+        // allocate an empty tree with the smallest power of 2 size that fits the contents of a tree
+        imap_node_t *newtree;
+        imap_slot_t sval;
+        imap_u32_t nnode, nsmal, ncell, nboxd, nhead, nnval;
+        imap_u64_t newmark;
+        nnode = nsmal = ncell = nboxd = 0;
+        sval = tree->vecsl[imap__tree_root__];
+        if (sval & imap__slot_node__)
+            imap__compact_count__(tree, sval, &nnode, &nsmal, &ncell, &nboxd);
+        // the header node holds the first few value cells; the rest are packed into nodes
+        nhead = sizeof(imap_u64_t) == ysize ? imap__tree_nhead64__ :
+            sizeof(imap_u128_t) == ysize ? imap__tree_nhead128__ : 0;
+        nnval = ysize ? sizeof(imap_node_t) / ysize : 1;
+        newmark = (1 + nnode +
+            (nsmal + imap__node_nsmall__ - 1) / imap__node_nsmall__ +
+            (ncell + imap__node_nval128__ - 1) / imap__node_nval128__) * sizeof(imap_node_t);
+        if (nboxd > nhead)
+            newmark += (nboxd - nhead + nnval - 1) / nnval * sizeof(imap_node_t);
+        if (tree->vecsl[imap__tree_ext__])
+            newmark += sizeof(imap_node_t);
+        if (imap__ext_get__(tree, imap__ext_jump__))
+            newmark += imap__jump_size__(imap__jump_depth_of__(tree));
+        if (imap__ext_get__(tree, imap__ext_lcache__))
+            newmark += imap__lcache_size__(imap__lcache_count_of__(tree));
+    #if defined(IMAP_USE_RESERVE)
+        // a rebuilt tree keeps the reservation of the tree it replaces
+        newtree = imap__create__(imap__growsize__(0, newmark), ysize, tree->vecsl[imap__tree_resv__]);
+    #else
+        newtree = imap__create__(imap__growsize__(0, newmark), ysize, 0);
+    #endif
+        if (!newtree)
+            return newtree;
+        if (tree->vecsl[imap__tree_ext__])
+        {
+            imap__ext_alloc__(newtree);
+            *imap__ext_slot__(newtree, imap__ext_grow__) = imap__ext_get__(tree, imap__ext_grow__);
+            *imap__ext_slot__(newtree, imap__ext_budget__) = imap__ext_get__(tree, imap__ext_budget__);
+            *imap__ext_slot__(newtree, imap__ext_sparse__) = imap__ext_get__(tree, imap__ext_sparse__);
+        }
+        return newtree;
+    }
+
+    static inline
+    imap_node_t *imap__compact__(imap_node_t *tree, imap_u32_t ysize)
+    {
+        imap_node_t *newtree;
+        imap_slot_t sval = tree->vecsl[imap__tree_root__];
+        // a list is not rebuilt: it has no free nodes and stays in the tree header
+        if (imap__slot_islist__(sval))
+            return tree;
+        newtree = imap__compact_alloc__(tree, ysize);
+        if (!newtree)
+            return newtree;
+        if (sval & imap__slot_node__)
+            newtree->vecsl[imap__tree_root__] = (sval & imap__slot_pmask__) |
+                imap__compact_copy__(newtree, tree, sval & ~imap__slot_pmask__, ysize);
+        // the jump table is rebuilt after the nodes and the leaf cache starts out empty
+        if (imap__ext_get__(tree, imap__ext_jump__))
+            imap__jump_alloc__(newtree, imap__jump_depth_of__(tree));
+        imap__lcache_copy__(newtree, tree);
+        IMAP_ASSERT(newtree->vecsl[imap__tree_mark__] <= newtree->vecsl[imap__tree_size__]);
+        imap_free(tree);
+        return newtree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_compact(imap_node_t *tree)
+    {
+        return imap__compact__(tree, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_compact0(imap_node_t *tree)
+    {
+        return imap__compact__(tree, 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_compact64(imap_node_t *tree)
+    {
+        return imap__compact__(tree, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_compact128(imap_node_t *tree)
+    {
+        return imap__compact__(tree, sizeof(imap_u128_t));
+    }
+
+    static inline
+    imap_u32_t imap__relayout_height__(imap_node_t *tree, imap_slot_t sval)
+    {
+        imap_slot_t *slot;
+        imap_u32_t dirn, height, h;
+        if (imap__slot_iscell__(sval))
+            return 1;
+        height = 0;
+        for (dirn = 0; 16 > dirn; dirn++)
+        {
+            slot = imap__inner_slot__(tree, sval, dirn);
+            if (slot && (*slot & imap__slot_node__))
+            {
+                h = imap__relayout_height__(tree, *slot);
+                height = height < h ? h : height;
+            }
+        }
+        return height + 1;
+    }
+
+    static inline
+    void imap__relayout_place__(imap_node_t *newtree, imap_node_t *tree, imap_slot_t *slot, imap_u32_t ysize)
+    {
+        // copy the node that a slot of the new tree still references in the old tree;
+        // the children of the copy keep referencing the old tree until they are placed in turn
+        imap_node_t *node, *newnode;
+        imap_slot_t *slots;
+        imap_slot_t sval, newsval;
+        imap_u32_t dirn;
+        sval = *slot;
+        if (imap__slot_iscell__(sval))
+        {
+            newsval = imap__alloc_cell__(newtree, *imap__cell__(tree, sval));
+            *imap__cell_slot__(newtree, newsval) =
+                imap__compact_copyval__(newtree, tree, *imap__cell_slot__(tree, sval), ysize);
+        }
+        else if (sval & imap__slot_cell__)
+        {
+            slots = imap__small_slots__(tree, sval);
+            newsval = imap__alloc_small__(newtree, *imap__small__(tree, sval),
+                slots[0] & imap__slot_pmask__, slots[0], slots[1] & imap__slot_pmask__, slots[1]);
+        }
+        else
+        {
+            node = imap__node__(tree, sval & imap__slot_value__);
+            newsval = imap__alloc_node__(newtree);
+            newnode = imap__node__(newtree, newsval);
+            *newnode = *node;
+            if (0 == imap__node_pos__(node))
+                for (dirn = 0; 16 > dirn; dirn++)
+                    if (imap__slot_boxed__(node->vecsl[dirn]))
+                        newnode->vecsl[dirn] = (node->vecsl[dirn] & imap__slot_pmask__) |
+                            imap__compact_copyval__(newtree, tree, node->vecsl[dirn], ysize);
+            newsval |= imap__slot_node__;
+        }
+        *slot = (sval & imap__slot_pmask__) | newsval;
+    }
+
+    static inline
+    void imap__relayout__(imap_node_t *newtree, imap_node_t *tree, imap_slot_t *slot,
+        imap_u32_t depth, imap_u32_t height, imap_u32_t policy, imap_u32_t ysize)
+    {
+        // lay out the subtrees found depth levels below a slot that has been placed already;
+        // each subtree is cut after height levels
+        imap_slot_t *cslot;
+        imap_slot_t sval;
+        imap_u32_t dirn, top;
+        if (0 < depth)
+        {
+            sval = *slot;
+            if (imap__slot_iscell__(sval))
+                return;
+            for (dirn = 0; 16 > dirn; dirn++)
+            {
+                cslot = imap__inner_slot__(newtree, sval, dirn);
+                if (cslot && (*cslot & imap__slot_node__))
+                    imap__relayout__(newtree, tree, cslot, depth - 1, height, policy, ysize);
+            }
+            return;
+        }
+        if (imap_layout_dfs == policy)
+        {
+            imap__relayout_place__(newtree, tree, slot, ysize);
+            imap__relayout__(newtree, tree, slot, 1, height, policy, ysize);
+        }
+        else if (1 >= height)
+            imap__relayout_place__(newtree, tree, slot, ysize);
+        else
+        {
+            // van Emde Boas order: the top half of the levels is laid out first and recursively,
+            // followed by each of the subtrees that hang below it
+            top = height / 2;
+            imap__relayout__(newtree, tree, slot, 0, top, policy, ysize);
+            imap__relayout__(newtree, tree, slot, top, height - top, policy, ysize);
+        }
+    }
+
+    static inline
+    imap_node_t *imap__relayout_tree__(imap_node_t *tree, imap_u32_t policy, imap_u32_t ysize)
+    {
+        imap_node_t *newtree;
+        imap_slot_t *slot, sval = tree->vecsl[imap__tree_root__];
+        imap_u32_t height, depth;
+        if (imap__slot_islist__(sval))
+            return tree;
+        newtree = imap__compact_alloc__(tree, ysize);
+        if (!newtree)
+            return newtree;
+        slot = &newtree->vecsl[imap__tree_root__];
+        *slot = sval;
+        if (sval & imap__slot_node__)
+        {
+            height = imap__relayout_height__(tree, sval);
+            if (imap_layout_bfs == policy)
+                for (depth = 0; height > depth; depth++)
+                    imap__relayout__(newtree, tree, slot, depth, 1, policy, ysize);
+            else
+                imap__relayout__(newtree, tree, slot, 0, height, policy, ysize);
+        }
+        if (imap__ext_get__(tree, imap__ext_jump__))
+            imap__jump_alloc__(newtree, imap__jump_depth_of__(tree));
+        imap__lcache_copy__(newtree, tree);
+        IMAP_ASSERT(newtree->vecsl[imap__tree_mark__] <= newtree->vecsl[imap__tree_size__]);
+        imap_free(tree);
+        return newtree;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_relayout(imap_node_t *tree, imap_u32_t policy)
+    {
+        return imap__relayout_tree__(tree, policy, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_relayout0(imap_node_t *tree, imap_u32_t policy)
+    {
+        return imap__relayout_tree__(tree, policy, 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_relayout64(imap_node_t *tree, imap_u32_t policy)
+    {
+        return imap__relayout_tree__(tree, policy, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_relayout128(imap_node_t *tree, imap_u32_t policy)
+    {
+        return imap__relayout_tree__(tree, policy, sizeof(imap_u128_t));
+    }
+
+    static inline
+    imap_node_t *imap__cmpt__(imap_node_t *tree)
+    {
+        return imap__node__(tree, imap__ext_get__(tree, imap__ext_cmpt__));
+    }
+
+    static inline
+    imap_u64_t imap__cmpt_offset__(imap_u32_t list, imap_slot_t e)
+    {
+        // free node entries are marks; the other free entries are cell or value indices
+        return imap__fre_node__ == list ? e : (imap_u64_t)(e >> imap__slot_shift__) * sizeof(imap_u64_t);
+    }
+
+    static inline
+    imap_slot_t imap__cmpt_pop__(imap_node_t *tree, imap_slot_t *head, imap_u32_t list)
+    {
+        imap_slot_t e = *head;
+        *head = imap__fre_node__ == list ?
+            *(imap_slot_t *)((imap_u8_t *)tree + e) : (imap_slot_t)tree->vec64[e >> imap__slot_shift__];
+        return e;
+    }
+
+    static inline
+    void imap__cmpt_push__(imap_node_t *tree, imap_slot_t *head, imap_u32_t list, imap_slot_t e)
+    {
+        if (imap__fre_node__ == list)
+            *(imap_slot_t *)((imap_u8_t *)tree + e) = *head;
+        else
+            tree->vec64[e >> imap__slot_shift__] = *head;
+        *head = e;
+    }
+
+    static inline
+    int imap__cmpt_abort__(imap_node_t *ctrl)
+    {
+        // there is not enough free memory below the gap: give the memory set aside back
+        ctrl->vec64[imap__cmpt_limit__] = imap__cmpt_drain__;
+        ctrl->vec64[imap__cmpt_mark__] = 0;
+        return 0;
+    }
+
+    static inline
+    void imap__cmpt_reuse__(imap_node_t *tree, imap_slot_t mark, imap_u32_t list)
+    {
+        // a node that is freed to make room for a cell or small node is set aside if it lies in the gap;
+        // without other free memory for the replacement the pass is abandoned so that the node is reused
+        imap_slot_t cmpt = imap__ext_get__(tree, imap__ext_cmpt__);
+        imap_node_t *ctrl;
+        if (!cmpt || *imap__fre_list__(tree, list) || tree->vecsl[imap__tree_nfre__])
+            return;
+        ctrl = imap__node__(tree, cmpt);
+        if (imap__cmpt_ingap__(ctrl, mark))
+            imap__cmpt_abort__(ctrl);
+    }
+
+    static inline
+    int imap__cmpt_moveval__(imap_node_t *tree, imap_node_t *ctrl, imap_slot_t *slot, imap_u32_t ysize)
+    {
+        imap_slot_t sval = *slot, newsval;
+        if (!imap__slot_boxed__(sval) ||
+            !imap__cmpt_ingap__(ctrl, (imap_u64_t)(sval >> imap__slot_shift__) * sizeof(imap_u64_t)))
+            return 1;
+        // memory is only taken from the free lists: anything past the mark would be in the way
+        newsval = tree->vecsl[imap__tree_vfre__];
+        if (!newsval && !tree->vecsl[imap__tree_nfre__])
+            return imap__cmpt_abort__(ctrl);
+        if (sizeof(imap_u128_t) == ysize)
+        {
+            if (!newsval)
+                newsval = imap__alloc_val128__(tree);
+            tree->vecsl[imap__tree_vfre__] = (imap_slot_t)tree->vec128[newsval >> (imap__slot_shift__ + 1)].v[0];
+            tree->vec128[newsval >> (imap__slot_shift__ + 1)] = tree->vec128[sval >> (imap__slot_shift__ + 1)];
+        }
+        else
+        {
+            if (!newsval)
+                newsval = imap__alloc_val__(tree);
+            tree->vecsl[imap__tree_vfre__] = (imap_slot_t)tree->vec64[newsval >> imap__slot_shift__];
+            tree->vec64[newsval >> imap__slot_shift__] = tree->vec64[sval >> imap__slot_shift__];
+        }
+        imap__free_val__(tree, sval);
+        *slot = (sval & imap__slot_pmask__) | newsval;
+        return 1;
+    }
+
+    static inline
+    int imap__cmpt_move__(imap_node_t *tree, imap_node_t *ctrl, imap_slot_t *slot)
+    {
+        imap_slot_t sval = *slot, newsval, *slots;
+        if (!imap__cmpt_ingap__(ctrl, imap__inner_offset__(sval)))
+            return 1;
+        if (imap__slot_iscell__(sval))
+        {
+            if (!imap__ext_get__(tree, imap__ext_cfre__) && !tree->vecsl[imap__tree_nfre__])
+                return imap__cmpt_abort__(ctrl);
+            newsval = imap__alloc_cell__(tree, *imap__cell__(tree, sval));
+            *imap__cell_slot__(tree, newsval) = *imap__cell_slot__(tree, sval);
+            imap__free_cell__(tree, sval);
+        }
+        else if (sval & imap__slot_cell__)
+        {
+            if (!imap__ext_get__(tree, imap__ext_sfre__) && !tree->vecsl[imap__tree_nfre__])
+                return imap__cmpt_abort__(ctrl);
+            slots = imap__small_slots__(tree, sval);
+            newsval = imap__alloc_small__(tree, *imap__small__(tree, sval),
+                slots[0] & imap__slot_pmask__, slots[0], slots[1] & imap__slot_pmask__, slots[1]);
+            imap__free_small__(tree, sval);
+        }
+        else
+        {
+            if (!tree->vecsl[imap__tree_nfre__])
+                return imap__cmpt_abort__(ctrl);
+            newsval = imap__alloc_node__(tree);
+            *imap__node__(tree, newsval) = *imap__node__(tree, sval & imap__slot_value__);
+            imap__free_node__(tree, sval & imap__slot_value__);
+            newsval |= imap__slot_node__;
+        }
+        *slot = (sval & imap__slot_pmask__) | newsval;
+        return 1;
+    }
+
+    static inline
+    int imap__cmpt_walk__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x, imap_u32_t ysize, imap_u32_t *pbudget)
+    {
+        // visit the part of a subtree at or after x in post order and either measure the memory it uses
+        // or move what it keeps in the gap below it; returns 0 when the budget runs out or the pass aborts
+        imap_node_t *ctrl = imap__cmpt__(tree);
+        int measure = imap__cmpt_measure__ == (ctrl->vec64[imap__cmpt_limit__] & imap__cmpt_phase__);
+        imap_slot_t *cslot;
+        imap_slot_t sval, cval;
+        imap_u32_t posn, dirn;
+        imap_u64_t prfx, mask, next;
+        sval = *slot;
+        if (imap__slot_iscell__(sval))
+        {
+            if (*imap__cell__(tree, sval) < x)
+                return 1;
+            if (measure)
+            {
+                ctrl->vec64[imap__cmpt_count__] += sizeof(imap_u128_t) +
+                    (imap__slot_boxed__(*imap__cell_slot__(tree, sval)) ? ysize : 0);
+                return 1;
+            }
+            return imap__cmpt_move__(tree, ctrl, slot) &&
+                imap__cmpt_moveval__(tree, ctrl, imap__cell_slot__(tree, *slot), ysize);
+        }
+        posn = imap__inner_pos__(tree, sval);
+        prfx = imap__inner_prefix__(tree, sval);
+        mask = 15 == posn ? ~0ull : (0x10ull << (posn << 2)) - 1;
+        if ((prfx | mask) < x)
+            return 1;
+        if (0 != posn)
+        {
+            for (dirn = (prfx & ~mask) < x ? imap__xdir__(x, posn) : 0; 16 > dirn; dirn++)
+            {
+                cslot = imap__inner_slot__(tree, sval, dirn);
+                if (!cslot)
+                    continue;
+                cval = *cslot;
+                if (!(cval & imap__slot_node__))
+                    continue;
+                if (0 == *pbudget && imap__slot_isinner__(cval))
+                {
+                    next = (prfx & ~mask) | ((imap_u64_t)dirn << (posn << 2));
+                    ctrl->vec64[imap__cmpt_x__] = next < x ? x : next;
+                    return 0;
+                }
+                if (!imap__cmpt_walk__(tree, cslot, x, ysize, pbudget))
+                    return 0;
+            }
+        }
+        if (0 != *pbudget)
+            --*pbudget;
+        if (measure)
+        {
+            ctrl->vec64[imap__cmpt_count__] += sval & imap__slot_cell__ ? imap__small_size__ : sizeof(imap_node_t);
+            if (0 == posn)
+                for (dirn = 0; 16 > dirn; dirn++)
+                    if (imap__slot_boxed__(imap__node__(tree, sval & imap__slot_value__)->vecsl[dirn]))
+                        ctrl->vec64[imap__cmpt_count__] += ysize;
+            return 1;
+        }
+        if (0 == posn)
+            for (dirn = 0; 16 > dirn; dirn++)
+                if (!imap__cmpt_moveval__(tree, ctrl, &imap__node__(tree, sval & imap__slot_value__)->vecsl[dirn], ysize))
+                    return 0;
+        return imap__cmpt_move__(tree, ctrl, slot);
+    }
+
+    static inline
+    void imap__cmpt_finish__(imap_node_t *tree)
+    {
+        imap_slot_t cmpt = imap__ext_get__(tree, imap__ext_cmpt__);
+        *imap__ext_slot__(tree, imap__ext_cmpt__) = 0;
+        imap__free_node__(tree, cmpt);
+    }
+
+    static inline
+    int imap__compact_step__(imap_node_t *tree, imap_u32_t budget, imap_u32_t ysize)
+    {
+        // a pass measures the memory in use, sets the top of the tree aside as a gap, moves everything
+        // that lives in the gap into the free memory below it and finally lowers the mark past the gap
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_node_t *ctrl;
+        imap_slot_t cmpt, e;
+        imap_u64_t live, limit, mark, offset, size;
+        imap_u32_t i;
+        budget = budget ? budget : 1;
+        if (imap__slot_islist__(*slot))
+            return 0;
+        cmpt = imap__ext_get__(tree, imap__ext_cmpt__);
+        if (!cmpt)
+        {
+            // the jump table and the leaf cache reference nodes by mark and a pass moves them:
+            // both are dropped
+            if (0 != (e = imap__ext_get__(tree, imap__ext_jump__)))
+            {
+                *imap__ext_slot__(tree, imap__ext_jump__) = 0;
+                imap__jump_free__(tree, e);
+            }
+            if (0 != (e = imap__ext_get__(tree, imap__ext_lcache__)))
+            {
+                *imap__ext_slot__(tree, imap__ext_lcache__) = 0;
+                imap__lcache_free__(tree, e);
+            }
+            // the node of the pass is referenced from the extension node, which may have to be carved as well
+            i = tree->vecsl[imap__tree_ext__] ? 1 : 2;
+            for (e = tree->vecsl[imap__tree_nfre__]; e && i; e = *(imap_slot_t *)((imap_u8_t *)tree + e))
+                i--;
+            if (tree->vecsl[imap__tree_mark__] + i * sizeof(imap_node_t) > tree->vecsl[imap__tree_size__])
+                return 0;
+            if (!tree->vecsl[imap__tree_ext__])
+                imap__ext_alloc__(tree);
+            cmpt = imap__alloc_node__(tree);
+            *imap__node__(tree, cmpt) = imap__node_zero__;
+            imap__node__(tree, cmpt)->vec64[imap__cmpt_limit__] = imap__cmpt_measure__;
+            *imap__ext_slot__(tree, imap__ext_cmpt__) = cmpt;
+        }
+        ctrl = imap__cmpt__(tree);
+        switch (ctrl->vec64[imap__cmpt_limit__] & imap__cmpt_phase__)
+        {
+        case imap__cmpt_measure__:
+            if ((*slot & imap__slot_node__) && !imap__cmpt_walk__(tree, slot, ctrl->vec64[imap__cmpt_x__], ysize, &budget))
+                return 1;
+            // the gap starts halfway between the memory in use and the mark
+            mark = tree->vecsl[imap__tree_mark__];
+            live = 3 * sizeof(imap_node_t) + ctrl->vec64[imap__cmpt_count__];
+            limit = live < mark ? live + (mark - live) / 2 : mark;
+            limit = (limit + sizeof(imap_node_t) - 1) & ~(imap_u64_t)(sizeof(imap_node_t) - 1);
+            if (limit + sizeof(imap_node_t) > mark)
+            {
+                imap__cmpt_finish__(tree);
+                return 0;
+            }
+            for (i = 0; 4 > i; i++)
+            {
+                ctrl->vecsl[imap__cmpt_old__ + i] = *imap__fre_list__(tree, i);
+                *imap__fre_list__(tree, i) = 0;
+            }
+            ctrl->vec64[imap__cmpt_x__] = 0;
+            ctrl->vec64[imap__cmpt_count__] = 0;
+            ctrl->vec64[imap__cmpt_limit__] = limit | imap__cmpt_sort__;
+            ctrl->vec64[imap__cmpt_mark__] = mark;
+            return 1;
+        case imap__cmpt_sort__:
+            // free memory below the gap goes back to the tree; free memory in the gap is set aside
+            for (i = 0; 4 > i && budget;)
+            {
+                e = ctrl->vecsl[imap__cmpt_old__ + i];
+                if (!e)
+                {
+                    i++;
+                    continue;
+                }
+                imap__cmpt_pop__(tree, &ctrl->vecsl[imap__cmpt_old__ + i], i);
+                offset = imap__cmpt_offset__(i, e);
+                size =
+                    imap__fre_node__ == i ? sizeof(imap_node_t) :
+                    imap__fre_small__ == i ? imap__small_size__ :
+                    imap__fre_cell__ == i || sizeof(imap_u128_t) == ysize ? sizeof(imap_u128_t) :
+                    sizeof(imap_u64_t);
+                if (imap__cmpt_ingap__(ctrl, offset))
+                {
+                    imap__cmpt_push__(tree, &ctrl->vecsl[imap__cmpt_dead__ + i], i, e);
+                    ctrl->vec64[imap__cmpt_count__] += size;
+                }
+                else
+                {
+                    imap__cmpt_push__(tree, imap__fre_list__(tree, i), i, e);
+                    ctrl->vec64[imap__cmpt_x__] += size;
+                }
+                budget--;
+            }
+            if (4 > i)
+                return 1;
+            mark = ctrl->vec64[imap__cmpt_mark__];
+            limit = ctrl->vec64[imap__cmpt_limit__] & ~(imap_u64_t)imap__cmpt_phase__;
+            if (mark - limit > ctrl->vec64[imap__cmpt_count__] + ctrl->vec64[imap__cmpt_x__])
+            {
+                imap__cmpt_abort__(ctrl);
+                return 1;
+            }
+            // the extension node and the node of the pass move out of the gap first
+            e = tree->vecsl[imap__tree_ext__];
+            if (imap__cmpt_ingap__(ctrl, e))
+            {
+                if (!tree->vecsl[imap__tree_nfre__])
+                {
+                    imap__cmpt_abort__(ctrl);
+                    return 1;
+                }
+                tree->vecsl[imap__tree_ext__] = imap__alloc_node__(tree);
+                *imap__node__(tree, tree->vecsl[imap__tree_ext__]) = *imap__node__(tree, e);
+                imap__free_node__(tree, e);
+            }
+            if (imap__cmpt_ingap__(ctrl, cmpt))
+            {
+                if (!tree->vecsl[imap__tree_nfre__])
+                {
+                    imap__cmpt_abort__(ctrl);
+                    return 1;
+                }
+                e = imap__alloc_node__(tree);
+                *imap__node__(tree, e) = *ctrl;
+                *imap__ext_slot__(tree, imap__ext_cmpt__) = e;
+                ctrl = imap__cmpt__(tree);
+                imap__free_node__(tree, cmpt);
+            }
+            ctrl->vec64[imap__cmpt_x__] = 0;
+            ctrl->vec64[imap__cmpt_limit__] = limit | imap__cmpt_evacuate__;
+            return 1;
+        case imap__cmpt_evacuate__:
+            if ((*slot & imap__slot_node__) && !imap__cmpt_walk__(tree, slot, ctrl->vec64[imap__cmpt_x__], ysize, &budget))
+                return 1;
+            limit = ctrl->vec64[imap__cmpt_limit__] & ~(imap_u64_t)imap__cmpt_phase__;
+            if (tree->vecsl[imap__tree_mark__] == ctrl->vec64[imap__cmpt_mark__])
+            {
+                // nothing lives in the gap: the memory set aside there is dropped with it
+                tree->vecsl[imap__tree_mark__] = (imap_slot_t)limit;
+                imap__cmpt_finish__(tree);
+                return 0;
+            }
+            // nodes were allocated past the gap since the pass started: the gap is freed node by node instead
+            for (i = 0; 4 > i; i++)
+                ctrl->vecsl[imap__cmpt_dead__ + i] = 0;
+            ctrl->vec64[imap__cmpt_x__] = ctrl->vec64[imap__cmpt_mark__];
+            ctrl->vec64[imap__cmpt_count__] = limit;
+            ctrl->vec64[imap__cmpt_limit__] = imap__cmpt_release__;
+            ctrl->vec64[imap__cmpt_mark__] = 0;
+            return 1;
+        case imap__cmpt_release__:
+            for (; budget && ctrl->vec64[imap__cmpt_x__] > ctrl->vec64[imap__cmpt_count__]; budget--)
+            {
+                imap__free_node__(tree, (imap_slot_t)ctrl->vec64[imap__cmpt_count__]);
+                ctrl->vec64[imap__cmpt_count__] += sizeof(imap_node_t);
+            }
+            if (ctrl->vec64[imap__cmpt_x__] > ctrl->vec64[imap__cmpt_count__])
+                return 1;
+            imap__cmpt_finish__(tree);
+            return 0;
+        case imap__cmpt_drain__:
+            for (i = 0; 8 > i && budget;)
+            {
+                e = ctrl->vecsl[i];
+                if (!e)
+                {
+                    i++;
+                    continue;
+                }
+                imap__cmpt_pop__(tree, &ctrl->vecsl[i], i & 3);
+                imap__cmpt_push__(tree, imap__fre_list__(tree, i & 3), i & 3, e);
+                budget--;
+            }
+            if (8 > i)
+                return 1;
+            imap__cmpt_finish__(tree);
+            return 0;
+        }
+        return 0;
+    }
+
+    IMAP_DEFNFUNC
+    int imap_compact_step(imap_node_t *tree, imap_u32_t budget)
+    {
+        return imap__compact_step__(tree, budget, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    int imap_compact_step0(imap_node_t *tree, imap_u32_t budget)
+    {
+        return imap__compact_step__(tree, budget, 0);
+    }
+
+    IMAP_DEFNFUNC
+    int imap_compact_step64(imap_node_t *tree, imap_u32_t budget)
+    {
+        return imap__compact_step__(tree, budget, sizeof(imap_u64_t));
+    }
+
+    IMAP_DEFNFUNC
+    int imap_compact_step128(imap_node_t *tree, imap_u32_t budget)
+    {
+        return imap__compact_step__(tree, budget, sizeof(imap_u128_t));
+    }
+
+    static inline
+    imap_slot_t *imap__list_lookup__(imap_node_t *tree, imap_slot_t lval, imap_u64_t x)
+    {
+        imap_slot_t *slot;
+        imap_u32_t i = imap__list_find__(tree, lval, x);
+        if ((lval & imap__slot_pmask__) == i)
+            return 0;
+        slot = &imap__list_slots__(tree)[i];
+        return *slot & imap__slot_value__ ? slot : 0;
+    }
+
+    static inline
+    imap_slot_t *imap__lookup__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x, imap_u64_t *entry)
+    {
+        // descend from a slot that references the root of a (sub)tree; if entry is not null,
+        // it is filled with the position 0 node of x for the leaf cache
+        imap_node_t *node = tree;
+        imap_slot_t sval;
+        imap_u32_t posn = 16;
+        for (;;)
+        {
+            sval = *slot;
+            if (!(sval & imap__slot_node__))
+            {
+                if (0 == posn && imap__node_prefix__(node) == (x & ~0xfull))
+                {
+                    // the position 0 node of x is cached whether or not x has a value
+                    if (entry)
+                    {
+                        entry[0] = x & ~0xfull;
+                        entry[1] = (imap_u64_t)((imap_u8_t *)node - (imap_u8_t *)tree);
+                    }
+                    return sval & imap__slot_value__ ? slot : 0;
+                }
+                // an inline small map is the only root that is neither a node nor empty
+                if (16 == posn && imap__slot_islist__(sval))
+                    return imap__list_lookup__(tree, sval, x);
+                return 0;
+            }
+            if (sval & imap__slot_cell__)
+            {
+                if (!(sval & imap__slot_small__))
+                {
+                    slot = imap__cell_slot__(tree, sval);
+                    return (*slot & imap__slot_value__) && *imap__cell__(tree, sval) == x ? slot : 0;
+                }
+                slot = imap__small_slot__(tree, sval,
+                    imap__xdir__(x, (imap_u32_t)(*imap__small__(tree, sval) & imap__prefix_pos__)));
+                if (!slot)
+                    return 0;
+                continue;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    static inline
+    imap_slot_t *imap__lookup_plain__(imap_node_t *tree, imap_u64_t x)
+    {
+        // a tree without an extension node has neither cells nor small nodes
+        imap_node_t *node = tree;
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t sval;
+        imap_u32_t posn = 16;
+        for (;;)
+        {
+            sval = *slot;
+            if (!(sval & imap__slot_node__))
+            {
+                if (0 == posn && imap__node_prefix__(node) == (x & ~0xfull))
+                    return sval & imap__slot_value__ ? slot : 0;
+                // an inline small map is the only root that is neither a node nor empty
+                if (16 == posn && imap__slot_islist__(sval))
+                    return imap__list_lookup__(tree, sval, x);
+                return 0;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t *imap_lookup(imap_node_t *tree, imap_u64_t x)
+    {
+        imap_node_t *node;
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t *jslot;
+        imap_slot_t lcache;
+        imap_u64_t *chdr, *entry = 0;
+        // without an extension node there is no leaf cache or jump table to consult
+        if (!tree->vecsl[imap__tree_ext__])
+            return imap__lookup_plain__(tree, x);
+        if (imap__slot_islist__(*slot))
+            return imap__list_lookup__(tree, *slot, x);
+        lcache = imap__ext_get__(tree, imap__ext_lcache__);
+        // a leaf cache hit goes straight to the position 0 node of x
+        if (lcache)
+        {
+            chdr = imap__node__(tree, lcache)->vec64;
+            entry = imap__lcache_entry__(tree, lcache, x & ~0xfull);
+            if (entry[0] == (x & ~0xfull))
+            {
+                chdr[imap__lcache_hits__]++;
+                node = imap__node__(tree, (imap_slot_t)entry[1]);
+                IMAP_ASSERT(imap__node_prefix__(node) == (x & ~0xfull));
+                slot = &node->vecsl[x & 0xf];
+                return *slot & imap__slot_value__ ? slot : 0;
+            }
+            chdr[imap__lcache_misses__]++;
+        }
+        // the jump table entry references the node below the top levels as the slot of its parent would
+        if (0 != (jslot = imap__jump_slot__(tree, x)))
+            slot = jslot;
+        return imap__lookup__(tree, slot, x, entry);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_lookup_batch(imap_node_t *tree, const imap_u64_t *xs, imap_slot_t **out, imap_u32_t n)
+    {
+        imap_node_t *nodestack[imap__batch_group__];
+        imap_slot_t cvalstack[imap__batch_group__];
+        imap_u32_t indxstack[imap__batch_group__];
+        imap_node_t *node;
+        imap_slot_t *slot;
+        imap_slot_t sval;
+        imap_u32_t posn, i, j, k, m;
+        imap_u64_t x;
+        for (i = 0; n > i; i += m)
+        {
+            m = n - i < imap__batch_group__ ? n - i : imap__batch_group__;
+            sval = tree->vecsl[imap__tree_root__];
+            if (!(sval & imap__slot_node__))
+            {
+                for (j = 0; m > j; j++)
+                    out[i + j] = imap__slot_islist__(sval) ? imap__list_lookup__(tree, sval, xs[i + j]) : 0;
+                continue;
+            }
+            node = sval & imap__slot_cell__ ? 0 : imap__node__(tree, sval & imap__slot_value__);
+            for (j = 0; m > j; j++)
+                nodestack[j] = node, cvalstack[j] = sval, indxstack[j] = i + j;
+            // advance all keys in the group by one node per round;
+            // the next node, small node or cell of each key is prefetched while the other keys are processed
+            for (k = m; k;)
+                for (j = 0; k > j;)
+                {
+                    node = nodestack[j];
+                    x = xs[indxstack[j]];
+                    if (node)
+                    {
+                        posn = imap__node_pos__(node);
+                        slot = &node->vecsl[imap__xdir__(x, posn)];
+                    }
+                    else
+                    {
+                        sval = cvalstack[j];
+                        if (!(sval & imap__slot_small__))
+                        {
+                            // a cell ends the search
+                            slot = imap__cell_slot__(tree, sval);
+                            out[indxstack[j]] =
+                                (*slot & imap__slot_value__) && *imap__cell__(tree, sval) == x ? slot : 0;
+                            goto done;
+                        }
+                        posn = (imap_u32_t)(*imap__small__(tree, sval) & imap__prefix_pos__);
+                        slot = imap__small_slot__(tree, sval, imap__xdir__(x, posn));
+                        if (!slot)
+                        {
+                            out[indxstack[j]] = 0;
+                            goto done;
+                        }
+                    }
+                    sval = *slot;
+                    if (sval & imap__slot_node__)
+                    {
+                        if (sval & imap__slot_cell__)
+                        {
+                            IMAP_PREFETCH(imap__small__(tree, sval));
+                            nodestack[j] = 0;
+                            cvalstack[j++] = sval;
+                            continue;
+                        }
+                        node = imap__node__(tree, sval & imap__slot_value__);
+                        IMAP_PREFETCH(node);
+                        nodestack[j++] = node;
+                        continue;
+                    }
+                    if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull))
+                    {
+                        IMAP_ASSERT(0 == posn);
+                        out[indxstack[j]] = slot;
+                    }
+                    else
+                        out[indxstack[j]] = 0;
+                done:
+                    // key is done; replace it with the last active key in the group
+                    k--;
+                    nodestack[j] = nodestack[k];
+                    cvalstack[j] = cvalstack[k];
+                    indxstack[j] = indxstack[k];
+                }
+        }
+    }
+
+    static inline
+    imap_slot_t *imap__promote__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x)
+    {
+        // a second key with the prefix of a cell turns the cell into a position 0 node
+        imap_node_t *newnode;
+        imap_slot_t newmark, cval = *slot;
+        newmark = imap__alloc_node__(tree);
+        newnode = imap__node__(tree, newmark);
+        *newnode = imap__node_zero__;
+        imap__node_setprefix__(newnode, x & ~0xfull);
+        newnode->vecsl[*imap__cell__(tree, cval) & 0xfull] |= *imap__cell_slot__(tree, cval) & ~imap__slot_pmask__;
+        imap__free_cell__(tree, cval);
+        *slot = (cval & imap__slot_pmask__) | imap__slot_node__ | newmark;
+        imap__jump_update__(tree, x, 0);
+        return &newnode->vecsl[x & 0xfull];
+    }
+
+    static inline
+    imap_slot_t *imap__grow__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x)
+    {
+        // a third child turns a small node into a node; the new key is stored in a cell
+        imap_node_t *newnode;
+        imap_slot_t *slots;
+        imap_slot_t newmark, cval, sval = *slot;
+        imap_u64_t prfx;
+        prfx = *imap__small__(tree, sval);
+        slots = imap__small_slots__(tree, sval);
+        newmark = imap__alloc_node__(tree);
+        newnode = imap__node__(tree, newmark);
+        *newnode = imap__node_zero__;
+        newnode->vecsl[slots[0] & imap__slot_pmask__] = slots[0] & ~imap__slot_pmask__;
+        newnode->vecsl[slots[1] & imap__slot_pmask__] = slots[1] & ~imap__slot_pmask__;
+        cval = imap__alloc_cell__(tree, x);
+        newnode->vecsl[imap__xdir__(x, prfx & imap__prefix_pos__)] = cval;
+        imap__node_setprefix__(newnode, prfx);
+        imap__free_small__(tree, sval);
+        *slot = (sval & imap__slot_pmask__) | imap__slot_node__ | newmark;
+        imap__jump_update__(tree, prfx, (imap_u32_t)(prfx & imap__prefix_pos__));
+        return imap__cell_slot__(tree, cval);
+    }
+
+    static inline
+    imap_slot_t *imap__attach__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t prfx, imap_u32_t diff,
+        imap_u64_t x, int split)
+    {
+        // outside the sparse layout a new key gets a position 0 node; if it branches off above the slot,
+        // an internal node at position diff joins the new node and the subtree of the slot
+        imap_node_t *newnode;
+        imap_slot_t newmark, sval = *slot;
+        newmark = imap__alloc_node__(tree);
+        *slot = (sval & imap__slot_pmask__) | imap__slot_node__ | newmark;
+        if (split)
+        {
+            newnode = imap__node__(tree, newmark);
+            *newnode = imap__node_zero__;
+            newmark = imap__alloc_node__(tree);
+            newnode->vecsl[imap__xdir__(prfx, diff)] = sval;
+            newnode->vecsl[imap__xdir__(x, diff)] = imap__slot_node__ | newmark;
+            imap__node_setprefix__(newnode, imap__xpfx__(prfx, diff) | diff);
+        }
+        newnode = imap__node__(tree, newmark);
+        *newnode = imap__node_zero__;
+        imap__node_setprefix__(newnode, x & ~0xfull);
+        imap__jump_update__(tree, x, split ? diff : 0);
+        return &newnode->vecsl[x & 0xfull];
+    }
+
+    static inline
+    imap_slot_t *imap__list_assign__(imap_node_t *tree, imap_u64_t x)
+    {
+        // keys are kept sorted; imap_ensure turns a full list into a tree before it can overflow
+        imap_u64_t *keys = imap__list_keys__(tree);
+        imap_slot_t *slots = imap__list_slots__(tree);
+        imap_slot_t lval = tree->vecsl[imap__tree_root__];
+        imap_u32_t i, j;
+        i = imap__list_lower__(tree, lval, x);
+        if ((lval & imap__slot_pmask__) > i && keys[i] == x)
+            return &slots[i];
+        IMAP_ASSERT(imap__list_max__ > (lval & imap__slot_pmask__));
+        for (j = lval & imap__slot_pmask__; j > i; j--)
+        {
+            keys[j] = keys[j - 1];
+            slots[j] = slots[j - 1];
+        }
+        keys[i] = x;
+        slots[i] = 0;
+        tree->vecsl[imap__tree_root__] = lval + 1;
+        return &slots[i];
+    }
+
+    static inline
+    imap_slot_t *imap__assign__(imap_node_t *tree, imap_node_t *node, imap_slot_t *slot, imap_u32_t posn,
+        imap_u64_t x)
+    {
+        // descend from a slot of node at position posn (the root slot has position 16)
+        imap_slot_t *slotstack[16 + 1];
+        imap_u32_t posnstack[16 + 1];
+        imap_u32_t stackp, stacki;
+        imap_slot_t cval, sval;
+        imap_u32_t diff;
+        imap_u64_t prfx;
+        stackp = 0;
+        for (;;)
+        {
+            sval = *slot;
+            slotstack[stackp] = slot, posnstack[stackp++] = posn;
+            if (!(sval & imap__slot_node__) || (sval & imap__slot_cell__))
+            {
+                if (imap__slot_issmall__(sval))
+                {
+                    prfx = *imap__small__(tree, sval);
+                    posn = (imap_u32_t)(prfx & imap__prefix_pos__);
+                    if (0 != (slot = imap__small_slot__(tree, sval, imap__xdir__(x, posn))))
+                        continue;
+                    // a small node whose subtree contains x gets a third child
+                    if (imap__xpos__(prfx ^ x) <= posn)
+                        return imap__grow__(tree, slotstack[stackp - 1], x);
+                }
+                else if (sval & imap__slot_node__)
+                {
+                    // a cell acts as a position 0 node whose prefix is the full key
+                    prfx = *imap__cell__(tree, sval);
+                    if (prfx == x)
+                        return imap__cell_slot__(tree, sval);
+                    if (!((prfx ^ x) & ~0xfull))
+                        return imap__promote__(tree, slot, x);
+                    posn = 0;
+                }
+                else
+                {
+                    prfx = imap__node_prefix__(node);
+                    if (0 == posn && prfx == (x & ~0xfull))
+                        return slot;
+                }
+                diff = imap__xpos__(prfx ^ x);
+                IMAP_ASSERT(diff < 16);
+                for (stacki = stackp; diff > posn;)
+                    posn = posnstack[--stacki];
+                slot = slotstack[stacki == stackp ? stackp - 1 : stacki];
+                if (!imap__ext_get__(tree, imap__ext_sparse__))
+                    return imap__attach__(tree, slot, prfx, diff, x, stacki != stackp);
+                cval = imap__alloc_cell__(tree, x);
+                if (stacki != stackp)
+                {
+                    // the new key branches off above the slot: a small node joins the two subtrees
+                    sval = *slot;
+                    IMAP_ASSERT(sval & imap__slot_node__);
+                    *slot = (sval & imap__slot_pmask__) | imap__alloc_small__(tree, imap__xpfx__(prfx, diff) | diff,
+                        imap__xdir__(prfx, diff), sval, imap__xdir__(x, diff), cval);
+                    imap__jump_update__(tree, x, diff);
+                }
+                else
+                    *slot = (*slot & imap__slot_pmask__) | cval;
+                return imap__cell_slot__(tree, cval);
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    static inline
+    imap_slot_t *imap__assign_plain__(imap_node_t *tree, imap_u64_t x)
+    {
+        // a tree without an extension node has neither cells, small nodes nor a jump table
+        imap_slot_t *slotstack[16 + 1];
+        imap_u32_t posnstack[16 + 1];
+        imap_u32_t stackp, stacki;
+        imap_node_t *node = tree;
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t sval;
+        imap_u32_t diff, posn = 16;
+        imap_u64_t prfx;
+        stackp = 0;
+        for (;;)
+        {
+            sval = *slot;
+            slotstack[stackp] = slot, posnstack[stackp++] = posn;
+            if (!(sval & imap__slot_node__))
+            {
+                prfx = imap__node_prefix__(node);
+                if (0 == posn && prfx == (x & ~0xfull))
+                    return slot;
+                diff = imap__xpos__(prfx ^ x);
+                IMAP_ASSERT(diff < 16);
+                for (stacki = stackp; diff > posn;)
+                    posn = posnstack[--stacki];
+                return imap__attach__(tree, slotstack[stacki == stackp ? stackp - 1 : stacki],
+                    prfx, diff, x, stacki != stackp);
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t *imap_assign(imap_node_t *tree, imap_u64_t x)
+    {
+        imap_node_t *node;
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t *jslot;
+        if (imap__slot_islist__(*slot))
+            return imap__list_assign__(tree, x);
+        if (!tree->vecsl[imap__tree_ext__])
+            return imap__assign_plain__(tree, x);
+        if (0 != (jslot = imap__jump_slot__(tree, x)))
+        {
+            // start at the node of the jump table entry: x shares the digits above it,
+            // so a new key never branches off above the node and its parents need not be recorded
+            node = imap__node__(tree, *jslot & imap__slot_value__);
+            return imap__assign__(tree, node, &node->vecsl[imap__xdir__(x, imap__node_pos__(node))],
+                imap__node_pos__(node), x);
+        }
+        return imap__assign__(tree, tree, slot, 16, x);
+    }
+
+    IMAP_DEFNFUNC
+    int imap_hasval(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        return sval & imap__slot_value__;
+    }
+
+    IMAP_DEFNFUNC
+    imap_u64_t imap_getval(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        if (!imap__slot_boxed__(sval))
+            return sval >> imap__slot_shift__;
+        else
+            return tree->vec64[sval >> imap__slot_shift__];
+    }
+
+    IMAP_DEFNFUNC
+    imap_u32_t imap_getval0(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        return (imap_u32_t)(sval >> imap__slot_shift__);
+    }
+
+    IMAP_DEFNFUNC
+    imap_u64_t imap_getval64(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        return tree->vec64[sval >> imap__slot_shift__];
+    }
+
+    IMAP_DEFNFUNC
+    imap_u128_t imap_getval128(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        return tree->vec128[sval >> (imap__slot_shift__ + 1)];
+    }
+
+    IMAP_DEFNFUNC
+    void imap_getval_batch(imap_node_t *tree, imap_slot_t **slots, imap_u64_t *ys, imap_u32_t n)
+    {
+        imap_slot_t *slot;
+        imap_slot_t sval;
+        imap_u32_t i, j, m;
+        for (i = 0; n > i; i += m)
+        {
+            m = n - i < imap__batch_group__ ? n - i : imap__batch_group__;
+            for (j = 0; m > j; j++)
+            {
+                slot = slots[i + j];
+                if (slot && (sval = *slot, imap__slot_boxed__(sval)))
+                    IMAP_PREFETCH(&tree->vec64[sval >> imap__slot_shift__]);
+            }
+            for (j = 0; m > j; j++)
+            {
+                slot = slots[i + j];
+                ys[i + j] = slot ? imap_getval(tree, slot) : 0;
+            }
+        }
+    }
+
+    IMAP_DEFNFUNC
+    void imap_setval(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        if (y < ((imap_u64_t)1 << imap__slot_sbits__))
+        {
+            if (imap__slot_boxed__(sval))
+                imap__free_val__(tree, sval);
+            *slot = (*slot & imap__slot_pmask__) | imap__slot_scalar__ | ((imap_slot_t)y << imap__slot_shift__);
+        }
+        else
+        {
+            if (!imap__slot_boxed__(sval))
+            {
+                sval = tree->vecsl[imap__tree_vfre__];
+                if (!sval)
+                    sval = imap__alloc_val__(tree);
+                IMAP_ASSERT(sval >> imap__slot_shift__);
+                tree->vecsl[imap__tree_vfre__] = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__];
+            }
+            IMAP_ASSERT(!(sval & imap__slot_node__));
+            IMAP_ASSERT(imap__slot_boxed__(sval));
+            *slot = (*slot & imap__slot_pmask__) | sval;
+            tree->vec64[sval >> imap__slot_shift__] = y;
+        }
+    }
+
+    IMAP_DEFNFUNC
+    void imap_setval0(imap_node_t *tree, imap_slot_t *slot, imap_u32_t y)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        *slot = (*slot & imap__slot_pmask__) | imap__slot_scalar__ | ((imap_slot_t)y << imap__slot_shift__);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_setval64(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        if (!(sval >> imap__slot_shift__))
+        {
+            sval = tree->vecsl[imap__tree_vfre__];
+            if (!sval)
+                sval = imap__alloc_val__(tree);
+            IMAP_ASSERT(sval >> imap__slot_shift__);
+            tree->vecsl[imap__tree_vfre__] = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__];
+        }
+        IMAP_ASSERT(!(sval & imap__slot_node__));
+        IMAP_ASSERT(imap__slot_boxed__(sval));
+        *slot = (*slot & imap__slot_pmask__) | sval;
+        tree->vec64[sval >> imap__slot_shift__] = y;
+    }
+
+    IMAP_DEFNFUNC
+    void imap_setval128(imap_node_t *tree, imap_slot_t *slot, imap_u128_t y)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        if (!(sval >> imap__slot_shift__))
+        {
+            sval = tree->vecsl[imap__tree_vfre__];
+            if (!sval)
+                sval = imap__alloc_val128__(tree);
+            IMAP_ASSERT(sval >> imap__slot_shift__);
+            tree->vecsl[imap__tree_vfre__] = (imap_slot_t)tree->vec128[sval >> (imap__slot_shift__ + 1)].v[0];
+        }
+        IMAP_ASSERT(!(sval & imap__slot_node__));
+        IMAP_ASSERT(imap__slot_boxed__(sval));
+        *slot = (*slot & imap__slot_pmask__) | sval;
+        tree->vec128[sval >> (imap__slot_shift__ + 1)] = y;
+    }
+
+    IMAP_DEFNFUNC
+    void imap_delval(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        if (imap__slot_boxed__(sval))
+            imap__free_val__(tree, sval);
+        *slot &= imap__slot_pmask__;
+    }
+
+    IMAP_DEFNFUNC
+    imap_u64_t *imap_addrof64(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        return &tree->vec64[sval >> imap__slot_shift__];
+    }
+
+    IMAP_DEFNFUNC
+    imap_u128_t *imap_addrof128(imap_node_t *tree, imap_slot_t *slot)
+    {
+        IMAP_ASSERT(!(*slot & imap__slot_node__));
+        imap_slot_t sval = *slot;
+        return &tree->vec128[sval >> (imap__slot_shift__ + 1)];
+    }
+
+    static inline
+    int imap__collapse__(imap_node_t *tree, imap_slot_t *slot)
+    {
+        // an empty node is freed and an internal node with a single child is replaced by its child;
+        // in a sparse tree an internal node with two children is also turned into a small node
+        // and a position 0 node with a single value into a cell; returns 0 if the node stays
+        imap_node_t *node;
+        imap_slot_t *slots;
+        imap_slot_t sval, pval, cval, mark;
+        imap_u32_t posn, dirn, dir0;
+        imap_u64_t prfx;
+        sval = *slot;
+        if (sval & imap__slot_cell__)
+        {
+            slots = imap__small_slots__(tree, sval);
+            if ((slots[0] & ~imap__slot_pmask__) && (slots[1] & ~imap__slot_pmask__))
+                return 0;
+            pval = (slots[0] | slots[1]) & ~imap__slot_pmask__;
+            prfx = *imap__small__(tree, sval);
+            imap__free_small__(tree, sval);
+            *slot = (sval & imap__slot_pmask__) | pval;
+            imap__jump_update__(tree, prfx, (imap_u32_t)(prfx & imap__prefix_pos__));
+            return 1;
+        }
+        mark = sval & imap__slot_value__;
+        node = imap__node__(tree, mark);
+        posn = imap__node_pos__(node);
+        switch (imap__node_popcnt__(node, &pval))
+        {
+        case 0:
+            prfx = imap__node_prefix__(node);
+            imap__free_node__(tree, mark);
+            *slot = sval & imap__slot_pmask__;
+            break;
+        case 1:
+            prfx = imap__node_prefix__(node);
+            if (0 != posn)
+            {
+                imap__free_node__(tree, mark);
+                *slot = (sval & imap__slot_pmask__) | (pval & ~imap__slot_pmask__);
+                break;
+            }
+            if (!imap__ext_get__(tree, imap__ext_sparse__))
+                return 0;
+            for (dirn = 0; !(node->vecsl[dirn] & ~imap__slot_pmask__); dirn++)
+                ;
+            // free the node first: the cell may be carved from it
+            imap__cmpt_reuse__(tree, mark, imap__fre_cell__);
+            imap__free_node__(tree, mark);
+            cval = imap__alloc_cell__(tree, prfx | dirn);
+            *imap__cell_slot__(tree, cval) = pval & ~imap__slot_pmask__;
+            *slot = (sval & imap__slot_pmask__) | cval;
+            break;
+        case 2:
+            if (0 == posn || !imap__ext_get__(tree, imap__ext_sparse__))
+                return 0;
+            prfx = imap__node_prefix__(node);
+            for (dir0 = 0; !(node->vecsl[dir0] & ~imap__slot_pmask__); dir0++)
+                ;
+            for (dirn = dir0 + 1; !(node->vecsl[dirn] & ~imap__slot_pmask__); dirn++)
+                ;
+            pval = node->vecsl[dir0];
+            cval = node->vecsl[dirn];
+            // free the node first: the small node may be carved from it
+            imap__cmpt_reuse__(tree, mark, imap__fre_small__);
+            imap__free_node__(tree, mark);
+            *slot = (sval & imap__slot_pmask__) | imap__alloc_small__(tree, prfx, dir0, pval, dirn, cval);
+            break;
+        default:
+            return 0;
+        }
+        imap__jump_update__(tree, prfx, posn);
+        return 1;
+    }
+
+    static inline
+    void imap__list_remove__(imap_node_t *tree, imap_u64_t x0, imap_u64_t x1)
+    {
+        // remove the keys within the range and close the gaps
+        imap_u64_t *keys = imap__list_keys__(tree);
+        imap_slot_t *slots = imap__list_slots__(tree);
+        imap_slot_t lval = tree->vecsl[imap__tree_root__];
+        imap_u32_t i, j;
+        for (i = j = 0; (lval & imap__slot_pmask__) > i; i++)
+            if (x0 <= keys[i] && keys[i] <= x1)
+                imap_delval(tree, &slots[i]);
+            else
+            {
+                keys[j] = keys[i];
+                slots[j++] = slots[i];
+            }
+        tree->vecsl[imap__tree_root__] = imap__slot_cell__ | j;
+    }
+
+    static inline
+    void imap__remove__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x)
+    {
+        // descend from a slot that references the root of a (sub)tree and collapse the nodes on the way back
+        imap_slot_t *slotstack[16 + 1];
+        imap_u32_t stackp;
+        imap_node_t *node = tree;
+        imap_slot_t sval;
+        imap_u32_t posn = 16;
+        stackp = 0;
+        for (;;)
+        {
+            sval = *slot;
+            if (!(sval & imap__slot_node__))
+            {
+                if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull))
+                {
+                    IMAP_ASSERT(0 == posn);
+                    imap_delval(tree, slot);
+                }
+                break;
+            }
+            if (imap__slot_iscell__(sval))
+            {
+                if (*imap__cell__(tree, sval) == x)
+                {
+                    imap_delval(tree, imap__cell_slot__(tree, sval));
+                    imap__free_cell__(tree, sval);
+                    *slot = sval & imap__slot_pmask__;
+                }
+                break;
+            }
+            slotstack[stackp++] = slot;
+            if (sval & imap__slot_cell__)
+            {
+                slot = imap__small_slot__(tree, sval,
+                    imap__xdir__(x, (imap_u32_t)(*imap__small__(tree, sval) & imap__prefix_pos__)));
+                if (!slot)
+                    break;
+                continue;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+        while (stackp && imap__collapse__(tree, slotstack[--stackp]))
+            ;
+    }
+
+    static inline
+    void imap__remove_plain__(imap_node_t *tree, imap_u64_t x)
+    {
+        // a tree without an extension node has neither cells, small nodes, a jump table, a leaf cache
+        // nor a compaction pass: an empty position 0 node is freed and an internal node with a single child
+        // is replaced by its child
+        imap_slot_t *slotstack[16 + 1];
+        imap_u32_t stackp;
+        imap_node_t *node = tree;
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t sval, pval;
+        imap_u32_t posn = 16;
+        stackp = 0;
+        for (;;)
+        {
+            sval = *slot;
+            if (!(sval & imap__slot_node__))
+            {
+                if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull))
+                {
+                    IMAP_ASSERT(0 == posn);
+                    imap_delval(tree, slot);
+                }
+                while (stackp)
+                {
+                    slot = slotstack[--stackp];
+                    sval = *slot;
+                    node = imap__node__(tree, sval & imap__slot_value__);
+                    posn = imap__node_pos__(node);
+                    if (!!posn != imap__node_popcnt__(node, &pval))
+                        break;
+                    imap__free_node__(tree, sval & imap__slot_value__);
+                    // the popcount leaves pval undefined for an empty node
+                    *slot = (sval & imap__slot_pmask__) | (posn ? pval & ~imap__slot_pmask__ : 0);
+                }
+                return;
+            }
+            slotstack[stackp++] = slot;
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    IMAP_DEFNFUNC
+    void imap_remove(imap_node_t *tree, imap_u64_t x)
+    {
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        if (imap__slot_islist__(*slot))
+            imap__list_remove__(tree, x, x);
+        else
+        if (!tree->vecsl[imap__tree_ext__])
+            imap__remove_plain__(tree, x);
+        else
+            imap__remove__(tree, slot, x);
+    }
+
+    static inline
+    imap_u32_t imap__cursor_resume__(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x,
+        imap_node_t **pnode, imap_slot_t **pslot, imap_u32_t *pposn)
+    {
+        imap_u32_t stackp = cursor->stackp, diff, posn;
+        imap_slot_t *slot;
+        if (0 != stackp)
+        {
+            // pop recorded slots until we find a node whose subtree contains x;
+            // the header slot has position 16 and always stops the loop
+            diff = imap__xpos__(cursor->prfx ^ x);
+            while (cursor->posnstack[--stackp] < diff)
+                ;
+            posn = cursor->posnstack[stackp];
+            if (16 != posn)
+            {
+                slot = (imap_slot_t *)((imap_u8_t *)tree + cursor->slotstack[stackp - 1]);
+                if (*slot & imap__slot_cell__)
+                {
+                    // a small node may not have a child for x; resume at the slot that references it
+                    *pnode = tree;
+                    *pslot = slot;
+                    *pposn = cursor->posnstack[stackp - 1];
+                    return stackp - 1;
+                }
+                *pnode = imap__node__(tree, cursor->slotstack[stackp] & ~(imap_slot_t)(sizeof(imap_node_t) - 1));
+                *pslot = &(*pnode)->vecsl[imap__xdir__(x, posn)];
+                *pposn = posn;
+                return stackp;
+            }
+        }
+        *pnode = tree;
+        *pslot = &tree->vecsl[imap__tree_root__];
+        *pposn = 16;
+        return 0;
+    }
+
+    static inline
+    void imap__free_subtree__(imap_node_t *tree, imap_slot_t sval)
+    {
+        imap_slot_t stack[15 * 16 + 1];
+        imap_u32_t stackp;
+        imap_slot_t *slots;
+        imap_slot_t cval;
+        imap_u32_t dirn, ndir;
+        stackp = 0;
+        stack[stackp++] = sval;
+        while (stackp)
+        {
+            sval = stack[--stackp];
+            if (sval & imap__slot_cell__)
+                slots = imap__small_slots__(tree, sval), ndir = 2;
+            else
+                slots = imap__node__(tree, sval & imap__slot_value__)->vecsl, ndir = 16;
+            for (dirn = 0; ndir > dirn; dirn++)
+            {
+                cval = slots[dirn];
+                if (cval & imap__slot_node__)
+                {
+                    if (!imap__slot_iscell__(cval))
+                        stack[stackp++] = cval & ~imap__slot_pmask__;
+                    else
+                    {
+                        imap_delval(tree, imap__cell_slot__(tree, cval));
+                        imap__free_cell__(tree, cval);
+                    }
+                }
+                else if (imap__slot_boxed__(cval))
+                    imap_delval(tree, &slots[dirn]);
+            }
+            if (sval & imap__slot_cell__)
+                imap__free_small__(tree, sval);
+            else
+                imap__free_node__(tree, sval & imap__slot_value__);
+        }
+    }
+
+    static inline
+    void imap__remove_range__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x0, imap_u64_t x1)
+    {
+        imap_slot_t *cslot;
+        imap_slot_t sval, cval;
+        imap_u32_t posn, dirn, dir0, dir1;
+        imap_u64_t prfx, mask, lo, hi;
+        sval = *slot;
+        if (imap__slot_iscell__(sval))
+        {
+            prfx = *imap__cell__(tree, sval);
+            if (x0 <= prfx && prfx <= x1)
+            {
+                imap_delval(tree, imap__cell_slot__(tree, sval));
+                imap__free_cell__(tree, sval);
+                *slot = sval & imap__slot_pmask__;
+            }
+            return;
+        }
+        posn = imap__inner_pos__(tree, sval);
+        prfx = imap__inner_prefix__(tree, sval);
+        mask = 15 == posn ? ~0ull : (0x10ull << (posn << 2)) - 1;
+        lo = prfx & ~mask;
+        hi = lo | mask;
+        if (hi < x0 || x1 < lo)
+            return;
+        if (x0 <= lo && hi <= x1)
+        {
+            imap__free_subtree__(tree, sval & ~imap__slot_pmask__);
+            *slot &= imap__slot_pmask__;
+            imap__jump_update__(tree, prfx, posn);
+            return;
+        }
+        // only the directions that contain x0 and x1 are partially inside the range;
+        // the directions between them are removed as a whole
+        dir0 = x0 <= lo ? 0 : imap__xdir__(x0, posn);
+        dir1 = hi <= x1 ? 15 : imap__xdir__(x1, posn);
+        for (dirn = dir0; dir1 >= dirn; dirn++)
+        {
+            cslot = imap__inner_slot__(tree, sval, dirn);
+            if (!cslot)
+                continue;
+            cval = *cslot;
+            if (!(cval & imap__slot_node__))
+            {
+                if (cval & imap__slot_value__)
+                    imap_delval(tree, cslot);
+            }
+            else if (dirn == dir0 || dirn == dir1 || imap__slot_iscell__(cval))
+                imap__remove_range__(tree, cslot, x0, x1);
+            else
+            {
+                // the child is at a lower position; the entries that may lead to it are those of the direction
+                imap__free_subtree__(tree, cval & ~imap__slot_pmask__);
+                *cslot &= imap__slot_pmask__;
+                imap__jump_update__(tree, lo | (imap_u64_t)dirn << (posn << 2), posn - 1);
+            }
+        }
+        imap__collapse__(tree, slot);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_remove_range(imap_node_t *tree, imap_u64_t x0, imap_u64_t x1)
+    {
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        if (x0 <= x1 && (*slot & imap__slot_node__))
+            imap__remove_range__(tree, slot, x0, x1);
+        else if (x0 <= x1 && imap__slot_islist__(*slot))
+            imap__list_remove__(tree, x0, x1);
+    }
+
+    static inline
+    int imap__prune__(imap_node_t *tree, imap_slot_t *slot, imap_u64_t x, imap_u32_t *pbudget, imap_u64_t *pnext)
+    {
+        // prune the part of a subtree at or after x in post order: empty cells are freed and every internal node
+        // whose children are done is collapsed; returns 0 (with the key to resume at) when the budget runs out
+        imap_slot_t *cslot;
+        imap_slot_t sval, cval;
+        imap_u32_t posn, dirn;
+        imap_u64_t prfx, mask;
+        sval = *slot;
+        if (imap__slot_iscell__(sval))
+        {
+            if (!(*imap__cell_slot__(tree, sval) & imap__slot_value__))
+            {
+                imap__free_cell__(tree, sval);
+                *slot = sval & imap__slot_pmask__;
+            }
+            return 1;
+        }
+        posn = imap__inner_pos__(tree, sval);
+        prfx = imap__inner_prefix__(tree, sval);
+        mask = 15 == posn ? ~0ull : (0x10ull << (posn << 2)) - 1;
+        if ((prfx | mask) < x)
+            return 1;
+        if (0 != posn)
+        {
+            for (dirn = (prfx & ~mask) < x ? imap__xdir__(x, posn) : 0; 16 > dirn; dirn++)
+            {
+                cslot = imap__inner_slot__(tree, sval, dirn);
+                if (!cslot)
+                    continue;
+                cval = *cslot;
+                if (!(cval & imap__slot_node__))
+                    continue;
+                if (0 == *pbudget)
+                {
+                    *pnext = (prfx & ~mask) | ((imap_u64_t)dirn << (posn << 2));
+                    if (*pnext < x)
+                        *pnext = x;
+                    return 0;
+                }
+                if (!imap__prune__(tree, cslot, x, pbudget, pnext))
+                    return 0;
+            }
+        }
+        if (0 != *pbudget)
+            --*pbudget;
+        imap__collapse__(tree, slot);
+        return 1;
+    }
+
+    static inline
+    void imap__list_prune__(imap_node_t *tree)
+    {
+        // drop the entries whose values were deleted
+        imap_u64_t *keys = imap__list_keys__(tree);
+        imap_slot_t *slots = imap__list_slots__(tree);
+        imap_slot_t lval = tree->vecsl[imap__tree_root__];
+        imap_u32_t i, j;
+        for (i = j = 0; (lval & imap__slot_pmask__) > i; i++)
+            if (slots[i] & imap__slot_value__)
+            {
+                keys[j] = keys[i];
+                slots[j++] = slots[i];
+            }
+        tree->vecsl[imap__tree_root__] = imap__slot_cell__ | j;
+    }
+
+    IMAP_DEFNFUNC
+    void imap_prune(imap_node_t *tree)
+    {
+        imap_prune_step(tree, 0, ~(imap_u32_t)0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_u64_t imap_prune_step(imap_node_t *tree, imap_u64_t x, imap_u32_t budget)
+    {
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_u64_t next = 0;
+        // every step makes progress: at least one node is pruned
+        budget = budget ? budget : 1;
+        if (imap__slot_islist__(*slot))
+            imap__list_prune__(tree);
+        else if (*slot & imap__slot_node__)
+            imap__prune__(tree, slot, x, &budget, &next);
+        return next;
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t *imap_cursor_lookup(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x)
+    {
+        imap_slot_t *slotstack = cursor->slotstack;
+        imap_u32_t *posnstack = cursor->posnstack;
+        imap_u32_t stackp;
+        imap_node_t *node;
+        imap_slot_t *slot;
+        imap_slot_t sval;
+        imap_u32_t posn;
+        imap_u64_t prfx;
+        if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+        {
+            // a list has no path to remember
+            cursor->stackp = 0;
+            return imap_lookup(tree, x);
+        }
+        stackp = imap__cursor_resume__(tree, cursor, x, &node, &slot, &posn);
+        for (;;)
+        {
+            sval = *slot;
+            slotstack[stackp] = (imap_slot_t)((imap_u8_t *)slot - (imap_u8_t *)tree), posnstack[stackp++] = posn;
+            if (!(sval & imap__slot_node__))
+            {
+                prfx = imap__node_prefix__(node);
+                cursor->prfx = prfx;
+                cursor->stackp = stackp;
+                if ((sval & imap__slot_value__) && prfx == (x & ~0xfull))
+                {
+                    IMAP_ASSERT(0 == posn);
+                    return slot;
+                }
+                return 0;
+            }
+            if (sval & imap__slot_cell__)
+            {
+                if (sval & imap__slot_small__)
+                {
+                    prfx = *imap__small__(tree, sval);
+                    posn = (imap_u32_t)(prfx & imap__prefix_pos__);
+                    if (0 != (slot = imap__small_slot__(tree, sval, imap__xdir__(x, posn))))
+                        continue;
+                    // the cursor stops at the slot that references the small node
+                    cursor->prfx = prfx;
+                    cursor->stackp = stackp;
+                    return 0;
+                }
+                // the cursor stops at the slot that references the cell
+                prfx = *imap__cell__(tree, sval);
+                cursor->prfx = prfx;
+                cursor->stackp = stackp;
+                slot = imap__cell_slot__(tree, sval);
+                return (*slot & imap__slot_value__) && prfx == x ? slot : 0;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t *imap_cursor_assign(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x)
+    {
+        imap_slot_t *slotstack = cursor->slotstack;
+        imap_u32_t *posnstack = cursor->posnstack;
+        imap_u32_t stackp, stacki;
+        imap_node_t *node;
+        imap_slot_t *slot;
+        imap_slot_t cval, sval;
+        imap_u32_t diff, posn;
+        imap_u64_t prfx;
+        if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+        {
+            cursor->stackp = 0;
+            return imap__list_assign__(tree, x);
+        }
+        stackp = imap__cursor_resume__(tree, cursor, x, &node, &slot, &posn);
+        for (;;)
+        {
+            sval = *slot;
+            slotstack[stackp] = (imap_slot_t)((imap_u8_t *)slot - (imap_u8_t *)tree), posnstack[stackp++] = posn;
+            if (!(sval & imap__slot_node__) || (sval & imap__slot_cell__))
+            {
+                cursor->prfx = x;
+                if (imap__slot_issmall__(sval))
+                {
+                    prfx = *imap__small__(tree, sval);
+                    posn = (imap_u32_t)(prfx & imap__prefix_pos__);
+                    if (0 != (slot = imap__small_slot__(tree, sval, imap__xdir__(x, posn))))
+                        continue;
+                    if (imap__xpos__(prfx ^ x) <= posn)
+                    {
+                        slot = (imap_slot_t *)((imap_u8_t *)tree + slotstack[stackp - 1]);
+                        cval = (imap_slot_t)((imap_u8_t *)imap__grow__(tree, slot, x) - (imap_u8_t *)tree);
+                        slotstack[stackp] = (*slot & imap__slot_value__) + imap__xdir__(x, posn) * sizeof(imap_slot_t);
+                        posnstack[stackp++] = posn;
+                        cursor->stackp = stackp;
+                        return (imap_slot_t *)((imap_u8_t *)tree + cval);
+                    }
+                }
+                else if (sval & imap__slot_node__)
+                {
+                    prfx = *imap__cell__(tree, sval);
+                    if (prfx == x)
+                    {
+                        cursor->stackp = stackp;
+                        return imap__cell_slot__(tree, sval);
+                    }
+                    if (!((prfx ^ x) & ~0xfull))
+                    {
+                        slot = imap__promote__(tree, slot, x);
+                        slotstack[stackp] = (imap_slot_t)((imap_u8_t *)slot - (imap_u8_t *)tree);
+                        posnstack[stackp++] = 0;
+                        cursor->stackp = stackp;
+                        return slot;
+                    }
+                    posn = 0;
+                }
+                else
+                {
+                    prfx = imap__node_prefix__(node);
+                    if (0 == posn && prfx == (x & ~0xfull))
+                    {
+                        cursor->stackp = stackp;
+                        return slot;
+                    }
+                }
+                diff = imap__xpos__(prfx ^ x);
+                IMAP_ASSERT(diff < 16);
+                for (stacki = stackp; diff > posn;)
+                    posn = posnstack[--stacki];
+                if (!imap__ext_get__(tree, imap__ext_sparse__))
+                {
+                    if (stacki != stackp)
+                    {
+                        slot = imap__attach__(tree, (imap_slot_t *)((imap_u8_t *)tree + slotstack[stacki]),
+                            prfx, diff, x, 1);
+                        sval = *(imap_slot_t *)((imap_u8_t *)tree + slotstack[stacki]);
+                        slotstack[++stacki] = (sval & imap__slot_value__) + imap__xdir__(x, diff) * sizeof(imap_slot_t);
+                        posnstack[stacki++] = diff;
+                        stackp = stacki;
+                    }
+                    else
+                        slot = imap__attach__(tree, slot, prfx, diff, x, 0);
+                    slotstack[stackp] = (imap_slot_t)((imap_u8_t *)slot - (imap_u8_t *)tree);
+                    posnstack[stackp++] = 0;
+                    cursor->stackp = stackp;
+                    return slot;
+                }
+                cval = imap__alloc_cell__(tree, x);
+                if (stacki != stackp)
+                {
+                    slot = (imap_slot_t *)((imap_u8_t *)tree + slotstack[stacki]);
+                    sval = *slot;
+                    IMAP_ASSERT(sval & imap__slot_node__);
+                    *slot = (sval & imap__slot_pmask__) | imap__alloc_small__(tree, imap__xpfx__(prfx, diff) | diff,
+                        imap__xdir__(prfx, diff), sval, imap__xdir__(x, diff), cval);
+                    imap__jump_update__(tree, x, diff);
+                    slot = imap__small_slot__(tree, *slot, imap__xdir__(x, diff));
+                    slotstack[++stacki] = (imap_slot_t)((imap_u8_t *)slot - (imap_u8_t *)tree);
+                    posnstack[stacki++] = diff;
+                    stackp = stacki;
+                }
+                else
+                    *slot = (*slot & imap__slot_pmask__) | cval;
+                cursor->stackp = stackp;
+                return imap__cell_slot__(tree, cval);
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    IMAP_DEFNFUNC
+    void imap_cursor_remove(imap_node_t *tree, imap_cursor_t *cursor, imap_u64_t x)
+    {
+        imap_slot_t *slotstack = cursor->slotstack;
+        imap_u32_t *posnstack = cursor->posnstack;
+        imap_u32_t stackp;
+        imap_node_t *node;
+        imap_slot_t *slot;
+        imap_slot_t sval;
+        imap_u32_t posn;
+        imap_u64_t prfx;
+        if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+        {
+            cursor->stackp = 0;
+            imap__list_remove__(tree, x, x);
+            return;
+        }
+        stackp = imap__cursor_resume__(tree, cursor, x, &node, &slot, &posn);
+        for (;;)
+        {
+            sval = *slot;
+            slotstack[stackp] = (imap_slot_t)((imap_u8_t *)slot - (imap_u8_t *)tree), posnstack[stackp++] = posn;
+            if (imap__slot_issmall__(sval))
+            {
+                prfx = *imap__small__(tree, sval);
+                posn = (imap_u32_t)(prfx & imap__prefix_pos__);
+                if (0 != (slot = imap__small_slot__(tree, sval, imap__xdir__(x, posn))))
+                    continue;
+                cursor->prfx = prfx;
+                cursor->stackp = stackp;
+                return;
+            }
+            if (!(sval & imap__slot_node__) || (sval & imap__slot_cell__))
+            {
+                if (sval & imap__slot_node__)
+                {
+                    prfx = *imap__cell__(tree, sval);
+                    if (prfx == x)
+                    {
+                        imap_delval(tree, imap__cell_slot__(tree, sval));
+                        imap__free_cell__(tree, sval);
+                        *slot = sval & imap__slot_pmask__;
+                    }
+                }
+                else
+                {
+                    prfx = imap__node_prefix__(node);
+                    if ((sval & imap__slot_value__) && prfx == (x & ~0xfull))
+                    {
+                        IMAP_ASSERT(0 == posn);
+                        imap_delval(tree, slot);
+                    }
+                }
+                cursor->prfx = prfx;
+                // every recorded slot except the last one points to a node;
+                // nodes below the first slot that survives are no longer valid
+                for (stackp--; stackp;)
+                    if (!imap__collapse__(tree, (imap_slot_t *)((imap_u8_t *)tree + slotstack[--stackp])))
+                    {
+                        stackp += 2;
+                        break;
+                    }
+                cursor->stackp = stackp ? stackp : 1;
+                return;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            posn = imap__node_pos__(node);
+            slot = &node->vecsl[imap__xdir__(x, posn)];
+        }
+    }
+
+    static inline
+    int imap__sort_ops__(imap_op_t *ops, imap_u32_t n)
+    {
+        imap_u32_t counts[8][256];
+        imap_op_t *src, *dst, *tmp, op;
+        imap_u32_t i, j, k, c, passes;
+        imap_u64_t x;
+        if (32 >= n)
+        {
+            // stable insertion sort for small batches
+            for (i = 1; n > i; i++)
+            {
+                op = ops[i];
+                for (j = i; j && ops[j - 1].x > op.x; j--)
+                    ops[j] = ops[j - 1];
+                ops[j] = op;
+            }
+            return 1;
+        }
+        tmp = (imap_op_t *)IMAP_MALLOC(n * sizeof(imap_op_t));
+        if (!tmp)
+            return 0;
+        for (k = 0; 8 > k; k++)
+            for (c = 0; 256 > c; c++)
+                counts[k][c] = 0;
+        for (i = 0; n > i; i++)
+            for (x = ops[i].x, k = 0; 8 > k; k++, x >>= 8)
+                counts[k][x & 0xff]++;
+        // stable LSD radix sort; skip digits that are the same for all keys
+        src = ops, dst = tmp, passes = 0;
+        for (k = 0; 8 > k; k++)
+        {
+            if (n == counts[k][(src[0].x >> (k << 3)) & 0xff])
+                continue;
+            for (i = 0, c = 0; 256 > c; c++)
+                j = counts[k][c], counts[k][c] = i, i += j;
+            for (i = 0; n > i; i++)
+                dst[counts[k][(src[i].x >> (k << 3)) & 0xff]++] = src[i];
+            tmp = src, src = dst, dst = tmp;
+            passes++;
+        }
+        if (passes & 1)
+            IMAP_MEMCPY(ops, src, n * sizeof(imap_op_t));
+        IMAP_FREE(passes & 1 ? src : dst);
+        return 1;
+    }
+
+    IMAP_DEFNFUNC
+    imap_node_t *imap_apply_batch(imap_node_t *tree, imap_op_t *ops, imap_u32_t n)
+    {
+        imap_cursor_t cursordata, *cursor = &cursordata;
+        imap_slot_t *slot;
+        imap_u32_t nassign, i;
+        if (!imap__sort_ops__(ops, n))
+            return 0;
+        for (nassign = 0, i = 0; n > i; i++)
+            nassign += imap_op_assign == ops[i].op;
+        // removals from a tree that does not exist leave nothing to create
+        if (!tree && !nassign)
+            return tree;
+        tree = imap_ensure(tree, nassign);
+        if (!tree)
+            return tree;
+        cursor->stackp = 0;
+        for (i = 0; n > i; i++)
+            if (imap_op_assign == ops[i].op)
+            {
+                slot = imap_cursor_assign(tree, cursor, ops[i].x);
+                imap_setval(tree, slot, ops[i].y);
+            }
+            else
+                imap_cursor_remove(tree, cursor, ops[i].x);
+        return tree;
+    }
+
+    // a forest is a tree whose header root is unused: the trees of a forest share its nodes and free lists
+    // and keep their roots in cells; an operation on a tree descends from its root cell slot,
+    // so lookups never write to the forest and may run concurrently
+
+    IMAP_DEFNFUNC
+    imap_forest_t *imap_forest_ensure(imap_forest_t *forest, imap_u32_t n)
+    {
+        // creating a tree counts as one key
+        imap_forest_t *newforest;
+        if (0 == forest)
+        {
+            // the trees of a forest are rooted in cells, so a forest is a sparse tree
+            forest = imap__resize__(0, 2 * sizeof(imap_node_t), sizeof(imap_u64_t));
+            if (!forest)
+                return forest;
+            imap__ext_alloc__(forest);
+            *imap__ext_slot__(forest, imap__ext_sparse__) = 1;
+            newforest = imap__ensure__(forest, n, sizeof(imap_u64_t), 0);
+            if (!newforest)
+                imap_free(forest);
+            return newforest;
+        }
+        return imap__ensure__(forest, n, sizeof(imap_u64_t), 0);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_forest_free(imap_forest_t *forest)
+    {
+        imap_free(forest);
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t imap_forest_create(imap_forest_t *forest)
+    {
+        // a tree is identified by the mark of its root cell
+        return imap__alloc_cell__(forest, 0);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_forest_destroy(imap_forest_t *forest, imap_slot_t tree)
+    {
+        imap_slot_t *slot = imap__cell_slot__(forest, tree);
+        if (*slot & imap__slot_node__)
+            imap__remove_range__(forest, slot, 0, ~0ull);
+        imap__free_cell__(forest, tree);
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t *imap_forest_lookup(imap_forest_t *forest, imap_slot_t tree, imap_u64_t x)
+    {
+        return imap__lookup__(forest, imap__cell_slot__(forest, tree), x, 0);
+    }
+
+    IMAP_DEFNFUNC
+    imap_slot_t *imap_forest_assign(imap_forest_t *forest, imap_slot_t tree, imap_u64_t x)
     {
-        imap_node_t *newtree;
-        imap_u32_t hasnfre, hasvfre, newmark, oldsize, newsize;
-        imap_u64_t newsize64;
-        if (0 == n)
-            return tree;
-        if (0 == tree)
+        return imap__assign__(forest, forest, imap__cell_slot__(forest, tree), 16, x);
+    }
+
+    IMAP_DEFNFUNC
+    void imap_forest_remove(imap_forest_t *forest, imap_slot_t tree, imap_u64_t x)
+    {
+        imap__remove__(forest, imap__cell_slot__(forest, tree), x);
+    }
+
+    IMAP_DEFNFUNC
+    imap_u64_t imap_forest_memsize(imap_forest_t *forest, imap_slot_t tree)
+    {
+        // the bytes in use by a tree: its root cell, nodes, small nodes, cells and boxed values
+        imap_slot_t sval = *imap__cell_slot__(forest, tree);
+        imap_u32_t nnode, nsmal, ncell, nboxd;
+        nnode = nsmal = nboxd = 0;
+        ncell = 1;
+        if (sval & imap__slot_node__)
+            imap__compact_count__(forest, sval, &nnode, &nsmal, &ncell, &nboxd);
+        return (imap_u64_t)nnode * sizeof(imap_node_t) + (imap_u64_t)nsmal * imap__small_size__ +
+            (imap_u64_t)ncell * sizeof(imap_u128_t) + (imap_u64_t)nboxd * sizeof(imap_u64_t);
+    }
+
+    static inline
+    imap_u8_t *imap__frozen_node__(imap_frozen_t *frozen, imap_u32_t ref)
+    {
+        // a ref is the offset of an 8-byte aligned node shifted right by one, with the node kind in the low bits
+        return (imap_u8_t *)frozen + ((imap_u64_t)(ref & ~3u) << 1);
+    }
+
+    static inline
+    imap_u32_t imap__frozen_root__(imap_frozen_t *frozen)
+    {
+        return *(imap_u32_t *)((imap_u8_t *)frozen + imap__frozen_root_offset__);
+    }
+
+    static inline
+    imap_u32_t imap__frozen_bitmap__(imap_u8_t *p, imap_u32_t ref)
+    {
+        return *(imap_u32_t *)(p + ((ref & 3) == imap__frozen_tleaf__ ? imap__frozen_leaf_header__ : 0));
+    }
+
+    static inline
+    imap_u64_t imap__frozen_get__(imap_u8_t *p, imap_u32_t size)
+    {
+        imap_u64_t y = 0;
+        imap_u32_t y32;
+        imap_u16_t y16;
+        imap_u8_t y8;
+        switch (size)
         {
-            hasnfre = 0;
-            hasvfre = 1;
-            newmark = sizeof(imap_node_t);
-            oldsize = 0;
+        case 1:
+            IMAP_MEMCPY(&y8, p, 1);
+            y = y8;
+            break;
+        case 2:
+            IMAP_MEMCPY(&y16, p, 2);
+            y = y16;
+            break;
+        case 4:
+            IMAP_MEMCPY(&y32, p, 4);
+            y = y32;
+            break;
+        case 8:
+            IMAP_MEMCPY(&y, p, 8);
+            break;
         }
-        else
+        return y;
+    }
+
+    static inline
+    void imap__frozen_set__(imap_u8_t *p, imap_u32_t size, imap_u64_t y)
+    {
+        imap_u32_t y32 = (imap_u32_t)y;
+        imap_u16_t y16 = (imap_u16_t)y;
+        imap_u8_t y8 = (imap_u8_t)y;
+        switch (size)
         {
-            hasnfre = !!tree->vec32[imap__tree_nfre__];
-            hasvfre = !!tree->vec32[imap__tree_vfre__];
-            newmark = tree->vec32[imap__tree_mark__];
-            oldsize = tree->vec32[imap__tree_size__];
+        case 1:
+            IMAP_MEMCPY(p, &y8, 1);
+            break;
+        case 2:
+            IMAP_MEMCPY(p, &y16, 2);
+            break;
+        case 4:
+            IMAP_MEMCPY(p, &y32, 4);
+            break;
+        case 8:
+            IMAP_MEMCPY(p, &y, 8);
+            break;
         }
-        newmark += (n * 2 - hasnfre) * sizeof(imap_node_t) + (n - hasvfre) * ysize;
-        if (newmark <= oldsize)
-            return tree;
-        newsize64 = imap__ceilpow2__(newmark);
-        if (0x20000000 < newsize64)
+    }
+
+    static inline
+    imap_u32_t imap__frozen_size_code__(imap_u64_t y)
+    {
+        return !y ? 0 : y <= 0xff ? 1 : y <= 0xffff ? 2 : y <= 0xffffffffull ? 3 : 4;
+    }
+
+    static inline
+    imap_u64_t imap__frozen_leaf_value__(imap_u8_t *p, imap_u32_t h, imap_u32_t i)
+    {
+        // a leaf keeps its smallest value followed by the differences of its values from it;
+        // each is stored in 0, 1, 2, 4 or 8 bytes as needed
+        imap_u32_t bsize = imap__frozen_bsize__(h), wsize = imap__frozen_wsize__(h);
+        p += imap__frozen_leaf_base__;
+        return imap__frozen_get__(p, bsize) + imap__frozen_get__(p + bsize + i * wsize, wsize);
+    }
+
+    static inline
+    int imap__freeze_dense__(imap_node_t *tree, imap_slot_t sval)
+    {
+        // an internal node is dense if all its children are internal nodes at the next position down
+        imap_slot_t *slot;
+        imap_u32_t posn = imap__inner_pos__(tree, sval), dirn;
+        if (2 > posn)
             return 0;
-        newsize = (imap_u32_t)newsize64;
-        newtree = (imap_node_t *)IMAP_ALIGNED_ALLOC(sizeof(imap_node_t), newsize);
-        if (!newtree)
-            return newtree;
-        if (0 == tree)
+        for (dirn = 0; 16 > dirn; dirn++)
+        {
+            slot = imap__inner_slot__(tree, sval, dirn);
+            if (!slot || !(*slot & imap__slot_node__) || imap__slot_iscell__(*slot) ||
+                imap__inner_pos__(tree, *slot) != posn - 1)
+                return 0;
+        }
+        return 1;
+    }
+
+    static inline
+    imap_u32_t imap__freeze__(imap_frozen_t *frozen, imap_node_t *tree, imap_slot_t sval, imap_u64_t *poff,
+        int wide);
+
+    static inline
+    imap_u32_t imap__freeze_wide__(imap_frozen_t *frozen, imap_node_t *tree, imap_slot_t sval, imap_u64_t *poff)
+    {
+        // a dense node and its children become a single wide node that consumes two digits
+        // and keeps a ref (or 0) for each of its 256 directions
+        imap_slot_t *slot, *gslot;
+        imap_u8_t *p;
+        imap_u32_t refs[256], ref, dirn, gdirn, nref = 0;
+        for (dirn = 15; 16 > dirn; dirn--)
         {
-            newtree->vec32[imap__tree_root__] = 0;
-            newtree->vec32[imap__tree_resv__] = 0;
-            newtree->vec32[imap__tree_mark__] = sizeof(imap_node_t);
-            newtree->vec32[imap__tree_size__] = newsize;
-            newtree->vec32[imap__tree_nfre__] = 0;
-            if (sizeof(imap_u64_t) == ysize)
+            slot = imap__inner_slot__(tree, sval, dirn);
+            for (gdirn = 15; 16 > gdirn; gdirn--)
             {
-                newtree->vec32[imap__tree_vfre__] = 3 << imap__slot_shift__;
-                newtree->vec64[3] = 4 << imap__slot_shift__;
-                newtree->vec64[4] = 5 << imap__slot_shift__;
-                newtree->vec64[5] = 6 << imap__slot_shift__;
-                newtree->vec64[6] = 7 << imap__slot_shift__;
-                newtree->vec64[7] = 0;
+                gslot = imap__inner_slot__(tree, *slot, gdirn);
+                ref = gslot && (*gslot & imap__slot_node__) ? imap__freeze__(frozen, tree, *gslot, poff, 1) : 0;
+                refs[(dirn << 4) | gdirn] = ref;
+                nref += !!ref;
             }
-            else
-            if (sizeof(imap_u128_t) == ysize)
+        }
+        if (!nref)
+            return 0;
+        *poff -= (sizeof(imap_u32_t) * (1 + 256) + 7) & ~7ull;
+        if (frozen)
+        {
+            p = (imap_u8_t *)frozen + *poff;
+            *(imap_u32_t *)p = imap__frozen_wide__ | (imap__inner_pos__(tree, sval) << 16);
+            IMAP_MEMCPY(p + sizeof(imap_u32_t), refs, sizeof refs);
+        }
+        return (imap_u32_t)(*poff >> 1) | imap__frozen_tinner__;
+    }
+
+    static inline
+    imap_u32_t imap__freeze__(imap_frozen_t *frozen, imap_node_t *tree, imap_slot_t sval, imap_u64_t *poff,
+        int wide)
+    {
+        // emit a subtree below *poff and return its ref, or 0 if it holds no values; children are emitted
+        // before their parent and in descending order, so that the nodes end up in depth-first key order;
+        // when frozen is 0 only the space is accounted for
+        imap_node_t *node;
+        imap_slot_t *slot;
+        imap_u8_t *p;
+        imap_u32_t refs[16], ref, bitmap, dirn, nref, wsize, wcode, bsize, bcode;
+        imap_u64_t ys[16], ymin, ymax;
+        if (imap__slot_iscell__(sval))
+        {
+            slot = imap__cell_slot__(tree, sval);
+            if (!(*slot & imap__slot_value__))
+                return 0;
+            *poff -= 2 * sizeof(imap_u64_t);
+            if (frozen)
             {
-                newtree->vec32[imap__tree_vfre__] = 4 << imap__slot_shift__;
-                newtree->vec128[1].v[1] = 0;
-                newtree->vec128[2].v[0] = 6 << imap__slot_shift__;
-                newtree->vec128[2].v[1] = 0;
-                newtree->vec128[3].v[0] = 0;
-                newtree->vec128[3].v[1] = 0;
+                p = (imap_u8_t *)frozen + *poff;
+                *(imap_u64_t *)p = *imap__cell__(tree, sval);
+                *(imap_u64_t *)(p + sizeof(imap_u64_t)) = imap_getval(tree, slot);
             }
-            else
+            return (imap_u32_t)(*poff >> 1) | imap__frozen_tpair__;
+        }
+        bitmap = nref = 0;
+        if (wide && imap__freeze_dense__(tree, sval))
+            return imap__freeze_wide__(frozen, tree, sval, poff);
+        if (0 != imap__inner_pos__(tree, sval))
+        {
+            for (dirn = 15; 16 > dirn; dirn--)
+            {
+                slot = imap__inner_slot__(tree, sval, dirn);
+                if (!slot || !(*slot & imap__slot_node__))
+                    continue;
+                ref = imap__freeze__(frozen, tree, *slot, poff, wide);
+                if (!ref)
+                    continue;
+                refs[dirn] = ref;
+                bitmap |= 1 << dirn;
+                nref++;
+            }
+            if (!nref)
+                return 0;
+            *poff -= (sizeof(imap_u32_t) * (1 + nref) + 7) & ~7ull;
+            if (frozen)
             {
-                newtree->vec32[imap__tree_vfre__] = 0;
-                newtree->vec64[3] = 0;
-                newtree->vec64[4] = 0;
-                newtree->vec64[5] = 0;
-                newtree->vec64[6] = 0;
-                newtree->vec64[7] = 0;
+                p = (imap_u8_t *)frozen + *poff;
+                *(imap_u32_t *)p = bitmap | (imap__inner_pos__(tree, sval) << 16);
+                for (dirn = 0, nref = 0; 16 > dirn; dirn++)
+                    if (bitmap & (1 << dirn))
+                        ((imap_u32_t *)p)[1 + nref++] = refs[dirn];
             }
+            return (imap_u32_t)(*poff >> 1) | imap__frozen_tinner__;
         }
-        else
+        node = imap__node__(tree, sval & imap__slot_value__);
+        ymin = ~0ull;
+        ymax = 0;
+        for (dirn = 0; 16 > dirn; dirn++)
+            if (node->vecsl[dirn] & imap__slot_value__)
+            {
+                ys[nref] = imap_getval(tree, &node->vecsl[dirn]);
+                ymin = ymin < ys[nref] ? ymin : ys[nref];
+                ymax = ymax > ys[nref] ? ymax : ys[nref];
+                bitmap |= 1 << dirn;
+                nref++;
+            }
+        if (!nref)
+            return 0;
+        wcode = imap__frozen_size_code__(ymax - ymin);
+        bcode = imap__frozen_size_code__(ymin);
+        wsize = imap__frozen_wsize__(wcode << 16);
+        bsize = imap__frozen_bsize__(bcode << 19);
+        *poff -= (imap__frozen_leaf_base__ + bsize + nref * wsize + 7) & ~7ull;
+        if (frozen)
         {
-            IMAP_MEMCPY(newtree, tree, tree->vec32[imap__tree_mark__]);
-            IMAP_ALIGNED_FREE(tree);
-            newtree->vec32[imap__tree_size__] = newsize;
+            p = (imap_u8_t *)frozen + *poff;
+            *(imap_u64_t *)p = imap__node_prefix__(node);
+            *(imap_u32_t *)(p + imap__frozen_leaf_header__) = bitmap | (wcode << 16) | (bcode << 19);
+            imap__frozen_set__(p + imap__frozen_leaf_base__, bsize, ymin);
+            while (nref--)
+                imap__frozen_set__(p + imap__frozen_leaf_base__ + bsize + nref * wsize, wsize, ys[nref] - ymin);
         }
-        return newtree;
+        return (imap_u32_t)(*poff >> 1) | imap__frozen_tleaf__;
     }
 
-    IMAP_DEFNFUNC
-    imap_node_t *imap_ensure(imap_node_t *tree, imap_u32_t n)
+    static inline
+    imap_frozen_t *imap__freeze_tree__(imap_node_t *tree, int wide)
     {
-        return imap__ensure__(tree, n, sizeof(imap_u64_t));
+        imap_frozen_t *frozen;
+        imap_node_t *copy;
+        imap_pair_t pair;
+        imap_iter_t iter;
+        imap_slot_t sval = tree->vecsl[imap__tree_root__];
+        imap_u64_t size, off;
+        imap_u32_t ref;
+        if (imap__slot_islist__(sval))
+        {
+            // a list is first turned into a tree
+            copy = imap_ensure(0, sval & imap__slot_pmask__);
+            if (!copy)
+                return 0;
+            for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+                imap_setval(copy, imap_assign(copy, pair.x), imap_getval(tree, pair.slot));
+            frozen = imap__freeze_tree__(copy, wide);
+            imap_free(copy);
+            return frozen;
+        }
+        size = 0;
+        if (sval & imap__slot_node__)
+            imap__freeze__(0, tree, sval, &size, wide);
+        size = imap__frozen_nodes__ - size;
+        if ((imap_u64_t)1 << 33 < size)
+            return 0;
+        frozen = (imap_frozen_t *)IMAP_ALIGNED_ALLOC(sizeof(imap_node_t), size);
+        if (!frozen)
+            return 0;
+        off = size;
+        ref = sval & imap__slot_node__ ? imap__freeze__(frozen, tree, sval, &off, wide) : 0;
+        IMAP_ASSERT(imap__frozen_nodes__ == off);
+        *(imap_u64_t *)frozen = size;
+        *(imap_u32_t *)((imap_u8_t *)frozen + imap__frozen_root_offset__) = ref;
+        return frozen;
     }
 
     IMAP_DEFNFUNC
-    imap_node_t *imap_ensure0(imap_node_t *tree, imap_u32_t n)
+    imap_frozen_t *imap_freeze(imap_node_t *tree)
     {
-        return imap__ensure__(tree, n, 0);
+        return imap__freeze_tree__(tree, 0);
     }
 
     IMAP_DEFNFUNC
-    imap_node_t *imap_ensure64(imap_node_t *tree, imap_u32_t n)
+    imap_frozen_t *imap_freeze_wide(imap_node_t *tree)
     {
-        return imap__ensure__(tree, n, sizeof(imap_u64_t));
+        return imap__freeze_tree__(tree, 1);
     }
 
     IMAP_DEFNFUNC
-    imap_node_t *imap_ensure128(imap_node_t *tree, imap_u32_t n)
+    void imap_frozen_free(imap_frozen_t *frozen)
     {
-        return imap__ensure__(tree, n, sizeof(imap_u128_t));
+        IMAP_ALIGNED_FREE(frozen);
     }
 
     IMAP_DEFNFUNC
-    void imap_free(imap_node_t *tree)
+    imap_u64_t imap_frozen_memsize(imap_frozen_t *frozen)
     {
-        IMAP_ALIGNED_FREE(tree);
+        return *(imap_u64_t *)frozen;
     }
 
     IMAP_DEFNFUNC
-    imap_slot_t *imap_lookup(imap_node_t *tree, imap_u64_t x)
+    int imap_frozen_lookup(imap_frozen_t *frozen, imap_u64_t x, imap_u64_t *py)
     {
-        imap_node_t *node = tree;
-        imap_slot_t *slot;
-        imap_u32_t sval, posn = 16, dirn = 0;
+        imap_u32_t ref = imap__frozen_root__(frozen), h, dirn;
+        imap_u8_t *p;
         for (;;)
         {
-            slot = &node->vec32[dirn];
-            sval = *slot;
-            if (!(sval & imap__slot_node__))
+            p = imap__frozen_node__(frozen, ref);
+            switch (ref & 3)
             {
-                if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull))
+            case imap__frozen_tinner__:
+                // prefixes of internal nodes are not kept: the key is compared in full at the end
+                h = *(imap_u32_t *)p;
+                if (h & imap__frozen_wide__)
                 {
-                    IMAP_ASSERT(0 == posn);
-                    return slot;
+                    ref = ((imap_u32_t *)p)[1 + imap__xdir8__(x, imap__frozen_pos__(h))];
+                    if (!ref)
+                        return 0;
+                    break;
                 }
+                dirn = imap__xdir__(x, imap__frozen_pos__(h));
+                if (!(h & (1 << dirn)))
+                    return 0;
+                ref = ((imap_u32_t *)p)[1 + imap__popcnt16__(h & ((1 << dirn) - 1))];
+                break;
+            case imap__frozen_tleaf__:
+                h = *(imap_u32_t *)(p + imap__frozen_leaf_header__);
+                dirn = x & 0xf;
+                if (*(imap_u64_t *)p != (x & ~0xfull) || !(h & (1 << dirn)))
+                    return 0;
+                *py = imap__frozen_leaf_value__(p, h, imap__popcnt16__(h & ((1 << dirn) - 1)));
+                return 1;
+            case imap__frozen_tpair__:
+                if (*(imap_u64_t *)p != x)
+                    return 0;
+                *py = *(imap_u64_t *)(p + sizeof(imap_u64_t));
+                return 1;
+            default:
                 return 0;
             }
-            node = imap__node__(tree, sval & imap__slot_value__);
-            posn = imap__node_pos__(node);
-            dirn = imap__xdir__(x, posn);
         }
     }
 
-    IMAP_DEFNFUNC
-    imap_slot_t *imap_assign(imap_node_t *tree, imap_u64_t x)
+    static inline
+    imap_frozen_pair_t imap__frozen_pair__(imap_u64_t x, imap_u64_t y)
     {
-        imap_slot_t *slotstack[16 + 1];
-        imap_u32_t posnstack[16 + 1];
-        imap_u32_t stackp, stacki;
-        imap_node_t *newnode, *node = tree;
-        imap_slot_t *slot;
-        imap_u32_t newmark, sval, diff, posn = 16, dirn = 0;
-        imap_u64_t prfx;
-        stackp = 0;
-        for (;;)
+        imap_frozen_pair_t pair;
+        pair.x = x;
+        pair.y = y;
+        pair.valid = 1;
+        return pair;
+    }
+
+    static inline
+    imap_frozen_pair_t imap__frozen_next__(imap_frozen_t *frozen, imap_frozen_iter_t *iter)
+    {
+        // each stack entry holds the ref of a node and the next direction to examine
+        imap_frozen_pair_t pair;
+        imap_u64_t entry;
+        imap_u32_t ref, h, dirn, i;
+        imap_u8_t *p;
+        while (iter->stackp)
         {
-            slot = &node->vec32[dirn];
-            sval = *slot;
-            slotstack[stackp] = slot, posnstack[stackp++] = posn;
-            if (!(sval & imap__slot_node__))
+            entry = iter->stack[iter->stackp - 1]++;
+            dirn = entry & 511;
+            ref = (imap_u32_t)(entry >> 9);
+            p = imap__frozen_node__(frozen, ref);
+            h = imap__frozen_bitmap__(p, ref);
+            if ((ref & 3) == imap__frozen_tinner__ && (h & imap__frozen_wide__))
             {
-                prfx = imap__node_prefix__(node);
-                if (0 == posn && prfx == (x & ~0xfull))
-                    return slot;
-                diff = imap__xpos__(prfx ^ x);
-                IMAP_ASSERT(diff < 16);
-                for (stacki = stackp; diff > posn;)
-                    posn = posnstack[--stacki];
-                if (stacki != stackp)
+                if (255 < dirn)
                 {
-                    slot = slotstack[stacki];
-                    sval = *slot;
-                    IMAP_ASSERT(sval & imap__slot_node__);
-                    newmark = imap__alloc_node__(tree);
-                    *slot = (*slot & imap__slot_pmask__) | imap__slot_node__ | newmark;
-                    newnode = imap__node__(tree, newmark);
-                    *newnode = imap__node_zero__;
-                    newmark = imap__alloc_node__(tree);
-                    newnode->vec32[imap__xdir__(prfx, diff)] = sval;
-                    newnode->vec32[imap__xdir__(x, diff)] = imap__slot_node__ | newmark;
-                    imap__node_setprefix__(newnode, imap__xpfx__(prfx, diff) | diff);
+                    iter->stackp--;
+                    continue;
                 }
-                else
+                ref = ((imap_u32_t *)p)[1 + dirn];
+                if (!ref)
+                    continue;
+            }
+            else
+            {
+                if (15 < dirn)
                 {
-                    newmark = imap__alloc_node__(tree);
-                    *slot = (*slot & imap__slot_pmask__) | imap__slot_node__ | newmark;
+                    iter->stackp--;
+                    continue;
                 }
-                newnode = imap__node__(tree, newmark);
-                *newnode = imap__node_zero__;
-                imap__node_setprefix__(newnode, x & ~0xfull);
-                return &newnode->vec32[x & 0xfull];
+                if (!(h & (1 << dirn)))
+                    continue;
+                i = imap__popcnt16__(h & ((1 << dirn) - 1));
+                if ((ref & 3) == imap__frozen_tleaf__)
+                    return imap__frozen_pair__(*(imap_u64_t *)p | dirn, imap__frozen_leaf_value__(p, h, i));
+                ref = ((imap_u32_t *)p)[1 + i];
             }
-            node = imap__node__(tree, sval & imap__slot_value__);
-            posn = imap__node_pos__(node);
-            dirn = imap__xdir__(x, posn);
+            if ((ref & 3) == imap__frozen_tpair__)
+            {
+                p = imap__frozen_node__(frozen, ref);
+                return imap__frozen_pair__(*(imap_u64_t *)p, *(imap_u64_t *)(p + sizeof(imap_u64_t)));
+            }
+            iter->stack[iter->stackp++] = imap__frozen_entry__(ref, 0);
+        }
+        pair.x = pair.y = 0;
+        pair.valid = 0;
+        return pair;
+    }
+
+    static inline
+    imap_u64_t imap__frozen_key__(imap_frozen_t *frozen, imap_u32_t ref)
+    {
+        // any key under a node; the prefix of a leaf will do
+        imap_u8_t *p;
+        imap_u32_t i;
+        for (;;)
+        {
+            p = imap__frozen_node__(frozen, ref);
+            if ((ref & 3) != imap__frozen_tinner__)
+                return *(imap_u64_t *)p;
+            for (i = 1; !((imap_u32_t *)p)[i]; i++)
+                ;
+            ref = ((imap_u32_t *)p)[i];
         }
     }
 
     IMAP_DEFNFUNC
-    int imap_hasval(imap_node_t *tree, imap_slot_t *slot)
+    imap_frozen_pair_t imap_frozen_locate(imap_frozen_t *frozen, imap_frozen_iter_t *iter, imap_u64_t x)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        return sval & imap__slot_value__;
+        imap_u32_t ref = imap__frozen_root__(frozen), term, h, dirn, diff, popped, i;
+        imap_u64_t k, xk;
+        imap_u8_t *p;
+        iter->stackp = 0;
+        if (!ref)
+            return imap__frozen_next__(frozen, iter);
+        // follow x down as far as the tree goes; every node on the way resumes after the direction of x
+        for (term = ref;;)
+        {
+            p = imap__frozen_node__(frozen, term);
+            if ((term & 3) == imap__frozen_tleaf__)
+            {
+                iter->stack[iter->stackp++] = imap__frozen_entry__(term, x & 0xf);
+                k = *(imap_u64_t *)p;
+                xk = x & ~0xfull;
+                break;
+            }
+            if ((term & 3) == imap__frozen_tpair__)
+            {
+                k = *(imap_u64_t *)p;
+                xk = x;
+                break;
+            }
+            h = *(imap_u32_t *)p;
+            if (h & imap__frozen_wide__)
+            {
+                dirn = imap__xdir8__(x, imap__frozen_pos__(h));
+                i = ((imap_u32_t *)p)[1 + dirn];
+            }
+            else
+            {
+                dirn = imap__xdir__(x, imap__frozen_pos__(h));
+                i = h & (1 << dirn) ? ((imap_u32_t *)p)[1 + imap__popcnt16__(h & ((1 << dirn) - 1))] : 0;
+            }
+            iter->stack[iter->stackp++] = imap__frozen_entry__(term, dirn + 1);
+            if (!i)
+            {
+                k = imap__frozen_key__(frozen, term);
+                xk = x;
+                term = 0;
+                break;
+            }
+            term = i;
+        }
+        if (xk == k)
+        {
+            if (term && (term & 3) == imap__frozen_tpair__)
+                return imap__frozen_pair__(k, *(imap_u64_t *)(p + sizeof(imap_u64_t)));
+            return imap__frozen_next__(frozen, iter);
+        }
+        // internal node prefixes are not kept: a key of the subtree where the walk stopped tells the
+        // position where x parts from the tree; the subtree below that position is all before or all after x
+        diff = imap__xpos__(xk ^ k);
+        popped = 0;
+        while (iter->stackp)
+        {
+            ref = (imap_u32_t)(iter->stack[iter->stackp - 1] >> 9);
+            p = imap__frozen_node__(frozen, ref);
+            if ((ref & 3) != imap__frozen_tleaf__ && imap__frozen_pos__(*(imap_u32_t *)p) >= diff)
+                break;
+            iter->stackp--;
+            popped = 1;
+        }
+        if (xk < k)
+        {
+            if (popped)
+            {
+                // revisit the subtree from its beginning
+                if (iter->stackp)
+                    iter->stack[iter->stackp - 1]--;
+                else
+                    iter->stack[iter->stackp++] = imap__frozen_entry__(imap__frozen_root__(frozen), 0);
+            }
+            else if (term)
+                return imap__frozen_pair__(k, *(imap_u64_t *)(imap__frozen_node__(frozen, term) + sizeof(imap_u64_t)));
+        }
+        return imap__frozen_next__(frozen, iter);
     }
 
     IMAP_DEFNFUNC
-    imap_u64_t imap_getval(imap_node_t *tree, imap_slot_t *slot)
+    imap_frozen_pair_t imap_frozen_iterate(imap_frozen_t *frozen, imap_frozen_iter_t *iter, int restart)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        if (!imap__slot_boxed__(sval))
-            return sval >> imap__slot_shift__;
+        imap_u32_t ref;
+        imap_u8_t *p;
+        if (restart)
+        {
+            iter->stackp = 0;
+            ref = imap__frozen_root__(frozen);
+            if ((ref & 3) == imap__frozen_tpair__)
+            {
+                p = imap__frozen_node__(frozen, ref);
+                return imap__frozen_pair__(*(imap_u64_t *)p, *(imap_u64_t *)(p + sizeof(imap_u64_t)));
+            }
+            if (ref)
+                iter->stack[iter->stackp++] = imap__frozen_entry__(ref, 0);
+        }
+        return imap__frozen_next__(frozen, iter);
+    }
+
+    #define imap__count_index__(sval)   (imap__inner_offset__(sval) / imap__small_size__)
+
+    static inline
+    imap_u32_t imap__count_slot__(imap_node_t *tree, imap_u32_t *counts, imap_slot_t sval)
+    {
+        if (!(sval & imap__slot_node__))
+            return !!(sval & imap__slot_value__);
+        if (imap__slot_iscell__(sval))
+            return !!(*imap__cell_slot__(tree, sval) & imap__slot_value__);
+        IMAP_ASSERT(imap__count_index__(sval) < counts[0]);
+        return counts[imap__count_index__(sval)];
+    }
+
+    static inline
+    imap_u32_t imap__count_node__(imap_node_t *tree, imap_u32_t *counts, imap_slot_t mark)
+    {
+        imap_slot_t *slots;
+        imap_u32_t count = 0, dirn;
+        if (mark & imap__slot_cell__)
+        {
+            slots = imap__small_slots__(tree, mark);
+            count = imap__count_slot__(tree, counts, slots[0]) + imap__count_slot__(tree, counts, slots[1]);
+        }
         else
-            return tree->vec64[sval >> imap__slot_shift__];
+        {
+            slots = imap__node__(tree, mark)->vecsl;
+            for (dirn = 0; 16 > dirn; dirn++)
+                count += imap__count_slot__(tree, counts, slots[dirn]);
+        }
+        // a tree grown without a matching imap_count_ensure has nodes past the end of the array
+        IMAP_ASSERT(imap__count_index__(mark) < counts[0]);
+        return counts[imap__count_index__(mark)] = count;
+    }
+
+    static inline
+    imap_u32_t imap__count_build__(imap_node_t *tree, imap_u32_t *counts, imap_slot_t mark)
+    {
+        imap_slot_t *slot;
+        imap_u32_t dirn;
+        if (0 != imap__inner_pos__(tree, mark))
+            for (dirn = 0; 16 > dirn; dirn++)
+            {
+                slot = imap__inner_slot__(tree, mark, dirn);
+                if (slot && imap__slot_isinner__(*slot))
+                    imap__count_build__(tree, counts, *slot & imap__slot_value__);
+            }
+        return imap__count_node__(tree, counts, mark);
+    }
+
+    static inline
+    imap_u64_t imap__list_rank__(imap_node_t *tree, imap_slot_t lval, imap_u32_t n)
+    {
+        // a list needs no counts: the rank of an entry is the number of entries with a value before it
+        imap_slot_t *slots = imap__list_slots__(tree);
+        imap_u64_t rank = 0;
+        imap_u32_t i;
+        for (i = 0; n > i; i++)
+            rank += !!(slots[i] & imap__slot_value__);
+        return rank;
+    }
+
+    static inline
+    imap_u64_t imap__count_total__(imap_node_t *tree, imap_u32_t *counts)
+    {
+        imap_slot_t sval = tree->vecsl[imap__tree_root__];
+        if (imap__slot_islist__(sval))
+            return imap__list_rank__(tree, sval, sval & imap__slot_pmask__);
+        return imap__count_slot__(tree, counts, sval);
     }
 
     IMAP_DEFNFUNC
-    imap_u32_t imap_getval0(imap_node_t *tree, imap_slot_t *slot)
+    imap_u32_t *imap_count_ensure(imap_node_t *tree, imap_u32_t *counts)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        return sval >> imap__slot_shift__;
+        imap_u32_t *newcounts;
+        imap_slot_t sval;
+        imap_u32_t capacity;
+        capacity = (imap_u32_t)(tree->vecsl[imap__tree_size__] / imap__small_size__);
+        if (counts && capacity <= counts[0])
+            return counts;
+        newcounts = (imap_u32_t *)IMAP_MALLOC(capacity * sizeof(imap_u32_t));
+        if (!newcounts)
+            return newcounts;
+        if (counts)
+        {
+            IMAP_MEMCPY(newcounts, counts, counts[0] * sizeof(imap_u32_t));
+            IMAP_FREE(counts);
+        }
+        // counts are indexed in units of a small node; the first unit is in the tree header
+        // and has no count; its entry holds the capacity
+        newcounts[0] = capacity;
+        if (!counts)
+        {
+            sval = tree->vecsl[imap__tree_root__];
+            if (imap__slot_isinner__(sval))
+                imap__count_build__(tree, newcounts, sval & imap__slot_value__);
+        }
+        return newcounts;
     }
 
     IMAP_DEFNFUNC
-    imap_u64_t imap_getval64(imap_node_t *tree, imap_slot_t *slot)
+    void imap_count_free(imap_u32_t *counts)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        return tree->vec64[sval >> imap__slot_shift__];
+        IMAP_FREE(counts);
     }
 
     IMAP_DEFNFUNC
-    imap_u128_t imap_getval128(imap_node_t *tree, imap_slot_t *slot)
+    void imap_count_update(imap_node_t *tree, imap_u32_t *counts, imap_u64_t x)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        return tree->vec128[sval >> (imap__slot_shift__ + 1)];
+        imap_slot_t markstack[16];
+        imap_u32_t stackp;
+        imap_slot_t *slot;
+        imap_slot_t sval;
+        IMAP_ASSERT(tree->vecsl[imap__tree_size__] / imap__small_size__ <= counts[0]);
+        stackp = 0;
+        sval = tree->vecsl[imap__tree_root__];
+        while (imap__slot_isinner__(sval))
+        {
+            sval &= imap__slot_value__;
+            markstack[stackp++] = sval;
+            slot = imap__inner_slot__(tree, sval, imap__xdir__(x, imap__inner_pos__(tree, sval)));
+            if (!slot)
+                break;
+            sval = *slot;
+        }
+        while (stackp)
+            imap__count_node__(tree, counts, markstack[--stackp]);
+    }
+
+    IMAP_DEFNFUNC
+    imap_u64_t imap_rank(imap_node_t *tree, imap_u32_t *counts, imap_u64_t x)
+    {
+        imap_node_t *node;
+        imap_slot_t *slots;
+        imap_slot_t sval;
+        imap_u32_t posn, dirn, d;
+        imap_u64_t prfx, rank = 0;
+        sval = tree->vecsl[imap__tree_root__];
+        if (imap__slot_islist__(sval))
+            return imap__list_rank__(tree, sval, imap__list_lower__(tree, sval, x));
+        while (sval & imap__slot_node__)
+        {
+            if (imap__slot_iscell__(sval))
+            {
+                if (*imap__cell__(tree, sval) < x)
+                    rank += imap__count_slot__(tree, counts, sval);
+                break;
+            }
+            posn = imap__inner_pos__(tree, sval);
+            prfx = imap__inner_prefix__(tree, sval);
+            if (posn < imap__xpos__(prfx ^ x))
+            {
+                // x lies outside the subtree: all or none of its entries precede x
+                if (prfx < x)
+                    rank += counts[imap__count_index__(sval)];
+                break;
+            }
+            dirn = imap__xdir__(x, posn);
+            if (sval & imap__slot_cell__)
+            {
+                slots = imap__small_slots__(tree, sval);
+                if ((slots[0] & imap__slot_pmask__) < dirn)
+                    rank += imap__count_slot__(tree, counts, slots[0]);
+                if ((slots[1] & imap__slot_pmask__) < dirn)
+                    rank += imap__count_slot__(tree, counts, slots[1]);
+                slots = imap__small_slot__(tree, sval, dirn);
+                if (!slots)
+                    break;
+                sval = *slots;
+                continue;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            for (d = 0; dirn > d; d++)
+                rank += imap__count_slot__(tree, counts, node->vecsl[d]);
+            sval = node->vecsl[dirn];
+        }
+        return rank;
     }
 
     IMAP_DEFNFUNC
-    void imap_setval(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y)
+    imap_pair_t imap_select(imap_node_t *tree, imap_u32_t *counts, imap_u64_t k)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        if (y < (1 << (imap__slot_sbits__)))
+        imap_node_t *node;
+        imap_slot_t *slots;
+        imap_slot_t sval;
+        imap_u32_t dirn, count;
+        if (imap__count_total__(tree, counts) <= k)
+            return imap__pair_zero__;
+        sval = tree->vecsl[imap__tree_root__];
+        if (imap__slot_islist__(sval))
         {
-            if (imap__slot_boxed__(sval))
-            {
-                tree->vec64[sval >> imap__slot_shift__] = tree->vec32[imap__tree_vfre__];
-                tree->vec32[imap__tree_vfre__] = sval & imap__slot_value__;
-            }
-            *slot = (*slot & imap__slot_pmask__) | imap__slot_scalar__ | (imap_u32_t)(y << imap__slot_shift__);
+            slots = imap__list_slots__(tree);
+            for (dirn = 0;; dirn++)
+                if ((slots[dirn] & imap__slot_value__) && 0 == k--)
+                    break;
+            return imap__pair__(imap__list_keys__(tree)[dirn], &slots[dirn]);
         }
-        else
+        for (;;)
         {
-            if (!imap__slot_boxed__(sval))
+            if (imap__slot_iscell__(sval))
+                return imap__pair__(*imap__cell__(tree, sval), imap__cell_slot__(tree, sval));
+            if (sval & imap__slot_cell__)
             {
-                sval = tree->vec32[imap__tree_vfre__];
-                if (!sval)
-                    sval = imap__alloc_val__(tree);
-                IMAP_ASSERT(sval >> imap__slot_shift__);
-                tree->vec32[imap__tree_vfre__] = (imap_u32_t)tree->vec64[sval >> imap__slot_shift__];
+                slots = imap__small_slots__(tree, sval);
+                sval = slots[0];
+                count = imap__count_slot__(tree, counts, sval);
+                if (k >= count)
+                    k -= count, sval = slots[1];
+                continue;
+            }
+            node = imap__node__(tree, sval & imap__slot_value__);
+            for (dirn = 0;; dirn++)
+            {
+                IMAP_ASSERT(16 > dirn);
+                sval = node->vecsl[dirn];
+                count = imap__count_slot__(tree, counts, sval);
+                if (k < count)
+                    break;
+                k -= count;
+            }
+            if (!(sval & imap__slot_node__))
+            {
+                IMAP_ASSERT(0 == imap__node_pos__(node));
+                return imap__pair__(imap__node_prefix__(node) | dirn, &node->vecsl[dirn]);
             }
-            IMAP_ASSERT(!(sval & imap__slot_node__));
-            IMAP_ASSERT(imap__slot_boxed__(sval));
-            *slot = (*slot & imap__slot_pmask__) | sval;
-            tree->vec64[sval >> imap__slot_shift__] = y;
         }
     }
 
     IMAP_DEFNFUNC
-    void imap_setval0(imap_node_t *tree, imap_slot_t *slot, imap_u32_t y)
+    imap_u64_t imap_count_range(imap_node_t *tree, imap_u32_t *counts, imap_u64_t x0, imap_u64_t x1)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        *slot = (*slot & imap__slot_pmask__) | imap__slot_scalar__ | (imap_u32_t)(y << imap__slot_shift__);
+        imap_u64_t rank1;
+        if (x0 > x1)
+            return 0;
+        rank1 = ~0ull == x1 ? imap__count_total__(tree, counts) : imap_rank(tree, counts, x1 + 1);
+        return rank1 - imap_rank(tree, counts, x0);
     }
 
     IMAP_DEFNFUNC
-    void imap_setval64(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y)
+    imap_pair_t imap_sample(imap_node_t *tree, imap_u32_t *counts, imap_u64_t r)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        if (!(sval >> imap__slot_shift__))
-        {
-            sval = tree->vec32[imap__tree_vfre__];
-            if (!sval)
-                sval = imap__alloc_val__(tree);
-            IMAP_ASSERT(sval >> imap__slot_shift__);
-            tree->vec32[imap__tree_vfre__] = (imap_u32_t)tree->vec64[sval >> imap__slot_shift__];
-        }
-        IMAP_ASSERT(!(sval & imap__slot_node__));
-        IMAP_ASSERT(imap__slot_boxed__(sval));
-        *slot = (*slot & imap__slot_pmask__) | sval;
-        tree->vec64[sval >> imap__slot_shift__] = y;
+        imap_u64_t total = imap__count_total__(tree, counts);
+        if (0 == total)
+            return imap__pair_zero__;
+        return imap_select(tree, counts, r % total);
     }
 
-    IMAP_DEFNFUNC
-    void imap_setval128(imap_node_t *tree, imap_slot_t *slot, imap_u128_t y)
+    static inline
+    imap_pair_t imap__list_iterate__(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x1)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        if (!(sval >> imap__slot_shift__))
+        // the iterator of a list holds the index of the next entry
+        imap_u64_t *keys = imap__list_keys__(tree);
+        imap_slot_t *slots = imap__list_slots__(tree);
+        imap_u32_t count = tree->vecsl[imap__tree_root__] & imap__slot_pmask__, i;
+        while (iter->stackp)
         {
-            sval = tree->vec32[imap__tree_vfre__];
-            if (!sval)
-                sval = imap__alloc_val128__(tree);
-            IMAP_ASSERT(sval >> imap__slot_shift__);
-            tree->vec32[imap__tree_vfre__] = (imap_u32_t)tree->vec128[sval >> (imap__slot_shift__ + 1)].v[0];
+            i = (imap_u32_t)iter->stack[0]++;
+            if (count <= i || keys[i] > x1)
+                break;
+            if (slots[i] & imap__slot_value__)
+                return imap__pair__(keys[i], &slots[i]);
         }
-        IMAP_ASSERT(!(sval & imap__slot_node__));
-        IMAP_ASSERT(imap__slot_boxed__(sval));
-        *slot = (*slot & imap__slot_pmask__) | sval;
-        tree->vec128[sval >> (imap__slot_shift__ + 1)] = y;
+        iter->stackp = 0;
+        return imap__pair_zero__;
     }
 
-    IMAP_DEFNFUNC
-    void imap_delval(imap_node_t *tree, imap_slot_t *slot)
+    static inline
+    imap_pair_t imap__list_iterate_rev__(imap_node_t *tree, imap_iter_t *iter)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        if (imap__slot_boxed__(sval))
+        // the reverse iterator of a list holds the number of entries that remain to be examined
+        imap_u64_t *keys = imap__list_keys__(tree);
+        imap_slot_t *slots = imap__list_slots__(tree);
+        imap_u32_t count = tree->vecsl[imap__tree_root__] & imap__slot_pmask__, i;
+        while (iter->stackp && iter->stack[0])
         {
-            tree->vec64[sval >> imap__slot_shift__] = tree->vec32[imap__tree_vfre__];
-            tree->vec32[imap__tree_vfre__] = sval & imap__slot_value__;
+            i = (imap_u32_t)--iter->stack[0];
+            if (count > i && (slots[i] & imap__slot_value__))
+                return imap__pair__(keys[i], &slots[i]);
         }
-        *slot &= imap__slot_pmask__;
+        iter->stackp = 0;
+        return imap__pair_zero__;
     }
 
-    IMAP_DEFNFUNC
-    imap_u64_t *imap_addrof64(imap_node_t *tree, imap_slot_t *slot)
+    static inline
+    imap_pair_t imap__locate__(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        return &tree->vec64[sval >> imap__slot_shift__];
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t sval, cval, mark = 0;
+        imap_u32_t posn = 16, dirn;
+        imap_u64_t prfx, xpfx;
+        if (imap__slot_islist__(*slot))
+        {
+            iter->stackp = 1;
+            iter->stack[0] = imap__list_lower__(tree, *slot, x);
+            return imap__list_iterate__(tree, iter, ~0ull);
+        }
+        iter->stackp = 0;
+        if (imap__jump_slot__(tree, x))
+            slot = imap__jump_path__(tree, iter, x);
+        for (;;)
+        {
+            sval = *slot;
+            if (imap__slot_isinner__(sval))
+            {
+                mark = sval & imap__slot_value__;
+                posn = imap__inner_pos__(tree, mark);
+                dirn = imap__xdir__(x, posn);
+                iter->stack[iter->stackp++] = mark | (dirn + 1);
+                if (0 != (slot = imap__inner_slot__(tree, mark, dirn)))
+                    continue;
+                // a small node without a child in the direction of x acts as an empty slot
+                sval = 0;
+            }
+            prfx = imap__inner_prefix__(tree, mark);
+            if (!(sval & imap__slot_node__) && (sval & imap__slot_value__) && prfx == (x & ~0xfull))
+            {
+                IMAP_ASSERT(0 == posn);
+                return imap__pair__(x, slot);
+            }
+            cval = sval & imap__slot_node__ ? sval : 0;
+            if (iter->stackp)
+                for (;;)
+                {
+                    prfx = imap__xpfx__(prfx, posn);
+                    xpfx = imap__xpfx__(x, posn);
+                    if (prfx == xpfx)
+                        break;
+                    // the node with the cell is either skipped or iterated as a whole
+                    cval = 0;
+                    if (prfx > xpfx)
+                    {
+                        if (!--iter->stackp)
+                        {
+                            // start at beginning of tree; same as supplying restart=1
+                            iter->stack[iter->stackp++] &= imap__slot_value__;
+                            break;
+                        }
+                        iter->stack[iter->stackp - 1]--;
+                    }
+                    else // if (prfx < xpfx)
+                    {
+                        if (!--iter->stackp)
+                            break;
+                    }
+                    posn = imap__inner_pos__(tree, iter->stack[iter->stackp - 1] & imap__slot_value__);
+                }
+            // a cell in the direction of x is the next pair if its key is not less than x;
+            // the iterator is already positioned past it
+            if (cval && x <= *imap__cell__(tree, cval) && (*imap__cell_slot__(tree, cval) & imap__slot_value__))
+                return imap__pair__(*imap__cell__(tree, cval), imap__cell_slot__(tree, cval));
+            return imap__pair_zero__;
+        }
     }
 
     IMAP_DEFNFUNC
-    imap_u128_t *imap_addrof128(imap_node_t *tree, imap_slot_t *slot)
+    imap_pair_t imap_locate(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x)
     {
-        IMAP_ASSERT(!(*slot & imap__slot_node__));
-        imap_u32_t sval = *slot;
-        return &tree->vec128[sval >> (imap__slot_shift__ + 1)];
+        imap_pair_t pair = imap__locate__(tree, iter, x);
+        return pair.slot ? pair : imap_iterate(tree, iter, 0);
     }
 
     IMAP_DEFNFUNC
-    void imap_remove(imap_node_t *tree, imap_u64_t x)
+    imap_pair_t imap_iterate(imap_node_t *tree, imap_iter_t *iter, int restart)
     {
-        imap_slot_t *slotstack[16 + 1];
-        imap_u32_t stackp;
-        imap_node_t *node = tree;
         imap_slot_t *slot;
-        imap_u32_t sval, pval, posn = 16, dirn = 0;
-        stackp = 0;
-        for (;;)
+        imap_slot_t sval, mark;
+        imap_u32_t dirn;
+        if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+        {
+            if (restart)
+                iter->stackp = 1, iter->stack[0] = 0;
+            return imap__list_iterate__(tree, iter, ~0ull);
+        }
+        if (restart)
+        {
+            iter->stackp = 0;
+            mark = dirn = 0;
+            goto enter;
+        }
+        // loop while stack is not empty
+        while (iter->stackp)
         {
-            slot = &node->vec32[dirn];
+            // get slot value and increment direction
+            sval = iter->stack[iter->stackp - 1]++;
+            dirn = sval & 31;
+            if (15 < dirn)
+            {
+                // if directions 0-15 have been examined, pop node from stack
+                iter->stackp--;
+                continue;
+            }
+            mark = sval & imap__slot_value__;
+        enter:
+            slot = imap__inner_slot__(tree, mark, dirn);
+            if (!slot)
+                continue;
             sval = *slot;
-            if (!(sval & imap__slot_node__))
+            if (sval & imap__slot_node__)
             {
-                if ((sval & imap__slot_value__) && imap__node_prefix__(node) == (x & ~0xfull))
-                {
-                    IMAP_ASSERT(0 == posn);
-                    imap_delval(tree, slot);
-                }
-                while (stackp)
-                {
-                    slot = slotstack[--stackp];
-                    sval = *slot;
-                    node = imap__node__(tree, sval & imap__slot_value__);
-                    posn = imap__node_pos__(node);
-                    if (!!posn != imap__node_popcnt__(node, &pval))
-                        break;
-                    imap__free_node__(tree, sval & imap__slot_value__);
-                    *slot = (sval & imap__slot_pmask__) | (pval & ~imap__slot_pmask__);
-                }
-                return;
+                if (imap__slot_isinner__(sval))
+                    // push node into stack
+                    iter->stack[iter->stackp++] = sval & imap__slot_value__;
+                else if (*imap__cell_slot__(tree, sval) & imap__slot_value__)
+                    return imap__pair__(*imap__cell__(tree, sval), imap__cell_slot__(tree, sval));
             }
-            node = imap__node__(tree, sval & imap__slot_value__);
-            posn = imap__node_pos__(node);
-            dirn = imap__xdir__(x, posn);
-            slotstack[stackp++] = slot;
+            else if (sval & imap__slot_value__)
+                return imap__pair__(imap__node_prefix__(imap__node__(tree, mark)) | dirn, slot);
         }
+        return imap__pair_zero__;
     }
 
     IMAP_DEFNFUNC
-    imap_pair_t imap_locate(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x)
+    imap_pair_t imap_locate_rev(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x)
     {
-        imap_node_t *node = tree;
-        imap_slot_t *slot;
-        imap_u32_t sval, posn = 16, dirn = 0;
+        imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+        imap_slot_t sval, cval, mark = 0;
+        imap_u32_t posn = 16, dirn = 0;
         imap_u64_t prfx, xpfx;
+        if (imap__slot_islist__(*slot))
+        {
+            iter->stackp = 1;
+            iter->stack[0] = ~0ull == x ? *slot & imap__slot_pmask__ : imap__list_lower__(tree, *slot, x + 1);
+            return imap__list_iterate_rev__(tree, iter);
+        }
         iter->stackp = 0;
         for (;;)
         {
-            slot = &node->vec32[dirn];
             sval = *slot;
-            if (!(sval & imap__slot_node__))
+            if (imap__slot_isinner__(sval))
             {
-                prfx = imap__node_prefix__(node);
-                if ((sval & imap__slot_value__) && prfx == (x & ~0xfull))
+                mark = sval & imap__slot_value__;
+                posn = imap__inner_pos__(tree, mark);
+                dirn = imap__xdir__(x, posn);
+                iter->stack[iter->stackp++] = mark | dirn;
+                if (0 != (slot = imap__inner_slot__(tree, mark, dirn)))
+                    continue;
+                // a small node without a child in the direction of x acts as an empty slot
+                sval = 0;
+            }
+            prfx = imap__inner_prefix__(tree, mark);
+            if (!(sval & imap__slot_node__) && (sval & imap__slot_value__) && prfx == (x & ~0xfull))
+            {
+                IMAP_ASSERT(0 == posn);
+                return imap__pair__(prfx | dirn, slot);
+            }
+            cval = sval & imap__slot_node__ ? sval : 0;
+            if (iter->stackp)
+                for (;;)
                 {
-                    IMAP_ASSERT(0 == posn);
-                    return imap__pair__(prfx | dirn, slot);
-                }
-                if (iter->stackp)
-                    for (;;)
+                    prfx = imap__xpfx__(prfx, posn);
+                    xpfx = imap__xpfx__(x, posn);
+                    if (prfx == xpfx)
+                        break;
+                    // the node with the cell is either skipped or iterated as a whole
+                    cval = 0;
+                    if (prfx < xpfx)
                     {
-                        prfx = imap__xpfx__(prfx, posn);
-                        xpfx = imap__xpfx__(x, posn);
-                        if (prfx == xpfx)
-                            break;
-                        if (prfx > xpfx)
-                        {
-                            if (!--iter->stackp)
-                            {
-                                // start at beginning of tree; same as supplying restart=1
-                                iter->stack[iter->stackp++] &= imap__slot_value__;
-                                break;
-                            }
-                            iter->stack[iter->stackp - 1]--;
-                        }
-                        else // if (prfx < xpfx)
+                        if (!--iter->stackp)
                         {
-                            if (!--iter->stackp)
-                                break;
+                            // start at end of tree; same as supplying restart=1
+                            iter->stack[iter->stackp++] = (iter->stack[0] & imap__slot_value__) | 16;
+                            break;
                         }
-                        sval = iter->stack[iter->stackp - 1];
-                        node = imap__node__(tree, sval & imap__slot_value__);
-                        posn = imap__node_pos__(node);
+                        iter->stack[iter->stackp - 1]++;
                     }
-                return imap_iterate(tree, iter, 0);
-            }
-            node = imap__node__(tree, sval & imap__slot_value__);
-            posn = imap__node_pos__(node);
-            dirn = imap__xdir__(x, posn);
-            iter->stack[iter->stackp++] = (sval & imap__slot_value__) | (dirn + 1);
+                    else // if (prfx > xpfx)
+                    {
+                        if (!--iter->stackp)
+                            break;
+                    }
+                    posn = imap__inner_pos__(tree, iter->stack[iter->stackp - 1] & imap__slot_value__);
+                }
+            // a cell in the direction of x is the next pair if its key is not greater than x;
+            // the iterator is already positioned past it
+            if (cval && *imap__cell__(tree, cval) <= x && (*imap__cell_slot__(tree, cval) & imap__slot_value__))
+                return imap__pair__(*imap__cell__(tree, cval), imap__cell_slot__(tree, cval));
+            return imap_iterate_rev(tree, iter, 0);
         }
     }
 
     IMAP_DEFNFUNC
-    imap_pair_t imap_iterate(imap_node_t *tree, imap_iter_t *iter, int restart)
+    imap_pair_t imap_iterate_rev(imap_node_t *tree, imap_iter_t *iter, int restart)
     {
-        imap_node_t *node;
         imap_slot_t *slot;
-        imap_u32_t sval, dirn;
+        imap_slot_t sval, mark;
+        imap_u32_t dirn;
+        if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+        {
+            if (restart)
+                iter->stackp = 1, iter->stack[0] = tree->vecsl[imap__tree_root__] & imap__slot_pmask__;
+            return imap__list_iterate_rev__(tree, iter);
+        }
         if (restart)
         {
             iter->stackp = 0;
-            sval = dirn = 0;
+            mark = dirn = 0;
             goto enter;
         }
+        // loop while stack is not empty; the low bits of a stack entry hold the
+        // number of directions that remain to be examined (from dirn-1 down to 0)
+        while (iter->stackp)
+        {
+            // get slot value and decrement direction
+            sval = iter->stack[iter->stackp - 1];
+            dirn = sval & 31;
+            if (0 == dirn)
+            {
+                // if directions 15-0 have been examined, pop node from stack
+                iter->stackp--;
+                continue;
+            }
+            iter->stack[iter->stackp - 1] = --sval;
+            dirn--;
+            mark = sval & imap__slot_value__;
+        enter:
+            slot = imap__inner_slot__(tree, mark, dirn);
+            if (!slot)
+                continue;
+            sval = *slot;
+            if (sval & imap__slot_node__)
+            {
+                if (imap__slot_isinner__(sval))
+                    // push node into stack
+                    iter->stack[iter->stackp++] = (sval & imap__slot_value__) | 16;
+                else if (*imap__cell_slot__(tree, sval) & imap__slot_value__)
+                    return imap__pair__(*imap__cell__(tree, sval), imap__cell_slot__(tree, sval));
+            }
+            else if (sval & imap__slot_value__)
+                return imap__pair__(imap__node_prefix__(imap__node__(tree, mark)) | dirn, slot);
+        }
+        return imap__pair_zero__;
+    }
+
+    IMAP_DEFNFUNC
+    imap_pair_t imap_locate_range(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x0, imap_u64_t x1)
+    {
+        imap_pair_t pair;
+        if (x0 > x1)
+        {
+            iter->stackp = 0;
+            return imap__pair_zero__;
+        }
+        pair = imap__locate__(tree, iter, x0);
+        if (!pair.slot)
+            return imap_iterate_range(tree, iter, x1);
+        if (pair.x > x1)
+        {
+            iter->stackp = 0;
+            return imap__pair_zero__;
+        }
+        return pair;
+    }
+
+    IMAP_DEFNFUNC
+    imap_pair_t imap_iterate_range(imap_node_t *tree, imap_iter_t *iter, imap_u64_t x1)
+    {
+        imap_slot_t *slot;
+        imap_slot_t sval, mark;
+        imap_u32_t dirn;
+        imap_u64_t x;
+        if (imap__slot_islist__(tree->vecsl[imap__tree_root__]))
+            return imap__list_iterate__(tree, iter, x1);
         // loop while stack is not empty
         while (iter->stackp)
         {
@@ -946,37 +5534,86 @@ extern "C" {
                 iter->stackp--;
                 continue;
             }
-        enter:
-            node = imap__node__(tree, sval & imap__slot_value__);
-            slot = &node->vec32[dirn];
+            mark = sval & imap__slot_value__;
+            slot = imap__inner_slot__(tree, mark, dirn);
+            if (!slot)
+                continue;
             sval = *slot;
-            if (sval & imap__slot_node__)
+            if (imap__slot_iscell__(sval))
+            {
+                x = *imap__cell__(tree, sval);
+                if (x > x1)
+                    break;
+                if (*imap__cell_slot__(tree, sval) & imap__slot_value__)
+                    return imap__pair__(x, imap__cell_slot__(tree, sval));
+            }
+            else if (sval & imap__slot_node__)
+            {
+                // if the subtree starts past the upper bound, so does everything after it
+                sval &= imap__slot_value__;
+                if (imap__xpfx__(imap__inner_prefix__(tree, sval), imap__inner_pos__(tree, sval)) > x1)
+                    break;
                 // push node into stack
-                iter->stack[iter->stackp++] = sval & imap__slot_value__;
+                iter->stack[iter->stackp++] = sval;
+            }
             else if (sval & imap__slot_value__)
-                return imap__pair__(imap__node_prefix__(node) | dirn, slot);
+            {
+                x = imap__node_prefix__(imap__node__(tree, mark)) | dirn;
+                if (x > x1)
+                    break;
+                return imap__pair__(x, slot);
+            }
         }
+        iter->stackp = 0;
         return imap__pair_zero__;
     }
 
+    IMAP_DEFNFUNC
+    int imap_scan_range(imap_node_t *tree, imap_u64_t x0, imap_u64_t x1, imap_scanfn_t *scanfn, void *ctx)
+    {
+        imap_iter_t iterdata, *iter = &iterdata;
+        imap_pair_t pair;
+        int result;
+        for (pair = imap_locate_range(tree, iter, x0, x1); pair.slot; pair = imap_iterate_range(tree, iter, x1))
+            if (0 != (result = scanfn(ctx, pair.x, pair.slot)))
+                return result;
+        return 0;
+    }
+
     static inline
-    int imap_dump_node(imap_node_t *tree, imap_u32_t mark, imap_dumpfn_t *dumpfn, void *ctx)
+    int imap_dump_node(imap_node_t *tree, imap_slot_t mark, imap_dumpfn_t *dumpfn, void *ctx)
     {
-        imap_node_t *node;
         imap_slot_t *slot;
-        imap_u32_t sval, posn, dirn;
+        imap_slot_t sval;
+        imap_u32_t posn, dirn;
         imap_u64_t prfx;
-        node = imap__node__(tree, mark);
-        posn = imap__node_pos__(node);
-        prfx = imap__node_prefix__(node);
-        dumpfn(ctx, "%08x: %016llx/%x",
-            mark, (unsigned long long)(prfx & ~imap__prefix_pos__), posn);
+        if (imap__slot_islist__(mark))
+        {
+            // a list is dumped as its keys and values
+            slot = imap__list_slots__(tree);
+            dumpfn(ctx, "%08llx: list", (unsigned long long)sizeof(imap_node_t));
+            for (dirn = 0; (mark & imap__slot_pmask__) > dirn; dirn++)
+                if (slot[dirn] & imap__slot_value__)
+                    dumpfn(ctx, " %llx:%llx", (unsigned long long)imap__list_keys__(tree)[dirn],
+                        (unsigned long long)imap_getval(tree, &slot[dirn]));
+            dumpfn(ctx, "\n");
+            return 0;
+        }
+        posn = imap__inner_pos__(tree, mark);
+        prfx = imap__inner_prefix__(tree, mark);
+        dumpfn(ctx, "%08llx: %016llx/%x",
+            (unsigned long long)imap__inner_offset__(mark), (unsigned long long)(prfx & ~imap__prefix_pos__), posn);
         for (dirn = 0; 16 > dirn; dirn++)
         {
-            slot = &node->vec32[dirn];
+            slot = imap__inner_slot__(tree, mark, dirn);
+            if (!slot)
+                continue;
             sval = *slot;
-            if (sval & imap__slot_node__)
-                dumpfn(ctx, " %x->*%x", dirn, sval & imap__slot_value__);
+            if (imap__slot_iscell__(sval))
+                dumpfn(ctx, " %x->%llx:%llx", dirn, (unsigned long long)*imap__cell__(tree, sval),
+                    (unsigned long long)imap_getval(tree, imap__cell_slot__(tree, sval)));
+            else if (sval & imap__slot_node__)
+                dumpfn(ctx, " %x->*%llx", dirn, (unsigned long long)imap__inner_offset__(sval));
             else if (sval & imap__slot_value__)
                 dumpfn(ctx, " %x->%llx", dirn, (unsigned long long)imap_getval(tree, slot));
         }
@@ -985,27 +5622,56 @@ extern "C" {
     }
 
     static inline
-    int imap_dump_node_gv(imap_node_t *tree, imap_u32_t mark, imap_dumpfn_t *dumpfn, void *ctx)
+    int imap_dump_node_gv(imap_node_t *tree, imap_slot_t mark, imap_dumpfn_t *dumpfn, void *ctx)
     {
-        imap_node_t *node;
         imap_slot_t *slot;
-        imap_u32_t sval, posn, dirn;
-        imap_u64_t prfx;
-        node = imap__node__(tree, mark);
-        posn = imap__node_pos__(node);
-        prfx = imap__node_prefix__(node);
-        dumpfn(ctx, "\"N%x\" [shape=record label=\"{%016llx / %x|"
-            "{<0>0|<1>1|<2>2|<3>3|<4>4|<5>5|<6>6|<7>7|<8>8|<9>9|<A>A|<B>B|<C>C|<D>D|<E>E|<F>F}"
-            "}\"]\n",
-            mark, (unsigned long long)(prfx & ~imap__prefix_pos__), posn);
+        imap_slot_t sval;
+        imap_u32_t posn, dirn;
+        imap_u64_t prfx, offs;
+        if (imap__slot_islist__(mark))
+        {
+            slot = imap__list_slots__(tree);
+            dumpfn(ctx, "\"N%llx\" [shape=record label=\"{list|{", (unsigned long long)sizeof(imap_node_t));
+            for (dirn = 0, posn = 0; (mark & imap__slot_pmask__) > dirn; dirn++)
+                if (slot[dirn] & imap__slot_value__)
+                    dumpfn(ctx, "%s%llx:%llx", posn++ ? "|" : "", (unsigned long long)imap__list_keys__(tree)[dirn],
+                        (unsigned long long)imap_getval(tree, &slot[dirn]));
+            dumpfn(ctx, "}}\"]\n");
+            return 0;
+        }
+        posn = imap__inner_pos__(tree, mark);
+        prfx = imap__inner_prefix__(tree, mark);
+        offs = imap__inner_offset__(mark);
+        if (mark & imap__slot_cell__)
+        {
+            // a small node has a port for each of its two directions
+            slot = imap__small_slots__(tree, mark);
+            dumpfn(ctx, "\"N%llx\" [shape=record label=\"{%016llx / %x|{<%X>%X|<%X>%X}}\"]\n",
+                (unsigned long long)offs, (unsigned long long)(prfx & ~imap__prefix_pos__), posn,
+                (unsigned)(slot[0] & imap__slot_pmask__), (unsigned)(slot[0] & imap__slot_pmask__),
+                (unsigned)(slot[1] & imap__slot_pmask__), (unsigned)(slot[1] & imap__slot_pmask__));
+        }
+        else
+            dumpfn(ctx, "\"N%llx\" [shape=record label=\"{%016llx / %x|"
+                "{<0>0|<1>1|<2>2|<3>3|<4>4|<5>5|<6>6|<7>7|<8>8|<9>9|<A>A|<B>B|<C>C|<D>D|<E>E|<F>F}"
+                "}\"]\n",
+                (unsigned long long)offs, (unsigned long long)(prfx & ~imap__prefix_pos__), posn);
         for (dirn = 0; 16 > dirn; dirn++)
         {
-            slot = &node->vec32[dirn];
+            slot = imap__inner_slot__(tree, mark, dirn);
+            if (!slot)
+                continue;
             sval = *slot;
-            if (sval & imap__slot_node__)
-                dumpfn(ctx, "\"N%x\":\"%x\":s->\"N%x\":n\n", mark, dirn, sval & imap__slot_value__);
+            if (imap__slot_iscell__(sval))
+                dumpfn(ctx, "\"N%llx\":\"%x\":s->\"%llx:%llx\":n\n",
+                    (unsigned long long)offs, dirn, (unsigned long long)*imap__cell__(tree, sval),
+                    (unsigned long long)imap_getval(tree, imap__cell_slot__(tree, sval)));
+            else if (sval & imap__slot_node__)
+                dumpfn(ctx, "\"N%llx\":\"%x\":s->\"N%llx\":n\n",
+                    (unsigned long long)offs, dirn, (unsigned long long)imap__inner_offset__(sval));
             else if (sval & imap__slot_value__)
-                dumpfn(ctx, "\"N%x\":\"%x\":s->\"%llx\":n\n", mark, dirn, (unsigned long long)imap_getval(tree, slot));
+                dumpfn(ctx, "\"N%llx\":\"%x\":s->\"%llx\":n\n",
+                    (unsigned long long)offs, dirn, (unsigned long long)imap_getval(tree, slot));
         }
         return posn;
     }
@@ -1014,10 +5680,17 @@ extern "C" {
     void imap_dump(imap_node_t *tree, imap_dumpfn_t *dumpfn, void *ctx)
     {
         imap_iter_t iterdata, *iter = &iterdata;
-        imap_node_t *node;
-        imap_u32_t sval, dirn;
+        imap_slot_t *slot;
+        imap_slot_t sval, mark;
+        imap_u32_t dirn;
+        sval = tree->vecsl[imap__tree_root__];
+        if (imap__slot_islist__(sval))
+        {
+            IMAP_DUMP_NODE(tree, sval, dumpfn, ctx);
+            return;
+        }
         iter->stackp = 0;
-        sval = dirn = 0;
+        mark = dirn = 0;
         goto enter;
         // loop while stack is not empty
         while (iter->stackp)
@@ -1031,10 +5704,13 @@ extern "C" {
                 iter->stackp--;
                 continue;
             }
+            mark = sval & imap__slot_value__;
         enter:
-            node = imap__node__(tree, sval & imap__slot_value__);
-            sval = node->vec32[dirn];
-            if (sval & imap__slot_node__ &&
+            slot = imap__inner_slot__(tree, mark, dirn);
+            if (!slot)
+                continue;
+            sval = *slot;
+            if (imap__slot_isinner__(sval) &&
                 IMAP_DUMP_NODE(tree, sval & imap__slot_value__, dumpfn, ctx))
                 // push node into stack, if node pos != 0
                 iter->stack[iter->stackp++] = sval & imap__slot_value__;
@@ -51,6 +51,9 @@ iset_u32_t iset__bsf__(iset_u32_t x)
 }
 #endif
 
+/* bits per scalar value: imap_getval0/imap_setval0 are 32-bit, so this stays 26 with IMAP_WIDE_SLOTS */
+#define iset__bits__                    26
+
 static inline
 iset_node_t *iset_ensure(iset_node_t *tree, iset_u32_t n)
 {
@@ -66,8 +69,8 @@ void iset_free(iset_node_t *tree)
 static inline
 iset_u32_t iset_lookup(iset_node_t *tree, iset_u64_t x)
 {
-    imap_u64_t q = x / imap__slot_sbits__;
-    imap_u32_t r = x % imap__slot_sbits__;
+    imap_u64_t q = x / iset__bits__;
+    imap_u32_t r = x % iset__bits__;
     imap_slot_t *slot = imap_lookup(tree, q);
     return slot ? (imap_getval0(tree, slot) & (1 << r)) : 0;
 }
@@ -75,8 +78,8 @@ iset_u32_t iset_lookup(iset_node_t *tree, iset_u64_t x)
 static inline
 void iset_assign(iset_node_t *tree, iset_u64_t x)
 {
-    imap_u64_t q = x / imap__slot_sbits__;
-    imap_u32_t r = x % imap__slot_sbits__;
+    imap_u64_t q = x / iset__bits__;
+    imap_u32_t r = x % iset__bits__;
     imap_slot_t *slot = imap_assign(tree, q);
     imap_setval0(tree, slot, imap_getval0(tree, slot) | (1 << r));
 }
@@ -84,8 +87,8 @@ void iset_assign(iset_node_t *tree, iset_u64_t x)
 static inline
 void iset_remove(iset_node_t *tree, iset_u64_t x)
 {
-    imap_u64_t q = x / imap__slot_sbits__;
-    imap_u32_t r = x % imap__slot_sbits__;
+    imap_u64_t q = x / iset__bits__;
+    imap_u32_t r = x % iset__bits__;
     imap_slot_t *slot = imap_lookup(tree, q);
     if (slot)
     {
@@ -101,8 +104,8 @@ static inline
 iset_pair_t iset_locate(iset_node_t *tree, iset_iter_t *iter, iset_u64_t x)
 {
     iset_pair_t result = { 0 };
-    imap_u64_t q = x / imap__slot_sbits__;
-    imap_u32_t r = x % imap__slot_sbits__;
+    imap_u64_t q = x / iset__bits__;
+    imap_u32_t r = x % iset__bits__;
     imap_pair_t pair;
     imap_u32_t dirn;
     iter->x = iter->y = 0;
@@ -112,7 +115,7 @@ iset_pair_t iset_locate(iset_node_t *tree, iset_iter_t *iter, iset_u64_t x)
         iter->y = imap_getval0(tree, pair.slot) & ~((1 << r) - 1);
         if (iter->y)
         {
-            iter->x = q * imap__slot_sbits__;
+            iter->x = q * iset__bits__;
             dirn = iset__bsf__(iter->y);
             iter->y &= ~(1 << dirn);
             result.x = iter->x + dirn;
@@ -136,7 +139,7 @@ iset_pair_t iset_iterate(iset_node_t *tree, iset_iter_t *iter, int restart)
     if (pair.slot)
     {
         iter->y = imap_getval0(tree, pair.slot);
-        iter->x = pair.x * imap__slot_sbits__;
+        iter->x = pair.x * iset__bits__;
     fill:
         dirn = iset__bsf__(iter->y);
         iter->y &= ~(1 << dirn);
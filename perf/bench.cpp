@@ -12,10 +12,17 @@
 
 #include <tlib/testsuite.h>
 #include <time.h>
+#include <chrono>
 #include <memory>
 #include <map>
 #include <unordered_map>
 #include "imap.h"
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 void test_srand(imap_u64_t s);
 imap_u64_t test_rand(void);
@@ -23,6 +30,10 @@ void test_imap_insert(imap_node_t *&tree, imap_u64_t x, imap_u64_t y);
 void test_imap_assign(imap_node_t *&tree, imap_u64_t x, imap_u64_t y);
 void test_imap_remove(imap_node_t *&tree, imap_u64_t x);
 imap_u64_t test_imap_lookup(imap_node_t *&tree, imap_u64_t x);
+void test_imap_cursor_assign(imap_node_t *&tree, imap_cursor_t &cursor, imap_u64_t x, imap_u64_t y);
+imap_u64_t test_imap_cursor_lookup(imap_node_t *&tree, imap_cursor_t &cursor, imap_u64_t x);
+void test_imap_lookup_batch(imap_node_t *&tree, const imap_u64_t *xs, imap_u64_t *ys, unsigned n);
+imap_u64_t test_imap_frozen_lookup(imap_frozen_t *frozen, imap_u64_t x);
 void test_stdu_insert(std::unordered_map<imap_u64_t, imap_u64_t> &stdu, imap_u64_t x, imap_u64_t y);
 void test_stdu_assign(std::unordered_map<imap_u64_t, imap_u64_t> &stdu, imap_u64_t x, imap_u64_t y);
 void test_stdu_remove(std::unordered_map<imap_u64_t, imap_u64_t> &stdu, imap_u64_t x);
@@ -67,18 +78,44 @@ static void imap_seq_assign_test(void)
         test_imap_assign(tree, i, i);
 }
 
+static void imap_seq_cursor_assign_test(void)
+{
+    imap_cursor_t cursor;
+    imap_cursor_reset(&cursor);
+    for (unsigned i = 0; N > i; i++)
+        test_imap_cursor_assign(tree, cursor, i, i);
+}
+
 static void imap_seq_lookup_test(void)
 {
     for (unsigned i = 0; N > i; i++)
         test_imap_lookup(tree, i);
 }
 
+static void imap_seq_cursor_lookup_test(void)
+{
+    imap_cursor_t cursor;
+    imap_cursor_reset(&cursor);
+    for (unsigned i = 0; N > i; i++)
+        test_imap_cursor_lookup(tree, cursor, i);
+}
+
 static void imap_seq_remove_test(void)
 {
     for (unsigned i = 0; N > i; i++)
         test_imap_remove(tree, i);
 }
 
+static void imap_seq_build_test(void)
+{
+    imap_u64_t *xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    for (unsigned i = 0; N > i; i++)
+        xs[i] = i;
+    imap_node_t *t = imap_build_sorted(xs, xs, N);
+    imap_free(t);
+    free(xs);
+}
+
 static void imbv_seq_insert_test(void)
 {
     for (unsigned i = 0; N > i; i++)
@@ -121,6 +158,192 @@ static void imap_rnd_lookup_test(void)
         test_imap_lookup(tree, test_array[i]);
 }
 
+static void imap_rnd_lookup_batch_dotest(unsigned batch)
+{
+    imap_u64_t xs[1024], ys[1024];
+    for (unsigned i = 0, n; N > i; i += n)
+    {
+        n = N - i < batch ? N - i : batch;
+        for (unsigned j = 0; n > j; j++)
+            xs[j] = test_array[i + j];
+        test_imap_lookup_batch(tree, xs, ys, n);
+    }
+}
+
+static void imap_rnd_lookup_batch16_test(void)
+{
+    imap_rnd_lookup_batch_dotest(16);
+}
+
+static void imap_rnd_lookup_batch1024_test(void)
+{
+    imap_rnd_lookup_batch_dotest(1024);
+}
+
+static int dtlb_open(void)
+{
+#if defined(__linux__)
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof attr);
+    attr.size = sizeof attr;
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void imap_rnd_lookup_tlb_test(void)
+{
+    /* sparse keys: every key gets its own leaf node, so lookups touch many pages */
+    const unsigned M = N / 4;
+    imap_node_t *t = imap_ensure(0, +1);
+    for (unsigned i = 0; M > i; i++)
+        test_imap_insert(t, i * 0x9E3779B97F4A7C15ull, i);
+
+    int fd = dtlb_open();
+    unsigned long long misses = 0;
+#if defined(__linux__)
+    if (-1 != fd)
+    {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; N > i; i++)
+        test_imap_lookup(t, test_array[i] % M * 0x9E3779B97F4A7C15ull);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+#if defined(__linux__)
+    if (-1 != fd)
+    {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (sizeof misses != read(fd, &misses, sizeof misses))
+            misses = 0;
+        close(fd);
+    }
+#endif
+
+    if (-1 != fd)
+        tlib_printf("lookup=%llums dtlb=%llu ",
+            (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), misses);
+    else
+        tlib_printf("lookup=%llums dtlb=n/a ",
+            (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+
+    imap_free(t);
+}
+
+static unsigned long long imap_rnd_lookup_cold(imap_node_t *t, unsigned M)
+{
+    /* evict the tree from the caches before each batch and time lookups that each depend on the value
+       found by the previous one, so that every lookup waits for its cache misses; returns ns per lookup */
+    static const size_t F = 64 << 20;
+    static const unsigned B = 64, L = 256;
+    static volatile imap_u8_t *flush = (volatile imap_u8_t *)calloc(F, 1);
+    std::chrono::steady_clock::duration elapsed{};
+    imap_u64_t j = 0;
+    for (unsigned b = 0; B > b; b++)
+    {
+        for (size_t i = 0; F > i; i += 64)
+            flush[i]++;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; L > i; i++)
+            j = (test_imap_lookup(t, test_array[j] % M * 0x9E3779B97F4A7C15ull) + i + 1) % N;
+        elapsed += std::chrono::steady_clock::now() - start;
+    }
+    return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (B * L);
+}
+
+static void imap_rnd_lookup_layout_test(void)
+{
+    /* sparse keys inserted in random order: parent and child nodes end up far apart */
+    const unsigned M = N / 4;
+    imap_node_t *t = imap_ensure(0, +1);
+    for (unsigned i = 0; N > i; i++)
+        if (M > test_array[i])
+            test_imap_insert(t, test_array[i] * 0x9E3779B97F4A7C15ull, i);
+
+    unsigned long long built = imap_rnd_lookup_cold(t, M);
+    t = imap_relayout(t, imap_layout_dfs);
+    unsigned long long dfs = imap_rnd_lookup_cold(t, M);
+    t = imap_relayout(t, imap_layout_bfs);
+    unsigned long long bfs = imap_rnd_lookup_cold(t, M);
+    t = imap_relayout(t, imap_layout_veb);
+    unsigned long long veb = imap_rnd_lookup_cold(t, M);
+
+    tlib_printf("built=%lluns dfs=%lluns bfs=%lluns veb=%lluns ", built, dfs, bfs, veb);
+
+    imap_free(t);
+}
+
+static void imap_rnd_lookup_jump_test(void)
+{
+    /* dense keys: every lookup walks the same top levels unless the jump table skips them */
+    unsigned long long ms[2];
+    for (unsigned j = 0; 2 > j; j++)
+    {
+        tree = imap_setjump(tree, j ? 3 : 0);
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; N > i; i++)
+            test_imap_lookup(tree, test_array[i]);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        ms[j] = (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    }
+    tree = imap_setjump(tree, 0);
+
+    tlib_printf("root=%llums jump=%llums ", ms[0], ms[1]);
+}
+
+static void imap_rnd_lookup_cache_test(void)
+{
+    /* skewed keys: 80% of the lookups go to 5% of the position 0 nodes */
+    unsigned long long ms[2];
+    imap_u64_t hits, misses;
+    for (unsigned j = 0; 2 > j; j++)
+    {
+        tree = imap_setcache(tree, j ? 65536 : 0);
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; N > i; i++)
+            test_imap_lookup(tree, i % 5 ? test_array[i] % (N / 20) : test_array[i]);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        ms[j] = (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    }
+    imap_cachestats(tree, &hits, &misses);
+    tree = imap_setcache(tree, 0);
+
+    tlib_printf("root=%llums cache=%llums hits=%llu%% ", ms[0], ms[1],
+        (unsigned long long)(100 * hits / (hits + misses)));
+}
+
+static void imap_rnd_lookup_frozen_test(void)
+{
+    /* the wide frozen map consumes two digits per level where the keys are dense */
+    imap_frozen_t *frozen[2] = { imap_freeze(tree), imap_freeze_wide(tree) };
+    unsigned long long ms[2];
+    for (unsigned j = 0; 2 > j; j++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; N > i; i++)
+            test_imap_frozen_lookup(frozen[j], test_array[i]);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        ms[j] = (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+    }
+
+    tlib_printf("tree=%lluK frozen=%lluK/%llums wide=%lluK/%llums ",
+        (unsigned long long)tree->vecsl[imap__tree_mark__] / 1024,
+        (unsigned long long)imap_frozen_memsize(frozen[0]) / 1024, ms[0],
+        (unsigned long long)imap_frozen_memsize(frozen[1]) / 1024, ms[1]);
+
+    imap_frozen_free(frozen[1]);
+    imap_frozen_free(frozen[0]);
+}
+
 static void imap_rnd_remove_test(void)
 {
     for (unsigned i = 0; N > i; i++)
@@ -142,6 +365,34 @@ static void imap_shortseq_test(void)
     }
 }
 
+static void imap_alloc_shortseq_test(void)
+{
+    for (unsigned i = 0; N / 100 > i; i++)
+    {
+        imap_node_t *t = imap_ensure(0, 100);
+        for (unsigned j = 0; 100 > j; j++)
+            test_imap_assign(t, j, j);
+        for (unsigned j = 0; 100 > j; j++)
+            test_imap_lookup(t, j);
+        imap_free(t);
+    }
+}
+
+static void imap_pool_shortseq_test(void)
+{
+    imap_pool_t *pool = imap_pool_create(1, 100);
+    for (unsigned i = 0; N / 100 > i; i++)
+    {
+        imap_node_t *t = imap_pool_get(pool);
+        for (unsigned j = 0; 100 > j; j++)
+            test_imap_assign(t, j, j);
+        for (unsigned j = 0; 100 > j; j++)
+            test_imap_lookup(t, j);
+        imap_pool_put(pool, t);
+    }
+    imap_pool_free(pool);
+}
+
 static void stdu_seq_insert_test(void)
 {
     for (unsigned i = 0; N > i; i++)
@@ -300,11 +551,141 @@ static void imap_memtrack_test(void)
     for (unsigned i = 0; N > i; i++)
         test_imap_insert(t, i, i);
 
-    tlib_printf("%u/%u ", t->vec32[imap__tree_mark__], t->vec32[imap__tree_size__]);
+    tlib_printf("%llu/%llu ",
+        (unsigned long long)t->vecsl[imap__tree_mark__], (unsigned long long)t->vecsl[imap__tree_size__]);
 
     imap_free(t);
 }
 
+static void imap_sparse_memtrack_dotest(const imap_u64_t *xs, unsigned n)
+{
+    /* the same keys in the default layout and in the sparse layout: memory and lookup time of each */
+    unsigned long long mark[2], ms[2];
+    for (unsigned j = 0; 2 > j; j++)
+    {
+        imap_node_t *t = imap_setsparse(imap_ensure(0, +1), j);
+        for (unsigned i = 0; n > i; i++)
+            test_imap_insert(t, xs[i], i);
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; n > i; i++)
+            test_imap_lookup(t, xs[i]);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        mark[j] = (unsigned long long)t->vecsl[imap__tree_mark__];
+        ms[j] = (unsigned long long)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count();
+        imap_free(t);
+    }
+
+    tlib_printf("default=%lluK/%llums sparse=%lluK/%llums ",
+        mark[0] / 1024, ms[0], mark[1] / 1024, ms[1]);
+}
+
+static void imap_sparse_memtrack_test(void)
+{
+    imap_u64_t *xs = (imap_u64_t *)malloc(N / 10 * sizeof(imap_u64_t));
+
+    for (unsigned i = 0; N / 10 > i; i++)
+        xs[i] = test_rand();
+    imap_sparse_memtrack_dotest(xs, N / 10);
+
+    free(xs);
+}
+
+static void imap_clustered_memtrack_test(void)
+{
+    imap_u64_t *xs = (imap_u64_t *)malloc(N / 10 * sizeof(imap_u64_t));
+
+    /* clusters of 64 values spaced 1 to 16 apart at random 64-bit bases */
+    for (unsigned i = 0; N / 10 > i; i++)
+        xs[i] = 0 == i % 64 ? test_rand() : xs[i - 1] + 1 + (test_rand() & 15);
+    imap_sparse_memtrack_dotest(xs, N / 10);
+
+    free(xs);
+}
+
+static void imap_tiny_memtrack_dotest(imap_node_t *(*ensure)(imap_node_t *, imap_u32_t))
+{
+    imap_node_t **ts = (imap_node_t **)malloc(N / 100 * sizeof(imap_node_t *));
+    imap_u64_t mark = 0, size = 0;
+
+    /* many maps of 6 random values each */
+    for (unsigned i = 0; N / 100 > i; i++)
+    {
+        ts[i] = 0;
+        for (unsigned j = 0; 6 > j; j++)
+        {
+            ts[i] = ensure(ts[i], 1);
+            test_imap_assign(ts[i], test_rand(), j);
+        }
+        mark += ts[i]->vecsl[imap__tree_mark__];
+        size += ts[i]->vecsl[imap__tree_size__];
+    }
+
+    tlib_printf("%llu/%llu ", (unsigned long long)mark, (unsigned long long)size);
+
+    for (unsigned i = 0; N / 100 > i; i++)
+        imap_free(ts[i]);
+    free(ts);
+}
+
+static void imap_tiny_memtrack_test(void)
+{
+    imap_tiny_memtrack_dotest(imap_ensure);
+}
+
+static void imap_inline_memtrack_test(void)
+{
+    imap_tiny_memtrack_dotest(imap_ensure_inline);
+}
+
+static void imap_medium_memtrack_test(void)
+{
+    imap_node_t **ts = (imap_node_t **)malloc(N / 10000 * sizeof(imap_node_t *));
+    imap_u64_t mark = 0, size = 0;
+
+    /* many maps of 1300 random values each, filled in turn */
+    for (unsigned i = 0; N / 10000 > i; i++)
+        ts[i] = imap_ensure(0, +1);
+    for (unsigned i = 0; N / 10000 * 1300 > i; i++)
+    {
+        ts[i % (N / 10000)] = imap_ensure(ts[i % (N / 10000)], +1);
+        test_imap_assign(ts[i % (N / 10000)], test_rand(), i);
+    }
+    for (unsigned i = 0; N / 10000 > i; i++)
+    {
+        mark += ts[i]->vecsl[imap__tree_mark__];
+        size += ts[i]->vecsl[imap__tree_size__];
+    }
+
+    tlib_printf("%llu/%llu ", (unsigned long long)mark, (unsigned long long)size);
+
+    for (unsigned i = 0; N / 10000 > i; i++)
+        imap_free(ts[i]);
+    free(ts);
+}
+
+static void imap_forest_memtrack_test(void)
+{
+    imap_slot_t *ids = (imap_slot_t *)malloc(N / 10000 * sizeof(imap_slot_t));
+    imap_forest_t *forest = imap_forest_ensure(0, N / 10000);
+
+    /* the same maps hosted by a forest; a single array can afford a finer growth policy */
+    forest = imap_setgrowth(forest, imap_grow_half, 0);
+    for (unsigned i = 0; N / 10000 > i; i++)
+        ids[i] = imap_forest_create(forest);
+    for (unsigned i = 0; N / 10000 * 1300 > i; i++)
+    {
+        forest = imap_forest_ensure(forest, +1);
+        imap_slot_t *slot = imap_forest_assign(forest, ids[i % (N / 10000)], test_rand());
+        imap_setval(forest, slot, i);
+    }
+
+    tlib_printf("%llu/%llu ",
+        (unsigned long long)forest->vecsl[imap__tree_mark__], (unsigned long long)forest->vecsl[imap__tree_size__]);
+
+    imap_forest_free(forest);
+    free(ids);
+}
+
 static void imbv_memtrack_test(void)
 {
     imap_node_t *t = imap_ensure(0, +1);
@@ -312,7 +693,29 @@ static void imbv_memtrack_test(void)
     for (unsigned i = 0; N > i; i++)
         test_imap_insert(t, i, 0x8000000000000000ull | i);
 
-    tlib_printf("%u/%u ", t->vec32[imap__tree_mark__], t->vec32[imap__tree_size__]);
+    tlib_printf("%llu/%llu ",
+        (unsigned long long)t->vecsl[imap__tree_mark__], (unsigned long long)t->vecsl[imap__tree_size__]);
+
+    imap_free(t);
+}
+
+static void imap_grow_latency_test(void)
+{
+    imap_node_t *t = imap_ensure(0, +1);
+    std::chrono::steady_clock::duration maxstall{}, stall;
+    std::chrono::steady_clock::time_point start;
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        start = std::chrono::steady_clock::now();
+        test_imap_insert(t, i, 0x8000000000000000ull | i);
+        stall = std::chrono::steady_clock::now() - start;
+        if (maxstall < stall)
+            maxstall = stall;
+    }
+
+    tlib_printf("max=%lluus ",
+        (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(maxstall).count());
 
     imap_free(t);
 }
@@ -353,14 +756,17 @@ static void stdm_memtrack_test(void)
 void perf_tests(void)
 {
     TEST(imap_seq_insert_test);
+    TEST(imap_seq_build_test);
     TEST_OPT(imbv_seq_insert_test);
     TEST(stdu_seq_insert_test);
     TEST_OPT(stdm_seq_insert_test);
     TEST(imap_seq_assign_test);
+    TEST(imap_seq_cursor_assign_test);
     TEST_OPT(imbv_seq_assign_test);
     TEST(stdu_seq_assign_test);
     TEST_OPT(stdm_seq_assign_test);
     TEST(imap_seq_lookup_test);
+    TEST(imap_seq_cursor_lookup_test);
     TEST_OPT(imbv_seq_lookup_test);
     TEST(stdu_seq_lookup_test);
     TEST_OPT(stdm_seq_lookup_test);
@@ -375,15 +781,31 @@ void perf_tests(void)
     TEST(stdu_rnd_assign_test);
     TEST_OPT(stdm_rnd_assign_test);
     TEST(imap_rnd_lookup_test);
+    TEST(imap_rnd_lookup_batch16_test);
+    TEST(imap_rnd_lookup_batch1024_test);
+    TEST(imap_rnd_lookup_tlb_test);
+    TEST(imap_rnd_lookup_layout_test);
+    TEST(imap_rnd_lookup_frozen_test);
+    TEST(imap_rnd_lookup_jump_test);
+    TEST(imap_rnd_lookup_cache_test);
     TEST(stdu_rnd_lookup_test);
     TEST_OPT(stdm_rnd_lookup_test);
     TEST(imap_rnd_remove_test);
     TEST(stdu_rnd_remove_test);
     TEST_OPT(stdm_rnd_remove_test);
     TEST(imap_shortseq_test);
+    TEST(imap_alloc_shortseq_test);
+    TEST(imap_pool_shortseq_test);
     TEST(stdu_shortseq_test);
     TEST_OPT(stdm_shortseq_test);
     TEST(imap_memtrack_test);
+    TEST(imap_sparse_memtrack_test);
+    TEST(imap_clustered_memtrack_test);
+    TEST(imap_tiny_memtrack_test);
+    TEST(imap_inline_memtrack_test);
+    TEST(imap_medium_memtrack_test);
+    TEST(imap_forest_memtrack_test);
+    TEST(imap_grow_latency_test);
     TEST_OPT(imbv_memtrack_test);
     TEST(stdu_memtrack_test);
     TEST_OPT(stdm_memtrack_test);
@@ -15,6 +15,8 @@
 #include "imap.h"
 
 static imap_u64_t seed = 0;
+/* lookup results are stored here, so that lookups inlined by LTO whose results are unused are not optimized away */
+static volatile imap_u64_t sink;
 void test_srand(imap_u64_t s)
 {
     seed = s;
@@ -47,7 +49,37 @@ void test_imap_remove(imap_node_t *&tree, imap_u64_t x)
 imap_u64_t test_imap_lookup(imap_node_t *&tree, imap_u64_t x)
 {
     auto slot = imap_lookup(tree, x);
-    return imap_getval(tree, slot);
+    return sink = imap_getval(tree, slot);
+}
+
+void test_imap_cursor_assign(imap_node_t *&tree, imap_cursor_t &cursor, imap_u64_t x, imap_u64_t y)
+{
+    auto slot = imap_cursor_assign(tree, &cursor, x);
+    imap_setval(tree, slot, y);
+}
+
+imap_u64_t test_imap_cursor_lookup(imap_node_t *&tree, imap_cursor_t &cursor, imap_u64_t x)
+{
+    auto slot = imap_cursor_lookup(tree, &cursor, x);
+    return sink = imap_getval(tree, slot);
+}
+
+void test_imap_lookup_batch(imap_node_t *&tree, const imap_u64_t *xs, imap_u64_t *ys, unsigned n)
+{
+    imap_slot_t *slots[64];
+    for (unsigned i = 0, m; n > i; i += m)
+    {
+        m = n - i < 64 ? n - i : 64;
+        imap_lookup_batch(tree, xs + i, slots, m);
+        imap_getval_batch(tree, slots, ys + i, m);
+    }
+}
+
+imap_u64_t test_imap_frozen_lookup(imap_frozen_t *frozen, imap_u64_t x)
+{
+    imap_u64_t y = 0;
+    imap_frozen_lookup(frozen, x, &y);
+    return sink = y;
 }
 
 void test_stdu_insert(std::unordered_map<imap_u64_t, imap_u64_t> &stdu, imap_u64_t x, imap_u64_t y)
@@ -67,7 +99,7 @@ void test_stdu_remove(std::unordered_map<imap_u64_t, imap_u64_t> &stdu, imap_u64
 
 imap_u64_t test_stdu_lookup(std::unordered_map<imap_u64_t, imap_u64_t> &stdu, imap_u64_t x)
 {
-    return stdu.at(x);
+    return sink = stdu.at(x);
 }
 
 void test_stdm_insert(std::map<imap_u64_t, imap_u64_t> &stdm, imap_u64_t x, imap_u64_t y)
@@ -87,5 +119,5 @@ void test_stdm_remove(std::map<imap_u64_t, imap_u64_t> &stdm, imap_u64_t x)
 
 imap_u64_t test_stdm_lookup(std::map<imap_u64_t, imap_u64_t> &stdm, imap_u64_t x)
 {
-    return stdm.at(x);
+    return sink = stdm.at(x);
 }
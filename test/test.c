@@ -14,6 +14,7 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 //#define IMAP_USE_SIMD
@@ -22,6 +23,11 @@
 #include "iset.h"
 #include "ivmap.h"
 
+#if defined(IMAP_WIDE_SLOTS)
+// wide slots have no 32-bit view of a node; the tests access its slots by their wide name
+#define vec32                           vecsl
+#endif
+
 static imap_u64_t seed = 0;
 static void test_srand(imap_u64_t s)
 {
@@ -73,8 +79,8 @@ static int test_concat_sprintf(void *ctx, const char *format, ...)
 
 static void imap_primitives_test(void)
 {
-    imap_u32_t vec32[16];
-    imap_u32_t val32;
+    imap_slot_t vec32[16];
+    imap_slot_t val32;
     imap_u64_t val64;
 
     memset(vec32, 0, sizeof vec32);
@@ -94,6 +100,12 @@ static void imap_primitives_test(void)
     memset(vec32, 0, sizeof vec32);
     vec32[3] = 0xd0;
     ASSERT(1 == imap__popcnt_hi28__(vec32, &val32) && 0xd0 == val32);
+    memset(vec32, 0, sizeof vec32);
+    vec32[9] = 0xc0, vec32[14] = 0xb0;
+    ASSERT(2 == imap__popcnt_hi28__(vec32, &val32) && 0xb0 == val32);
+    for (unsigned i = 0; 16 > i; i++)
+        vec32[i] = (i + 1) << 4;
+    ASSERT(16 == imap__popcnt_hi28__(vec32, &val32) && 0x100 == val32);
 }
 
 static void imap_ensure_test(void)
@@ -373,6 +385,18 @@ static void imap_assign_bigval_test(void)
         ASSERT((0x8000000000000000ull | i) == imap_getval(tree, slot));
     }
 
+    // values below 2^imap__slot_sbits__ are stored in the slot; larger values are boxed
+    tree = imap_ensure(tree, +1);
+    ASSERT(0 != tree);
+    slot = imap_assign(tree, N);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, (1ull << imap__slot_sbits__) - 1);
+    ASSERT(!imap__slot_boxed__(*slot));
+    ASSERT((1ull << imap__slot_sbits__) - 1 == imap_getval(tree, slot));
+    imap_setval(tree, slot, 1ull << imap__slot_sbits__);
+    ASSERT(imap__slot_boxed__(*slot));
+    ASSERT(1ull << imap__slot_sbits__ == imap_getval(tree, slot));
+
     imap_free(tree);
 }
 
@@ -1327,50 +1351,3368 @@ static void imap_locate_random_test(void)
     imap_locate_random_dotest(time(0));
 }
 
-static void imap_dump_test(void)
+static int u64cmp(const void *x, const void *y)
 {
-    imap_node_t *tree;
+    imap_u64_t a = *(imap_u64_t *)x, b = *(imap_u64_t *)y;
+    return (a > b) - (a < b);
+}
+
+static int test_count_lines(void *ctx, const char *format, ...)
+{
+    if (0 == strcmp(format, "\n"))
+        ++*(unsigned *)ctx;
+    return 0;
+}
+
+static void imap_remove_range_dotest(imap_u64_t seed, imap_u64_t xmask)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0, *tree2 = 0;
     imap_slot_t *slot;
-    char *dump;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+    imap_u64_t x0, x1, t;
+    unsigned count, count2;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        imap_u64_t x = test_rand() & xmask;
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, 0x8000000000000000ull | x);
+        tree2 = imap_ensure(tree2, +1);
+        ASSERT(0 != tree2);
+        slot = imap_assign(tree2, x);
+        ASSERT(0 != slot);
+        imap_setval(tree2, slot, 0x8000000000000000ull | x);
+    }
+
+    for (unsigned r = 0; 100 > r; r++)
+    {
+        x0 = test_rand() & xmask;
+        x1 = 0 == (r & 1) ? x0 + (test_rand() & 0xfff) : test_rand() & xmask;
+        if (x0 > x1)
+            t = x0, x0 = x1, x1 = t;
+        imap_remove_range(tree, x0, x1);
+        for (pair2 = imap_locate(tree2, &iter2, x0); pair2.slot && x1 >= pair2.x;
+            pair2 = imap_locate(tree2, &iter2, x0))
+            imap_remove(tree2, pair2.x);
+
+        pair = imap_iterate(tree, &iter, 1);
+        pair2 = imap_iterate(tree2, &iter2, 1);
+        for (;;)
+        {
+            ASSERT(pair.x == pair2.x);
+            ASSERT((0 == pair.slot) == (0 == pair2.slot));
+            if (0 == pair.slot)
+                break;
+            ASSERT(x0 > pair.x || pair.x > x1);
+            ASSERT(imap_getval(tree, pair.slot) == imap_getval(tree2, pair2.slot));
+            pair = imap_iterate(tree, &iter, 0);
+            pair2 = imap_iterate(tree2, &iter2, 0);
+        }
+
+        count = count2 = 0;
+        imap_dump(tree, test_count_lines, &count);
+        imap_dump(tree2, test_count_lines, &count2);
+        ASSERT(count == count2);
+    }
+
+    imap_remove_range(tree, 0, ~0ull);
+    ASSERT(0 == tree->vec32[0]);
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0 == pair.slot);
+
+    imap_free(tree2);
+    imap_free(tree);
+}
+
+static void imap_remove_range_test(void)
+{
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_pair_t pair;
+    imap_iter_t iter;
+
+    tree = imap_ensure(tree, +6);
+    ASSERT(0 != tree);
+    slot = imap_assign(tree, 0xA0000056);
+    imap_setval(tree, slot, 0x56);
+    slot = imap_assign(tree, 0xA0000057);
+    imap_setval(tree, slot, 0x57);
+    slot = imap_assign(tree, 0xA0008009);
+    imap_setval(tree, slot, 0x8009);
+    slot = imap_assign(tree, 0xA0008059);
+    imap_setval(tree, slot, 0x8059);
+    slot = imap_assign(tree, 0xA0008069);
+    imap_setval(tree, slot, 0x8069);
+    slot = imap_assign(tree, 0xB0000000);
+    imap_setval(tree, slot, 0xB0000000);
+
+    imap_remove_range(tree, 0xA0008069, 0xA0008009);
+    ASSERT(0 != imap_lookup(tree, 0xA0008009));
+    ASSERT(0 != imap_lookup(tree, 0xA0008069));
+
+    imap_remove_range(tree, 0xA0000057, 0xA0008059);
+    ASSERT(0 != imap_lookup(tree, 0xA0000056));
+    ASSERT(0 == imap_lookup(tree, 0xA0000057));
+    ASSERT(0 == imap_lookup(tree, 0xA0008009));
+    ASSERT(0 == imap_lookup(tree, 0xA0008059));
+    ASSERT(0 != imap_lookup(tree, 0xA0008069));
+    ASSERT(0 != imap_lookup(tree, 0xB0000000));
+
+    imap_remove_range(tree, 0xA0000000, 0xAfffffff);
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0xB0000000 == pair.x);
+    ASSERT(0xB0000000 == imap_getval(tree, pair.slot));
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0 == pair.slot);
+
+    imap_remove_range(tree, 0xB0000000, 0xB0000000);
+    ASSERT(0 == tree->vec32[0]);
+
+    imap_free(tree);
+
+    imap_remove_range_dotest(time(0), 0xffffffull);
+    imap_remove_range_dotest(time(0), 0xffffffffffffffffull);
+}
+
+static void imap_count_dotest(imap_u64_t seed, imap_u64_t xmask)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0;
+    imap_u32_t *counts = 0, *counts2;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t *xs, x0, x1, t;
+    unsigned n, lo, hi;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
 
-    tree = 0;
     tree = imap_ensure(tree, +1);
     ASSERT(0 != tree);
-    dump = 0;
-    imap_dump(tree, test_concat_sprintf, &dump);
-    ASSERT(0 == dump);
-    free(dump);
+    counts = imap_count_ensure(tree, counts);
+    ASSERT(0 != counts);
+    ASSERT(0 == imap_rank(tree, counts, 0));
+    ASSERT(0 == imap_select(tree, counts, 0).slot);
+    ASSERT(0 == imap_sample(tree, counts, test_rand()).slot);
+
+    for (unsigned r = 0; 8 > r; r++)
+    {
+        for (unsigned i = 0; N / 8 > i; i++)
+        {
+            imap_u64_t x = test_rand() & xmask;
+            switch (test_rand() % 4)
+            {
+            default:
+                tree = imap_ensure(tree, +1);
+                ASSERT(0 != tree);
+                counts = imap_count_ensure(tree, counts);
+                ASSERT(0 != counts);
+                slot = imap_assign(tree, x);
+                ASSERT(0 != slot);
+                imap_setval(tree, slot, x);
+                imap_count_update(tree, counts, x);
+                break;
+            case 0:
+                if (test_rand() & 1)
+                {
+                    imap_remove(tree, x);
+                    imap_count_update(tree, counts, x);
+                }
+                else
+                {
+                    x0 = x;
+                    x1 = x + (test_rand() & 0xff);
+                    imap_remove_range(tree, x0, x1);
+                    imap_count_update(tree, counts, x0);
+                    imap_count_update(tree, counts, x1);
+                }
+                break;
+            }
+        }
+
+        n = 0;
+        for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+            xs[n++] = pair.x;
+        ASSERT(n == imap_count_range(tree, counts, 0, ~0ull));
+
+        for (unsigned i = 0; n > i; i++)
+        {
+            ASSERT(i == imap_rank(tree, counts, xs[i]));
+            if (~0ull != xs[i])
+                ASSERT(i + 1 == imap_rank(tree, counts, xs[i] + 1));
+            pair = imap_select(tree, counts, i);
+            ASSERT(0 != pair.slot);
+            ASSERT(xs[i] == pair.x);
+            ASSERT(xs[i] == imap_getval(tree, pair.slot));
+        }
+        ASSERT(0 == imap_select(tree, counts, n).slot);
+
+        for (unsigned i = 0; 1000 > i; i++)
+        {
+            x0 = test_rand() & xmask;
+            x1 = test_rand() & xmask;
+            if (x0 > x1)
+                t = x0, x0 = x1, x1 = t;
+            for (lo = 0; n > lo && x0 > xs[lo]; lo++)
+                ;
+            for (hi = lo; n > hi && x1 >= xs[hi]; hi++)
+                ;
+            ASSERT(hi - lo == imap_count_range(tree, counts, x0, x1));
+            ASSERT(0 == imap_count_range(tree, counts, x1 + 1, x0) || x1 + 1 <= x0);
+
+            pair = imap_sample(tree, counts, test_rand());
+            ASSERT(0 != pair.slot);
+            ASSERT(pair.slot == imap_lookup(tree, pair.x));
+        }
+
+        counts2 = imap_count_ensure(tree, 0);
+        ASSERT(0 != counts2);
+        ASSERT(counts[0] == counts2[0]);
+        for (unsigned i = 0; n > i; i++)
+            ASSERT(imap_rank(tree, counts, xs[i]) == imap_rank(tree, counts2, xs[i]));
+        imap_count_free(counts2);
+    }
+
+    imap_count_free(counts);
     imap_free(tree);
+    free(xs);
+}
+
+static void imap_count_test(void)
+{
+    imap_count_dotest(time(0), 0xffffull);
+    imap_count_dotest(time(0), 0xffffffffffffffffull);
+}
+
+static void imap_locate_rev_dotest(imap_u64_t seed, imap_u64_t xmask)
+{
+    const unsigned N = 1000000;
+    const unsigned M = 1000000;
+    imap_u64_t *array;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t r;
+    unsigned n, lo, hi, mi;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    array = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != array);
+
+    for (unsigned i = 0; N > i; i++)
+        array[i] = 0x1000000 | (test_rand() & xmask);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, array[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, array[i]);
+    }
+
+    qsort(array, N, sizeof array[0], u64cmp);
+    n = 0;
+    for (unsigned i = 0; N > i; i++)
+        if (0 == n || array[n - 1] != array[i])
+            array[n++] = array[i];
+
+    ASSERT(array[0] == imap_min(tree).x);
+    ASSERT(array[n - 1] == imap_max(tree).x);
+
+    pair = imap_iterate_rev(tree, &iter, 1);
+    for (unsigned i = n; 0 < i; i--)
+    {
+        ASSERT(0 != pair.slot);
+        ASSERT(array[i - 1] == pair.x);
+        ASSERT(array[i - 1] == imap_getval(tree, pair.slot));
+        pair = imap_iterate_rev(tree, &iter, 0);
+    }
+    ASSERT(0 == pair.slot);
+
+    for (unsigned i = 0; M > i; i++)
+    {
+        r = 0 == (i & 1) ? test_rand() & (xmask | 0x1000000) : array[test_rand() % n] + (i & 2) / 2;
+        // find number of elements <= r
+        for (lo = 0, hi = n; lo < hi;)
+        {
+            mi = lo + (hi - lo) / 2;
+            if (array[mi] <= r)
+                lo = mi + 1;
+            else
+                hi = mi;
+        }
+        pair = imap_locate_rev(tree, &iter, r);
+        if (0 < lo)
+        {
+            ASSERT(0 != pair.slot);
+            ASSERT(array[lo - 1] == pair.x);
+            ASSERT(array[lo - 1] == imap_getval(tree, pair.slot));
+            pair = imap_iterate_rev(tree, &iter, 0);
+            if (1 < lo)
+            {
+                ASSERT(0 != pair.slot);
+                ASSERT(array[lo - 2] == pair.x);
+            }
+            else
+                ASSERT(0 == pair.slot);
+            pair = imap_pred(tree, r + 1);
+            ASSERT(0 != pair.slot);
+            ASSERT(array[lo - 1] == pair.x);
+        }
+        else
+        {
+            ASSERT(0 == pair.x);
+            ASSERT(0 == pair.slot);
+        }
+    }
+
+    imap_free(tree);
+
+    free(array);
+}
+
+static void imap_locate_rev_test(void)
+{
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
 
-    tree = 0;
     tree = imap_ensure(tree, +5);
     ASSERT(0 != tree);
+    ASSERT(0 == imap_min(tree).slot);
+    ASSERT(0 == imap_max(tree).slot);
+    ASSERT(0 == imap_locate_rev(tree, &iter, ~0ull).slot);
+    ASSERT(0 == imap_iterate_rev(tree, &iter, 1).slot);
+
     slot = imap_assign(tree, 0xA0000056);
-    ASSERT(0 != slot);
     imap_setval(tree, slot, 0x56);
     slot = imap_assign(tree, 0xA0000057);
-    ASSERT(0 != slot);
     imap_setval(tree, slot, 0x57);
     slot = imap_assign(tree, 0xA0008009);
-    ASSERT(0 != slot);
     imap_setval(tree, slot, 0x8009);
     slot = imap_assign(tree, 0xA0008059);
-    ASSERT(0 != slot);
     imap_setval(tree, slot, 0x8059);
     slot = imap_assign(tree, 0xA0008069);
-    ASSERT(0 != slot);
     imap_setval(tree, slot, 0x8069);
-    //
-    dump = 0;
-    imap_dump(tree, test_concat_sprintf, &dump);
-    ASSERT(0 == strcmp(dump, ""
-        "00000080: 00000000a0000000/3 0->*40 8->*100\n"
-        "00000040: 00000000a0000050/0 6->56 7->57\n"
-        "00000100: 00000000a0008000/1 0->*c0 5->*140 6->*180\n"
-        "000000c0: 00000000a0008000/0 9->8009\n"
-        "00000140: 00000000a0008050/0 9->8059\n"
-        "00000180: 00000000a0008060/0 9->8069\n"
+
+    ASSERT(0xA0000056 == imap_min(tree).x);
+    ASSERT(0xA0008069 == imap_max(tree).x);
+    ASSERT(0 == imap_pred(tree, 0).slot);
+    ASSERT(0 == imap_pred(tree, 0xA0000056).slot);
+    ASSERT(0xA0000056 == imap_pred(tree, 0xA0000057).x);
+    ASSERT(0xA0000057 == imap_pred(tree, 0xA0008009).x);
+    ASSERT(0xA0008069 == imap_pred(tree, ~0ull).x);
+
+    pair = imap_locate_rev(tree, &iter, 0xA0008060);
+    ASSERT(0xA0008059 == pair.x);
+    ASSERT(0x8059 == imap_getval(tree, pair.slot));
+    pair = imap_iterate_rev(tree, &iter, 0);
+    ASSERT(0xA0008009 == pair.x);
+    pair = imap_iterate_rev(tree, &iter, 0);
+    ASSERT(0xA0000057 == pair.x);
+    pair = imap_iterate_rev(tree, &iter, 0);
+    ASSERT(0xA0000056 == pair.x);
+    pair = imap_iterate_rev(tree, &iter, 0);
+    ASSERT(0 == pair.slot);
+
+    pair = imap_locate_rev(tree, &iter, 0xB0000000);
+    ASSERT(0xA0008069 == pair.x);
+    pair = imap_locate_rev(tree, &iter, 0xA0000000);
+    ASSERT(0 == pair.slot);
+
+    imap_free(tree);
+
+    imap_locate_rev_dotest(time(0), 0x3ffffffull);
+    imap_locate_rev_dotest(time(0), 0xffffffffffffffffull);
+}
+
+struct scan_range_ctx
+{
+    imap_u64_t *xs;
+    unsigned n, stop;
+};
+
+static int test_scan_range(void *ctx0, imap_u64_t x, imap_slot_t *slot)
+{
+    struct scan_range_ctx *ctx = (struct scan_range_ctx *)ctx0;
+    ctx->xs[ctx->n++] = x;
+    return ctx->n == ctx->stop ? 42 : 0;
+}
+
+static void imap_scan_range_dotest(imap_u64_t seed, imap_u64_t xmask)
+{
+    const unsigned N = 1000000;
+    const unsigned M = 1000;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+    imap_u64_t x0, x1, t;
+    struct scan_range_ctx ctx;
+    unsigned n;
+    int result;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        imap_u64_t x = test_rand() & xmask;
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, x);
+    }
+
+    ctx.xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != ctx.xs);
+
+    for (unsigned i = 0; M > i; i++)
+    {
+        x0 = test_rand() & xmask;
+        switch (i % 3)
+        {
+        case 0:
+            x1 = x0 + (test_rand() & 0xfff);
+            break;
+        case 1:
+            x1 = x0 + (test_rand() & (xmask >> 6));
+            if (x0 > x1)
+                t = x0, x0 = x1, x1 = t;
+            break;
+        default:
+            // prefix scan
+            t = (1ull << (test_rand() % 18)) - 1;
+            x0 &= ~t;
+            x1 = x0 | t;
+            break;
+        }
+
+        n = 0;
+        for (pair2 = imap_locate(tree, &iter2, x0); pair2.slot && x1 >= pair2.x;
+            pair2 = imap_iterate(tree, &iter2, 0))
+            ctx.xs[n++] = pair2.x;
+
+        pair = imap_locate_range(tree, &iter, x0, x1);
+        for (unsigned j = 0; n > j; j++)
+        {
+            ASSERT(0 != pair.slot);
+            ASSERT(ctx.xs[j] == pair.x);
+            ASSERT(ctx.xs[j] == imap_getval(tree, pair.slot));
+            pair = imap_iterate_range(tree, &iter, x1);
+        }
+        ASSERT(0 == pair.slot);
+        pair = imap_iterate_range(tree, &iter, x1);
+        ASSERT(0 == pair.slot);
+
+        ctx.n = 0;
+        ctx.stop = ~0U;
+        result = imap_scan_range(tree, x0, x1, test_scan_range, &ctx);
+        ASSERT(0 == result);
+        ASSERT(n == ctx.n);
+        for (unsigned j = 1; n > j; j++)
+            ASSERT(ctx.xs[j - 1] < ctx.xs[j]);
+        if (0 < n)
+        {
+            ASSERT(x0 <= ctx.xs[0]);
+            ASSERT(x1 >= ctx.xs[n - 1]);
+            ctx.n = 0;
+            ctx.stop = 1 + (unsigned)(test_rand() % n);
+            result = imap_scan_range(tree, x0, x1, test_scan_range, &ctx);
+            ASSERT(42 == result);
+            ASSERT(ctx.stop == ctx.n);
+        }
+
+        ASSERT(0 == imap_locate_range(tree, &iter, x1 + 1, x0).slot || x1 + 1 <= x0);
+    }
+
+    free(ctx.xs);
+
+    imap_free(tree);
+}
+
+static void imap_scan_range_test(void)
+{
+    imap_scan_range_dotest(time(0), 0xffffffull);
+    imap_scan_range_dotest(time(0), 0xffffffffffffffffull);
+}
+
+static imap_node_t *test_compact_ensure(imap_node_t *tree, unsigned ysize)
+{
+    switch (ysize)
+    {
+    default:
+        return imap_ensure(tree, +1);
+    case 0:
+        return imap_ensure0(tree, +1);
+    case 64:
+        return imap_ensure64(tree, +1);
+    case 128:
+        return imap_ensure128(tree, +1);
+    }
+}
+
+static void test_compact_setval(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y, unsigned ysize)
+{
+    imap_u128_t val128;
+    switch (ysize)
+    {
+    default:
+        imap_setval(tree, slot, y);
+        break;
+    case 0:
+        imap_setval0(tree, slot, (imap_u32_t)y & 0x3ffffff);
+        break;
+    case 64:
+        imap_setval64(tree, slot, y);
+        break;
+    case 128:
+        val128.v[0] = y;
+        val128.v[1] = ~y;
+        imap_setval128(tree, slot, val128);
+        break;
+    }
+}
+
+static int test_compact_hasval(imap_node_t *tree, imap_slot_t *slot, imap_u64_t y, unsigned ysize)
+{
+    imap_u128_t val128;
+    switch (ysize)
+    {
+    default:
+        return imap_getval(tree, slot) == y;
+    case 0:
+        return imap_getval0(tree, slot) == ((imap_u32_t)y & 0x3ffffff);
+    case 64:
+        return imap_getval64(tree, slot) == y;
+    case 128:
+        val128 = imap_getval128(tree, slot);
+        return val128.v[0] == y && val128.v[1] == ~y;
+    }
+}
+
+static void imap_compact_dotest(imap_u64_t seed, unsigned ysize, int sparse)
+{
+    const unsigned N = 1000000;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t *xs, y;
+    unsigned n, oldsize;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
+
+    if (sparse)
+    {
+        tree = test_compact_ensure(tree, ysize);
+        ASSERT(0 != tree);
+        tree = imap_setsparse(tree, 1);
+        ASSERT(0 != tree);
+    }
+    for (unsigned i = 0; N > i; i++)
+    {
+        imap_u64_t x = test_rand() & 0xffffffffull;
+        tree = test_compact_ensure(tree, ysize);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x);
+        ASSERT(0 != slot);
+        test_compact_setval(tree, slot, (x & 1) ? x : 0x8000000000000000ull | x, ysize);
+    }
+    for (unsigned i = 0; N > i; i++)
+    {
+        imap_u64_t x = test_rand() & 0xffffffffull;
+        if (0 != (x & 0xf))
+            imap_remove(tree, x);
+        else
+            imap_remove_range(tree, x, x + 0xffffff);
+    }
+
+    n = 0;
+    for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+        xs[n++] = pair.x;
+
+    oldsize = tree->vec32[3];
+    tree =
+        0 == ysize ? imap_compact0(tree) :
+        64 == ysize ? imap_compact64(tree) :
+        128 == ysize ? imap_compact128(tree) :
+        imap_compact(tree);
+    ASSERT(0 != tree);
+    ASSERT(oldsize >= tree->vec32[3]);
+    ASSERT(0 == tree->vec32[4]);
+    // the root is a node or a small node carved from the first node after the header
+    // (and after the extension node of a sparse tree)
+    ASSERT(1 >= n || (tree->vecsl[0] & 0x10));
+    ASSERT(1 >= n || (sparse ? 2 : 1) * sizeof(imap_node_t) == imap__inner_offset__(tree->vecsl[0]));
+    // the size must be the smallest power of 2 that fits
+    ASSERT(tree->vec32[2] <= tree->vec32[3]);
+    ASSERT(tree->vec32[2] > tree->vec32[3] / 2);
+
+    pair = imap_iterate(tree, &iter, 1);
+    for (unsigned i = 0; n > i; i++)
+    {
+        ASSERT(0 != pair.slot);
+        ASSERT(xs[i] == pair.x);
+        y = (xs[i] & 1) ? xs[i] : 0x8000000000000000ull | xs[i];
+        ASSERT(test_compact_hasval(tree, pair.slot, y, ysize));
+        pair = imap_iterate(tree, &iter, 0);
+    }
+    ASSERT(0 == pair.slot);
+
+    for (unsigned i = 0; N / 10 > i; i++)
+    {
+        imap_u64_t x = test_rand() & 0xffffffffull;
+        tree = test_compact_ensure(tree, ysize);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x);
+        ASSERT(0 != slot);
+        test_compact_setval(tree, slot, ~x, ysize);
+        ASSERT(test_compact_hasval(tree, imap_lookup(tree, x), ~x, ysize));
+    }
+    for (unsigned i = 0; n > i; i++)
+    {
+        imap_remove(tree, xs[i]);
+        ASSERT(0 == imap_lookup(tree, xs[i]));
+    }
+
+    imap_free(tree);
+
+    tree = 0;
+    for (unsigned i = 0; 3 > i; i++)
+    {
+        tree = test_compact_ensure(tree, 128);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, i);
+        ASSERT(0 != slot);
+        test_compact_setval(tree, slot, i, 128);
+    }
+    tree = imap_compact128(tree);
+    ASSERT(0 != tree);
+    ASSERT(tree->vec32[2] <= tree->vec32[3]);
+    for (unsigned i = 0; 3 > i; i++)
+        ASSERT(test_compact_hasval(tree, imap_lookup(tree, i), i, 128));
+    imap_free(tree);
+
+    tree = imap_compact(imap_ensure(0, +1));
+    ASSERT(0 != tree);
+    ASSERT(sizeof(imap_node_t) == tree->vec32[3]);
+    tree = imap_ensure(tree, +1);
+    ASSERT(0 != tree);
+    ASSERT(0 != imap_assign(tree, 42));
+    imap_free(tree);
+
+    free(xs);
+}
+
+static void imap_compact_test(void)
+{
+    imap_compact_dotest(time(0), 8, 0);
+    imap_compact_dotest(time(0), 0, 0);
+    imap_compact_dotest(time(0), 64, 0);
+    imap_compact_dotest(time(0), 128, 0);
+    imap_compact_dotest(time(0), 8, 1);
+}
+
+static void imap_relayout_levels(imap_node_t *tree, imap_slot_t sval, imap_u32_t depth,
+    imap_u64_t *minoff, imap_u64_t *maxoff)
+{
+    imap_slot_t *slot;
+    imap_u64_t offset;
+
+    // a full node is always placed after its parent; the offsets of the full nodes of each level are recorded
+    if (imap__slot_iscell__(sval))
+        return;
+    offset = imap__inner_offset__(sval);
+    if (!(sval & imap__slot_cell__))
+    {
+        minoff[depth] = minoff[depth] < offset ? minoff[depth] : offset;
+        maxoff[depth] = maxoff[depth] > offset ? maxoff[depth] : offset;
+    }
+    for (imap_u32_t dirn = 0; 16 > dirn; dirn++)
+    {
+        slot = imap__inner_slot__(tree, sval, dirn);
+        if (!slot || !(*slot & imap__slot_node__))
+            continue;
+        if (!imap__slot_iscell__(*slot) && !(*slot & imap__slot_cell__))
+            ASSERT(offset < imap__inner_offset__(*slot));
+        imap_relayout_levels(tree, *slot, depth + 1, minoff, maxoff);
+    }
+}
+
+static void imap_relayout_dotest(imap_u64_t seed, unsigned ysize, imap_u32_t policy)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t *xs, y, mark, minoff[32], maxoff[32];
+    unsigned n;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        imap_u64_t x = test_rand() & (i & 1 ? 0xffffffffull : 0xfffffull);
+        tree = test_compact_ensure(tree, ysize);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x);
+        ASSERT(0 != slot);
+        test_compact_setval(tree, slot, (x & 1) ? x : 0x8000000000000000ull | x, ysize);
+    }
+    for (unsigned i = 0; N / 2 > i; i++)
+        imap_remove(tree, test_rand() & 0xfffffull);
+
+    n = 0;
+    for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+        xs[n++] = pair.x;
+
+    tree =
+        0 == ysize ? imap_relayout0(tree, policy) :
+        64 == ysize ? imap_relayout64(tree, policy) :
+        128 == ysize ? imap_relayout128(tree, policy) :
+        imap_relayout(tree, policy);
+    ASSERT(0 != tree);
+    ASSERT(0 == tree->vecsl[imap__tree_nfre__]);
+    ASSERT(sizeof(imap_node_t) == imap__inner_offset__(tree->vecsl[imap__tree_root__]));
+    for (unsigned i = 0; 32 > i; i++)
+    {
+        minoff[i] = ~0ull;
+        maxoff[i] = 0;
+    }
+    imap_relayout_levels(tree, tree->vecsl[imap__tree_root__], 0, minoff, maxoff);
+    // breadth-first order places the full nodes of each level before those of the next
+    if (imap_layout_bfs == policy)
+        for (unsigned i = 0; 31 > i && ~0ull != minoff[i + 1]; i++)
+            ASSERT(maxoff[i] < minoff[i + 1]);
+
+    pair = imap_iterate(tree, &iter, 1);
+    for (unsigned i = 0; n > i; i++)
+    {
+        ASSERT(0 != pair.slot);
+        ASSERT(xs[i] == pair.x);
+        y = (xs[i] & 1) ? xs[i] : 0x8000000000000000ull | xs[i];
+        ASSERT(test_compact_hasval(tree, pair.slot, y, ysize));
+        pair = imap_iterate(tree, &iter, 0);
+    }
+    ASSERT(0 == pair.slot);
+
+    // the layout is as dense as that of a compacted tree
+    mark = tree->vecsl[imap__tree_mark__];
+    tree =
+        0 == ysize ? imap_compact0(tree) :
+        64 == ysize ? imap_compact64(tree) :
+        128 == ysize ? imap_compact128(tree) :
+        imap_compact(tree);
+    ASSERT(0 != tree);
+    ASSERT(mark == tree->vec32[imap__tree_mark__]);
+
+    imap_free(tree);
+    free(xs);
+}
+
+static void imap_relayout_test(void)
+{
+    imap_node_t *tree;
+
+    tree = imap_relayout(imap_ensure(0, +1), imap_layout_veb);
+    ASSERT(0 != tree);
+    ASSERT(0 == tree->vecsl[imap__tree_root__]);
+    tree = imap_ensure(tree, +1);
+    ASSERT(0 != tree);
+    imap_setval(tree, imap_assign(tree, 42), 43);
+    tree = imap_relayout(tree, imap_layout_bfs);
+    ASSERT(0 != tree);
+    ASSERT(43 == imap_getval(tree, imap_lookup(tree, 42)));
+    imap_free(tree);
+
+    imap_relayout_dotest(time(0), 8, imap_layout_dfs);
+    imap_relayout_dotest(time(0), 8, imap_layout_bfs);
+    imap_relayout_dotest(time(0), 8, imap_layout_veb);
+    imap_relayout_dotest(time(0), 0, imap_layout_veb);
+    imap_relayout_dotest(time(0), 128, imap_layout_bfs);
+    imap_relayout_dotest(time(0), 64, imap_layout_veb);
+}
+
+static void imap_growth_dotest(imap_u32_t policy)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree, *newtree;
+    imap_slot_t *slot;
+    imap_u64_t oldsize, newsize;
+
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    tree = imap_setgrowth(tree, policy, 0);
+    ASSERT(0 != tree);
+    for (unsigned i = 0; N > i; i++)
+    {
+        oldsize = tree->vecsl[imap__tree_size__];
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        newsize = tree->vecsl[imap__tree_size__];
+        ASSERT(0 == newsize % sizeof(imap_node_t));
+        if (oldsize != newsize)
+            switch (policy)
+            {
+            case imap_grow_pow2:
+                ASSERT(0 == (newsize & (newsize - 1)));
+                break;
+            case imap_grow_half:
+                ASSERT(newsize >= oldsize + oldsize / 2);
+                ASSERT(newsize < oldsize + oldsize / 2 + 4 * sizeof(imap_node_t));
+                break;
+            case imap_grow_exact:
+                ASSERT(newsize <= (tree->vecsl[imap__tree_mark__] + 3 * sizeof(imap_node_t)) * 9 / 8 +
+                    sizeof(imap_node_t));
+                break;
+            }
+        slot = imap_assign(tree, (imap_u64_t)i << 8);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, 0x8000000000000000ull | i);
+    }
+    for (unsigned i = 0; N > i; i++)
+    {
+        slot = imap_lookup(tree, (imap_u64_t)i << 8);
+        ASSERT(0 != slot);
+        ASSERT((0x8000000000000000ull | i) == imap_getval(tree, slot));
+    }
+    imap_free(tree);
+
+    // growth stops at the budget and leaves the tree intact
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    tree = imap_setgrowth(tree, policy, 64 * 1024);
+    ASSERT(0 != tree);
+    for (unsigned i = 0;; i++)
+    {
+        newtree = imap_ensure(tree, +1);
+        if (0 == newtree)
+        {
+            ASSERT(0 != i);
+            break;
+        }
+        tree = newtree;
+        ASSERT(64 * 1024 >= tree->vecsl[imap__tree_size__]);
+        slot = imap_assign(tree, (imap_u64_t)i << 8);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, i);
+    }
+    ASSERT(0 != imap_lookup(tree, 0));
+    imap_free(tree);
+}
+
+static void imap_growth_test(void)
+{
+    imap_growth_dotest(imap_grow_pow2);
+    imap_growth_dotest(imap_grow_half);
+    imap_growth_dotest(imap_grow_exact);
+}
+
+static void imap_reserve_exact_dotest(imap_u64_t seed, int empty, int sparse)
+{
+    const unsigned N = 100000;
+    imap_u64_t *xs, *ys;
+    imap_node_t *tree = 0, *tree2;
+    imap_slot_t *slot;
+    imap_u64_t x;
+    unsigned n;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
+    ys = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != ys);
+
+    if (sparse)
+    {
+        tree = imap_ensure(0, +1);
+        ASSERT(0 != tree);
+        tree = imap_setsparse(tree, 1);
+        ASSERT(0 != tree);
+    }
+    if (!empty)
+    {
+        // an existing tree with free nodes and free value cells
+        for (unsigned i = 0; N > i; i++)
+        {
+            x = test_rand() & 0xfffffffull;
+            tree = imap_ensure(tree, +1);
+            ASSERT(0 != tree);
+            slot = imap_assign(tree, x);
+            ASSERT(0 != slot);
+            imap_setval(tree, slot, (x & 1) ? x : 0x8000000000000000ull | x);
+        }
+        for (unsigned i = 0; N / 4 > i; i++)
+            imap_remove(tree, test_rand() & 0xfffffffull);
+    }
+
+    for (unsigned i = 0; N > i; i++)
+        xs[i] = test_rand() & 0xfffffffull;
+    qsort(xs, N, sizeof xs[0], u64cmp);
+    for (unsigned i = 0; N > i; i++)
+        ys[i] = (test_rand() & 1) ? xs[i] : 0x8000000000000000ull | xs[i];
+    n = N;
+
+    tree = imap_reserve_exact(tree, xs, ys, n);
+    ASSERT(0 != tree);
+    for (unsigned i = 0; n > i; i++)
+    {
+        slot = imap_assign(tree, xs[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, ys[i]);
+    }
+    for (unsigned i = 0; n > i; i++)
+    {
+        slot = imap_lookup(tree, xs[i]);
+        ASSERT(0 != slot);
+        if (n == i + 1 || xs[i] != xs[i + 1])
+            ASSERT(ys[i] == imap_getval(tree, slot));
+    }
+    // the reservation is used up exactly
+    ASSERT(0 == tree->vecsl[imap__tree_nfre__]);
+    ASSERT(tree->vecsl[imap__tree_mark__] == tree->vecsl[imap__tree_size__]);
+
+    if (empty)
+    {
+        n = 0;
+        for (unsigned i = 0; N > i; i++)
+            if (N == i + 1 || xs[i] != xs[i + 1])
+                xs[n] = xs[i], ys[n++] = ys[i];
+        tree2 = imap_build_sorted(xs, ys, n);
+        ASSERT(0 != tree2);
+        // a built tree has the default layout; in a sparse tree it is cells and small nodes that take less
+        if (sparse)
+            ASSERT(tree->vecsl[imap__tree_mark__] < tree2->vecsl[imap__tree_mark__]);
+        else
+            ASSERT(tree->vecsl[imap__tree_mark__] == tree2->vecsl[imap__tree_mark__]);
+        imap_free(tree2);
+    }
+
+    imap_free(tree);
+
+    free(ys);
+    free(xs);
+}
+
+static void imap_reserve_exact_test(void)
+{
+    imap_reserve_exact_dotest(time(0), 1, 0);
+    imap_reserve_exact_dotest(time(0), 0, 0);
+    imap_reserve_exact_dotest(time(0), 1, 1);
+    imap_reserve_exact_dotest(time(0), 0, 1);
+}
+
+static void imap_ensure_grow_test(void)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0, *tree0;
+    imap_slot_t *slot, *slot0;
+    imap_u64_t size0;
+
+    tree = imap_ensure(tree, +1);
+    ASSERT(0 != tree);
+    slot0 = imap_assign(tree, 0);
+    ASSERT(0 != slot0);
+    imap_setval(tree, slot0, 0x8000000000000000ull);
+    tree0 = tree;
+    size0 = tree->vecsl[imap__tree_size__];
+
+    for (unsigned i = 1; N > i; i++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, (imap_u64_t)i << 8);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, 0x8000000000000000ull | i);
+    }
+    ASSERT(size0 < tree->vecsl[imap__tree_size__]);
+    ASSERT(tree->vec32[imap__tree_mark__] <= tree->vec32[imap__tree_size__]);
+#if defined(IMAP_USE_RESERVE)
+    // growth commits the reserved range in place: the tree and its slots do not move
+    ASSERT(tree0 == tree);
+    ASSERT(slot0 == imap_lookup(tree, 0));
+    ASSERT(tree->vecsl[imap__tree_size__] <= tree->vecsl[imap__tree_resv__]);
+#else
+    (void)tree0;
+#endif
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        slot = imap_lookup(tree, (imap_u64_t)i << 8);
+        ASSERT(0 != slot);
+        ASSERT((0x8000000000000000ull | i) == imap_getval(tree, slot));
+    }
+
+    imap_free(tree);
+}
+
+static void imap_ensure_resv_test(void)
+{
+    imap_node_t *tree, *newtree;
+    imap_u64_t i;
+
+    // a tree with its own reservation grows within it; without IMAP_USE_RESERVE the size is ignored
+    tree = imap_ensure_resv(0, +1, 1 << 20);
+    ASSERT(0 != tree);
+    for (i = 0;; i++)
+    {
+        newtree = imap_ensure(tree, +1);
+        if (!newtree)
+            break;
+        tree = newtree;
+        imap_setval(tree, imap_assign(tree, i << 8), i);
+        if (1000000 == i)
+            break;
+    }
+#if defined(IMAP_USE_RESERVE)
+    ASSERT(1000000 > i);
+    ASSERT((1 << 20) == tree->vecsl[imap__tree_resv__]);
+    ASSERT(tree->vecsl[imap__tree_size__] <= (1 << 20));
+#else
+    ASSERT(1000000 == i);
+#endif
+    for (imap_u64_t j = 0; i > j; j++)
+        ASSERT(j == imap_getval(tree, imap_lookup(tree, j << 8)));
+
+    // compaction keeps the reservation
+    for (imap_u64_t j = 0; i > j; j += 2)
+        imap_remove(tree, j << 8);
+    tree = imap_compact(tree);
+    ASSERT(0 != tree);
+#if defined(IMAP_USE_RESERVE)
+    ASSERT((1 << 20) == tree->vecsl[imap__tree_resv__]);
+#endif
+    for (imap_u64_t j = 1; i > j; j += 2)
+        ASSERT(j == imap_getval(tree, imap_lookup(tree, j << 8)));
+    imap_free(tree);
+}
+
+static void imap_build_sorted_dotest(imap_u64_t seed, imap_u64_t xmask)
+{
+    const unsigned N = 1000000;
+    imap_u64_t *xs, *ys;
+    imap_node_t *tree = 0, *tree2 = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+    unsigned n;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
+    ys = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != ys);
+
+    for (unsigned i = 0; N > i; i++)
+        xs[i] = test_rand() & xmask;
+    qsort(xs, N, sizeof xs[0], u64cmp);
+    n = 0;
+    for (unsigned i = 0; N > i; i++)
+        if (0 == i || xs[i - 1] != xs[i])
+            xs[n++] = xs[i];
+    for (unsigned i = 0; N > i; i++)
+        ys[i] = (test_rand() & 1) ? xs[i] : (0x8000000000000000ull | xs[i]);
+
+    tree = imap_build_sorted(xs, ys, n);
+    ASSERT(0 != tree);
+    for (unsigned i = 0; n > i; i++)
+    {
+        tree2 = imap_ensure(tree2, +1);
+        ASSERT(0 != tree2);
+        slot = imap_assign(tree2, xs[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree2, slot, ys[i]);
+    }
+    // small nodes that are outgrown during assignment stay on the free list
+    ASSERT(tree->vecsl[imap__tree_mark__] <= tree2->vecsl[imap__tree_mark__]);
+    ASSERT(tree->vec32[imap__tree_mark__] <= tree->vec32[imap__tree_size__]);
+
+    for (unsigned i = 0; n > i; i++)
+    {
+        slot = imap_lookup(tree, xs[i]);
+        ASSERT(0 != slot);
+        ASSERT(ys[i] == imap_getval(tree, slot));
+    }
+    pair = imap_iterate(tree, &iter, 1);
+    pair2 = imap_iterate(tree2, &iter2, 1);
+    for (unsigned i = 0; n > i; i++)
+    {
+        ASSERT(xs[i] == pair.x && xs[i] == pair2.x);
+        ASSERT(ys[i] == imap_getval(tree, pair.slot));
+        pair = imap_iterate(tree, &iter, 0);
+        pair2 = imap_iterate(tree2, &iter2, 0);
+    }
+    ASSERT(0 == pair.x && 0 == pair.slot);
+    ASSERT(0 == pair2.x && 0 == pair2.slot);
+
+    for (unsigned i = 0; n > i; i += 2)
+        imap_remove(tree, xs[i]);
+    for (unsigned i = 0; n > i; i++)
+    {
+        slot = imap_lookup(tree, xs[i]);
+        ASSERT((0 == i % 2) == (0 == slot));
+    }
+    for (unsigned i = 0; n > i; i += 2)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, xs[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, ys[i]);
+    }
+    for (unsigned i = 0; n > i; i++)
+    {
+        slot = imap_lookup(tree, xs[i]);
+        ASSERT(0 != slot);
+        ASSERT(ys[i] == imap_getval(tree, slot));
+    }
+
+    imap_free(tree2);
+    imap_free(tree);
+
+    free(ys);
+    free(xs);
+}
+
+static void imap_build_sorted_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t xs[] = { 0xA0000056, 0xA0000057, 0xA0008009, 0xA0008059, 0xA0008069 };
+    imap_u64_t ys[] = { 0x56, 0x57, 0x8009, 0x8059, 0x8069 };
+
+    tree = imap_build_sorted(xs, ys, 0);
+    ASSERT(0 != tree);
+    ASSERT(0 == imap_lookup(tree, 0));
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0 == pair.x && 0 == pair.slot);
+    imap_free(tree);
+
+    tree = imap_build_sorted(xs, ys, 5);
+    ASSERT(0 != tree);
+    for (unsigned i = 0; 5 > i; i++)
+    {
+        slot = imap_lookup(tree, xs[i]);
+        ASSERT(0 != slot);
+        ASSERT(ys[i] == imap_getval(tree, slot));
+    }
+    ASSERT(0 == imap_lookup(tree, 0xA0000058));
+    ASSERT(7 * sizeof(imap_node_t) == tree->vecsl[imap__tree_mark__]);
+    imap_free(tree);
+
+    imap_build_sorted_dotest(time(0), 0xffffffffull);
+    imap_build_sorted_dotest(time(0), 0xffffffffffffffffull);
+}
+
+static void imap_apply_batch_dotest(imap_u64_t seed, imap_u64_t xmask)
+{
+    const unsigned N = 1000000;
+    const unsigned M = 1000;
+    imap_op_t *ops;
+    imap_node_t *tree = 0, *tree2 = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    ops = (imap_op_t *)malloc(N * sizeof(imap_op_t));
+    ASSERT(0 != ops);
+
+    for (unsigned r = 0; 4 > r; r++)
+    {
+        unsigned n = 0 == r ? N / 2 : test_rand() % M;
+        for (unsigned i = 0; n > i; i++)
+        {
+            ops[i].x = test_rand() & xmask;
+            ops[i].y = (test_rand() & 1) ? ops[i].x : (0x8000000000000000ull | ops[i].x);
+            ops[i].op = 0 == r || (test_rand() & 1) ? imap_op_assign : imap_op_remove;
+            if (imap_op_remove == ops[i].op && 0 < i && (test_rand() & 1))
+                ops[i].x = ops[test_rand() % i].x;
+        }
+        for (unsigned i = 0; n > i; i++)
+            if (imap_op_assign == ops[i].op)
+            {
+                tree2 = imap_ensure(tree2, +1);
+                ASSERT(0 != tree2);
+                slot = imap_assign(tree2, ops[i].x);
+                ASSERT(0 != slot);
+                imap_setval(tree2, slot, ops[i].y);
+            }
+            else
+                imap_remove(tree2, ops[i].x);
+        tree = imap_apply_batch(tree, ops, n);
+        ASSERT(0 != tree);
+        for (unsigned i = 1; n > i; i++)
+            ASSERT(ops[i - 1].x <= ops[i].x);
+
+        pair = imap_iterate(tree, &iter, 1);
+        pair2 = imap_iterate(tree2, &iter2, 1);
+        for (;;)
+        {
+            ASSERT(pair.x == pair2.x);
+            ASSERT((0 == pair.slot) == (0 == pair2.slot));
+            if (0 == pair.slot)
+                break;
+            ASSERT(imap_getval(tree, pair.slot) == imap_getval(tree2, pair2.slot));
+            pair = imap_iterate(tree, &iter, 0);
+            pair2 = imap_iterate(tree2, &iter2, 0);
+        }
+    }
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        ops[i].x = test_rand() & xmask;
+        ops[i].op = imap_op_remove;
+    }
+    pair = imap_iterate(tree, &iter, 1);
+    for (unsigned i = 0; N > i && pair.slot; i++)
+    {
+        ops[i].x = pair.x;
+        pair = imap_iterate(tree, &iter, 0);
+    }
+    tree = imap_apply_batch(tree, ops, N);
+    ASSERT(0 != tree);
+    ASSERT(0 == tree->vec32[0]);
+
+    imap_free(tree2);
+    imap_free(tree);
+
+    free(ops);
+}
+
+static void imap_apply_batch_test(void)
+{
+    imap_op_t ops[2] = { { 1, 0, imap_op_remove }, { 2, 0, imap_op_remove } };
+    imap_node_t *tree;
+
+    // removals alone do not create a tree
+    ASSERT(0 == imap_apply_batch(0, ops, 2));
+    ASSERT(0 == imap_apply_batch(0, ops, 0));
+    ops[1].op = imap_op_assign;
+    tree = imap_apply_batch(0, ops, 2);
+    ASSERT(0 != tree);
+    ASSERT(0 != imap_lookup(tree, 2));
+    imap_free(tree);
+
+    imap_apply_batch_dotest(time(0), 0xffffffull);
+    imap_apply_batch_dotest(time(0), 0xffffffffffffffffull);
+}
+
+static void imap_cursor_dotest(imap_u64_t seed, imap_u64_t xmask, int sequential, int sparse)
+{
+    const unsigned N = 1000000;
+    imap_node_t *tree = 0, *tree2 = 0;
+    imap_cursor_t cursor;
+    imap_slot_t *slot, *slot2;
+    imap_u64_t x;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    if (sparse)
+    {
+        tree = imap_ensure(0, +1);
+        ASSERT(0 != tree);
+        tree = imap_setsparse(tree, 1);
+        ASSERT(0 != tree);
+        tree2 = imap_ensure(0, +1);
+        ASSERT(0 != tree2);
+        tree2 = imap_setsparse(tree2, 1);
+        ASSERT(0 != tree2);
+    }
+    imap_cursor_reset(&cursor);
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = sequential ? (i >> 1) + (test_rand() & 0xf) : test_rand() & xmask;
+        switch (test_rand() % 4)
+        {
+        case 0:
+        case 1:
+            tree = imap_ensure(tree, +1);
+            ASSERT(0 != tree);
+            tree2 = imap_ensure(tree2, +1);
+            ASSERT(0 != tree2);
+            slot = imap_cursor_assign(tree, &cursor, x);
+            ASSERT(0 != slot);
+            slot2 = imap_assign(tree2, x);
+            ASSERT(0 != slot2);
+            ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+            imap_setval(tree, slot, i);
+            imap_setval(tree2, slot2, i);
+            break;
+        case 2:
+            if (0 != tree)
+                imap_cursor_remove(tree, &cursor, x);
+            if (0 != tree2)
+                imap_remove(tree2, x);
+            break;
+        case 3:
+            if (0 == tree)
+                break;
+            slot = imap_cursor_lookup(tree, &cursor, x);
+            slot2 = imap_lookup(tree2, x);
+            ASSERT((0 == slot) == (0 == slot2));
+            if (0 != slot)
+                ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+            break;
+        }
+    }
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = sequential ? i >> 1 : test_rand() & xmask;
+        slot = imap_cursor_lookup(tree, &cursor, x);
+        slot2 = imap_lookup(tree2, x);
+        ASSERT(slot == imap_lookup(tree, x));
+        ASSERT((0 == slot) == (0 == slot2));
+        if (0 != slot)
+            ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+    }
+
+    imap_free(tree2);
+    imap_free(tree);
+}
+
+static void imap_cursor_test(void)
+{
+    imap_node_t *tree;
+    imap_cursor_t cursor;
+    imap_slot_t *slot;
+
+    tree = 0;
+    tree = imap_ensure(tree, +5);
+    ASSERT(0 != tree);
+    imap_cursor_reset(&cursor);
+    ASSERT(0 == imap_cursor_lookup(tree, &cursor, 0xA0000056));
+    slot = imap_cursor_assign(tree, &cursor, 0xA0000056);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x56);
+    slot = imap_cursor_assign(tree, &cursor, 0xA0000057);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x57);
+    slot = imap_cursor_assign(tree, &cursor, 0xA0008009);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8009);
+    slot = imap_cursor_assign(tree, &cursor, 0xA0008059);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8059);
+    slot = imap_cursor_assign(tree, &cursor, 0xA0008069);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8069);
+    slot = imap_cursor_lookup(tree, &cursor, 0xA0000057);
+    ASSERT(0 != slot);
+    ASSERT(0x57 == imap_getval(tree, slot));
+    slot = imap_cursor_lookup(tree, &cursor, 0xA0008059);
+    ASSERT(0 != slot);
+    ASSERT(0x8059 == imap_getval(tree, slot));
+    imap_cursor_remove(tree, &cursor, 0xA0008059);
+    ASSERT(0 == imap_cursor_lookup(tree, &cursor, 0xA0008059));
+    ASSERT(0 == imap_lookup(tree, 0xA0008059));
+    imap_cursor_remove(tree, &cursor, 0xA0008069);
+    imap_cursor_remove(tree, &cursor, 0xA0008009);
+    imap_cursor_remove(tree, &cursor, 0xA0000056);
+    slot = imap_cursor_lookup(tree, &cursor, 0xA0000057);
+    ASSERT(0 != slot);
+    ASSERT(0x57 == imap_getval(tree, slot));
+    imap_cursor_remove(tree, &cursor, 0xA0000057);
+    ASSERT(0 == tree->vec32[0]);
+    imap_free(tree);
+
+    imap_cursor_dotest(time(0), 0xffffffull, 1, 0);
+    imap_cursor_dotest(time(0), 0xffffffull, 0, 0);
+    imap_cursor_dotest(time(0), 0xffffffffffffffffull, 0, 0);
+    imap_cursor_dotest(time(0), 0xffffffull, 0, 1);
+    imap_cursor_dotest(time(0), 0xffffffffffffffffull, 0, 1);
+}
+
+static void imap_lookup_batch_dotest(imap_u64_t seed)
+{
+    const unsigned N = 1000000;
+    const unsigned M = 1000;
+    imap_u64_t *array, *ys;
+    imap_slot_t **slots;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    array = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != array);
+    ys = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != ys);
+    slots = (imap_slot_t **)malloc(N * sizeof(imap_slot_t *));
+    ASSERT(0 != slots);
+
+    for (unsigned i = 0; N > i; i++)
+        array[i] = test_rand() & 0xffffffffffull;
+
+    for (unsigned i = 0; N / 2 > i; i++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, array[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, array[i]);
+    }
+
+    imap_lookup_batch(tree, array, slots, N);
+    for (unsigned i = 0; N > i; i++)
+        ASSERT(imap_lookup(tree, array[i]) == slots[i]);
+    imap_getval_batch(tree, slots, ys, N);
+    for (unsigned i = 0; N > i; i++)
+        ASSERT((slots[i] ? array[i] : 0) == ys[i]);
+
+    for (unsigned i = 0; M > i; i++)
+    {
+        unsigned j = test_rand() % (N - M);
+        unsigned n = test_rand() % (M + 1);
+        imap_lookup_batch(tree, array + j, slots, n);
+        imap_getval_batch(tree, slots, ys, n);
+        for (unsigned k = 0; n > k; k++)
+        {
+            slot = imap_lookup(tree, array[j + k]);
+            ASSERT(slot == slots[k]);
+            ASSERT((slot ? array[j + k] : 0) == ys[k]);
+        }
+    }
+
+    imap_free(tree);
+
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    imap_lookup_batch(tree, array, slots, M);
+    for (unsigned i = 0; M > i; i++)
+        ASSERT(0 == slots[i]);
+    imap_free(tree);
+
+    free(slots);
+    free(ys);
+    free(array);
+}
+
+static void imap_lookup_batch_test(void)
+{
+    imap_lookup_batch_dotest(time(0));
+}
+
+static void imap_sparse_leaf_dotest(imap_u64_t seed)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t *xs;
+    unsigned n;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
+
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    tree = imap_setsparse(tree, 1);
+    ASSERT(0 != tree);
+
+    // random 64-bit keys rarely share a position 0 node; every third key gets a neighbor that does
+    for (unsigned i = 0; N > i; i++)
+        xs[i] = 0 == i % 3 ? test_rand() : xs[i - i % 3] ^ (i % 3);
+    for (unsigned i = 0; N > i; i++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, xs[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, (xs[i] & 1) ? xs[i] : 0x8000000000000000ull | xs[i]);
+    }
+    // cells take a fraction of a node per key
+    ASSERT(tree->vecsl[imap__tree_mark__] < N * sizeof(imap_node_t));
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        slot = imap_lookup(tree, xs[i]);
+        ASSERT(0 != slot);
+        ASSERT(((xs[i] & 1) ? xs[i] : 0x8000000000000000ull | xs[i]) == imap_getval(tree, slot));
+        ASSERT(0 == imap_lookup(tree, xs[i] ^ 0x100));
+    }
+
+    for (unsigned i = 0; N > i; i += 2)
+        imap_remove(tree, xs[i]);
+    qsort(xs, N, sizeof xs[0], u64cmp);
+    n = 0;
+    for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+    {
+        ASSERT(0 == n || xs[n - 1] < pair.x);
+        ASSERT(pair.slot == imap_lookup(tree, pair.x));
+        pair = imap_locate(tree, &iter, pair.x);
+        ASSERT(pair.slot == imap_lookup(tree, pair.x));
+        xs[n++] = pair.x;
+    }
+    ASSERT(N / 2 == n);
+    for (unsigned i = 0; n > i; i++)
+    {
+        pair = imap_locate(tree, &iter, xs[i] - 1);
+        ASSERT(xs[i] == pair.x);
+        pair = imap_locate_rev(tree, &iter, xs[i] + 1);
+        ASSERT(xs[i] == pair.x);
+        pair = imap_iterate_rev(tree, &iter, 0);
+        ASSERT(0 == i ? 0 == pair.slot : xs[i - 1] == pair.x);
+    }
+
+    for (unsigned i = 0; n > i; i++)
+        imap_remove(tree, xs[i]);
+    ASSERT(0 == tree->vecsl[imap__tree_root__]);
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0 == pair.slot);
+
+    imap_free(tree);
+
+    free(xs);
+}
+
+static void imap_sparse_leaf_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+
+    // without the sparse layout a single key gets a position 0 node
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    slot = imap_assign(tree, 0xA0000056);
+    ASSERT(0 != slot);
+    ASSERT(!(imap__slot_cell__ & tree->vecsl[imap__tree_root__]));
+    ASSERT(2 * sizeof(imap_node_t) == tree->vecsl[imap__tree_mark__]);
+    imap_free(tree);
+
+    tree = imap_ensure(0, +3);
+    ASSERT(0 != tree);
+    tree = imap_setsparse(tree, 1);
+    ASSERT(0 != tree);
+
+    // a single key is held in a cell that the root points to directly
+    slot = imap_assign(tree, 0xA0000056);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x56);
+    ASSERT(imap__slot_cell__ & tree->vecsl[imap__tree_root__]);
+    ASSERT(3 * sizeof(imap_node_t) == tree->vecsl[imap__tree_mark__]);
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0xA0000056 == pair.x && slot == pair.slot);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0 == pair.slot);
+    pair = imap_locate(tree, &iter, 0xA0000050);
+    ASSERT(0xA0000056 == pair.x && slot == pair.slot);
+    pair = imap_locate(tree, &iter, 0xA0000057);
+    ASSERT(0 == pair.slot);
+    pair = imap_locate_rev(tree, &iter, 0xA000005f);
+    ASSERT(0xA0000056 == pair.x && slot == pair.slot);
+    pair = imap_locate_rev(tree, &iter, 0xA0000055);
+    ASSERT(0 == pair.slot);
+    ASSERT(0 == imap_lookup(tree, 0xA0000057));
+
+    // a second key with the same prefix turns the cell into a position 0 node
+    slot = imap_assign(tree, 0xA0000057);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8000000000000057ull);
+    ASSERT(!(imap__slot_cell__ & tree->vecsl[imap__tree_root__]));
+    ASSERT(0x56 == imap_getval(tree, imap_lookup(tree, 0xA0000056)));
+    ASSERT(0x8000000000000057ull == imap_getval(tree, imap_lookup(tree, 0xA0000057)));
+
+    // a key with a different prefix is split off into a cell of its own
+    slot = imap_assign(tree, 0xA0008009);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8009);
+    ASSERT(0x8009 == imap_getval(tree, imap_lookup(tree, 0xA0008009)));
+
+    // removing a key from a position 0 node with two values turns it back into a cell
+    imap_remove(tree, 0xA0000056);
+    ASSERT(0 == imap_lookup(tree, 0xA0000056));
+    ASSERT(0x8000000000000057ull == imap_getval(tree, imap_lookup(tree, 0xA0000057)));
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0xA0000057 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0xA0008009 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0 == pair.slot);
+    imap_remove(tree, 0xA0008009);
+    ASSERT(imap__slot_cell__ & tree->vecsl[imap__tree_root__]);
+    imap_remove(tree, 0xA0000057);
+    ASSERT(0 == tree->vecsl[imap__tree_root__]);
+
+    imap_free(tree);
+
+    imap_sparse_leaf_dotest(time(0));
+}
+
+static void imap_small_node_dotest(imap_u64_t seed)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0;
+    imap_u32_t *counts;
+    imap_cursor_t cursor;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t *xs;
+    unsigned n;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    xs = (imap_u64_t *)malloc(N * sizeof(imap_u64_t));
+    ASSERT(0 != xs);
+
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    tree = imap_setsparse(tree, 1);
+    ASSERT(0 != tree);
+
+    // random 64-bit keys make most internal nodes branch two ways
+    for (unsigned i = 0; N > i; i++)
+    {
+        xs[i] = test_rand();
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, xs[i]);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, i);
+    }
+    // small nodes and cells take less than half a node per key
+    ASSERT(tree->vecsl[imap__tree_mark__] < N * sizeof(imap_node_t) / 2);
+
+    counts = imap_count_ensure(tree, 0);
+    ASSERT(0 != counts);
+    for (unsigned i = 0; N > i; i += 2)
+    {
+        imap_remove(tree, xs[i]);
+        imap_count_update(tree, counts, xs[i]);
+    }
+    qsort(xs, N, sizeof xs[0], u64cmp);
+    n = 0;
+    for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+    {
+        ASSERT(0 == n || xs[n - 1] < pair.x);
+        ASSERT(pair.slot == imap_lookup(tree, pair.x));
+        xs[n++] = pair.x;
+    }
+    ASSERT(N / 2 == n);
+    for (unsigned i = 0; n > i; i++)
+    {
+        ASSERT(i == imap_rank(tree, counts, xs[i]));
+        ASSERT(xs[i] == imap_select(tree, counts, i).x);
+        pair = imap_locate(tree, &iter, xs[i] - 1);
+        ASSERT(xs[i] == pair.x);
+        pair = imap_locate_rev(tree, &iter, xs[i] + 1);
+        ASSERT(xs[i] == pair.x);
+        pair = imap_iterate_rev(tree, &iter, 0);
+        ASSERT(0 == i ? 0 == pair.slot : xs[i - 1] == pair.x);
+    }
+    imap_count_free(counts);
+
+    // the cursor resumes from small nodes on the path of the previous key
+    cursor.stackp = 0;
+    for (unsigned i = 0; n > i; i++)
+    {
+        ASSERT(imap_lookup(tree, xs[i]) == imap_cursor_lookup(tree, &cursor, xs[i]));
+        ASSERT(0 == imap_cursor_lookup(tree, &cursor, xs[i] ^ 0x10000));
+    }
+    cursor.stackp = 0;
+    for (unsigned i = 0; n > i; i++)
+        imap_cursor_remove(tree, &cursor, xs[i]);
+    ASSERT(0 == tree->vecsl[imap__tree_root__]);
+
+    imap_free(tree);
+
+    free(xs);
+}
+
+static void imap_small_node_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    char *dump;
+
+    tree = imap_ensure(0, +4);
+    ASSERT(0 != tree);
+    tree = imap_setsparse(tree, 1);
+    ASSERT(0 != tree);
+
+    // an internal node with two children is a small node
+    slot = imap_assign(tree, 0xA0001000);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x1000);
+    slot = imap_assign(tree, 0xA0002000);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x2000);
+    ASSERT(imap__slot_issmall__(tree->vecsl[imap__tree_root__]));
+    ASSERT(4 * sizeof(imap_node_t) == tree->vecsl[imap__tree_mark__]);
+    dump = 0;
+    imap_dump(tree, test_concat_sprintf, &dump);
+#if !defined(IMAP_WIDE_SLOTS)
+    ASSERT(0 == strcmp(dump, ""
+        "000000c0: 00000000a0000000/3 1->a0001000:1000 2->a0002000:2000\n"
+        ""));
+#else
+    ASSERT(0 == strcmp(dump, ""
+        "00000180: 00000000a0000000/3 1->a0001000:1000 2->a0002000:2000\n"
+        ""));
+#endif
+    free(dump);
+
+    // a small node under a small node
+    slot = imap_assign(tree, 0xA0001100);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x1100);
+    ASSERT(imap__slot_issmall__(tree->vecsl[imap__tree_root__]));
+    ASSERT(0x1100 == imap_getval(tree, imap_lookup(tree, 0xA0001100)));
+    ASSERT(0 == imap_lookup(tree, 0xA0001200));
+    ASSERT(0 == imap_lookup(tree, 0xA0003000));
+    pair = imap_locate(tree, &iter, 0xA0001001);
+    ASSERT(0xA0001100 == pair.x);
+    pair = imap_locate(tree, &iter, 0xA0001200);
+    ASSERT(0xA0002000 == pair.x);
+    pair = imap_locate_rev(tree, &iter, 0xA0001200);
+    ASSERT(0xA0001100 == pair.x);
+
+    // a third child turns a small node into a node and removing it turns the node back
+    slot = imap_assign(tree, 0xA0003000);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x3000);
+    ASSERT(!(imap__slot_cell__ & tree->vecsl[imap__tree_root__]));
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0xA0001000 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0xA0001100 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0xA0002000 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0xA0003000 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0 == pair.slot);
+    imap_remove(tree, 0xA0003000);
+    ASSERT(imap__slot_issmall__(tree->vecsl[imap__tree_root__]));
+
+    // a small node that loses a child is replaced by its other child
+    imap_remove(tree, 0xA0001000);
+    ASSERT(imap__slot_issmall__(tree->vecsl[imap__tree_root__]));
+    ASSERT(0x1100 == imap_getval(tree, imap_lookup(tree, 0xA0001100)));
+    ASSERT(0x2000 == imap_getval(tree, imap_lookup(tree, 0xA0002000)));
+    imap_remove(tree, 0xA0002000);
+    ASSERT(imap__slot_iscell__(tree->vecsl[imap__tree_root__]));
+    imap_remove(tree, 0xA0001100);
+    ASSERT(0 == tree->vecsl[imap__tree_root__]);
+
+    imap_free(tree);
+
+    imap_small_node_dotest(time(0));
+}
+
+static void imap_inline_check(imap_node_t *tree, imap_node_t *tree2, const imap_u64_t *keys, unsigned nkey)
+{
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+    imap_slot_t *slot, *slot2;
+
+    // the inline map and the tree hold the same pairs
+    pair = imap_iterate(tree, &iter, 1);
+    pair2 = imap_iterate(tree2, &iter2, 1);
+    for (;;)
+    {
+        ASSERT(pair.x == pair2.x);
+        ASSERT(!pair.slot == !pair2.slot);
+        if (!pair.slot)
+            break;
+        ASSERT(imap_getval(tree, pair.slot) == imap_getval(tree2, pair2.slot));
+        pair = imap_iterate(tree, &iter, 0);
+        pair2 = imap_iterate(tree2, &iter2, 0);
+    }
+    pair = imap_iterate_rev(tree, &iter, 1);
+    pair2 = imap_iterate_rev(tree2, &iter2, 1);
+    ASSERT(pair.x == pair2.x && !pair.slot == !pair2.slot);
+    for (unsigned i = 0; nkey > i; i++)
+    {
+        slot = imap_lookup(tree, keys[i]);
+        slot2 = imap_lookup(tree2, keys[i]);
+        ASSERT(!slot == !slot2);
+        if (slot)
+            ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+        pair = imap_locate(tree, &iter, keys[i]);
+        pair2 = imap_locate(tree2, &iter2, keys[i]);
+        ASSERT(pair.x == pair2.x && !pair.slot == !pair2.slot);
+        pair = imap_iterate(tree, &iter, 0);
+        pair2 = imap_iterate(tree2, &iter2, 0);
+        ASSERT(pair.x == pair2.x && !pair.slot == !pair2.slot);
+        pair = imap_locate_rev(tree, &iter, keys[i]);
+        pair2 = imap_locate_rev(tree2, &iter2, keys[i]);
+        ASSERT(pair.x == pair2.x && !pair.slot == !pair2.slot);
+        pair = imap_iterate_rev(tree, &iter, 0);
+        pair2 = imap_iterate_rev(tree2, &iter2, 0);
+        ASSERT(pair.x == pair2.x && !pair.slot == !pair2.slot);
+    }
+}
+
+static void imap_inline_dotest(imap_u64_t seed)
+{
+    const unsigned M = 2000;
+    imap_node_t *tree, *tree2;
+    imap_cursor_t cursor;
+    imap_slot_t *slot;
+    imap_u64_t keys[12], x, x1, y;
+    unsigned nkey, nlist = 0;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    // many small maps are checked against trees that receive the same operations;
+    // maps that get more than 8 keys turn into trees along the way
+    for (unsigned m = 0; M > m; m++)
+    {
+        nkey = 4 + m % 9;
+        for (unsigned i = 0; nkey > i; i++)
+            keys[i] = test_rand() & (m & 1 ? 0xffffffffffffffffull : 0xfff);
+        tree = imap_ensure_inline(0, +1);
+        ASSERT(0 != tree);
+        tree2 = imap_ensure(0, +1);
+        ASSERT(0 != tree2);
+        for (unsigned j = 0; 40 > j; j++)
+        {
+            x = keys[test_rand() % nkey];
+            x1 = x + (test_rand() & 0x3ff);
+            y = test_rand() & 1 ? test_rand() : test_rand() & 0xffff;
+            switch (test_rand() % 5)
+            {
+            case 0:
+            case 1:
+                tree = imap_ensure_inline(tree, +1);
+                ASSERT(0 != tree);
+                slot = imap_assign(tree, x);
+                ASSERT(0 != slot);
+                imap_setval(tree, slot, y);
+                break;
+            case 2:
+                tree = imap_ensure(tree, +1);
+                ASSERT(0 != tree);
+                cursor.stackp = 0;
+                slot = imap_cursor_assign(tree, &cursor, x);
+                ASSERT(0 != slot);
+                imap_setval(tree, slot, y);
+                break;
+            case 3:
+                imap_remove(tree, x);
+                imap_remove(tree2, x);
+                y = 0;
+                break;
+            case 4:
+                imap_remove_range(tree, x, x1);
+                imap_remove_range(tree2, x, x1);
+                y = 0;
+                break;
+            }
+            if (y)
+            {
+                tree2 = imap_ensure(tree2, +1);
+                ASSERT(0 != tree2);
+                slot = imap_assign(tree2, x);
+                ASSERT(0 != slot);
+                imap_setval(tree2, slot, y);
+            }
+            imap_inline_check(tree, tree2, keys, nkey);
+        }
+        nlist += imap__slot_islist__(tree->vecsl[imap__tree_root__]);
+        imap_free(tree2);
+        imap_free(tree);
+    }
+    ASSERT(0 < nlist && nlist < M);
+}
+
+static void imap_inline_test(void)
+{
+    imap_node_t *tree;
+    imap_u32_t *counts;
+    imap_cursor_t cursor;
+    imap_slot_t *slot, *slots[3];
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t xs[3];
+    char *dump;
+
+    // a new inline map is the header node followed by the list; nothing else is allocated
+    tree = imap_ensure_inline(0, +1);
+    ASSERT(0 != tree);
+    ASSERT(imap__slot_islist__(tree->vecsl[imap__tree_root__]));
+    ASSERT(sizeof(imap_node_t) + imap__list_size__ == tree->vecsl[imap__tree_mark__]);
+    ASSERT(tree->vecsl[imap__tree_mark__] == tree->vecsl[imap__tree_size__]);
+    ASSERT(0 == imap_lookup(tree, 0));
+    ASSERT(0 == imap_iterate(tree, &iter, 1).slot);
+    ASSERT(0 == imap_iterate_rev(tree, &iter, 1).slot);
+
+    for (imap_u64_t x = 8; x; x--)
+    {
+        tree = imap_ensure_inline(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x * 0x1111111111111111ull);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, x);
+    }
+    ASSERT(imap__slot_islist__(tree->vecsl[imap__tree_root__]));
+    ASSERT(sizeof(imap_node_t) + imap__list_size__ == tree->vecsl[imap__tree_size__]);
+    for (imap_u64_t x = 1; 8 >= x; x++)
+    {
+        ASSERT(x == imap_getval(tree, imap_lookup(tree, x * 0x1111111111111111ull)));
+        ASSERT(0 == imap_lookup(tree, x * 0x1111111111111111ull + 1));
+    }
+    xs[0] = 0x2222222222222222ull;
+    xs[1] = 0x2222222222222223ull;
+    xs[2] = 0x8888888888888888ull;
+    imap_lookup_batch(tree, xs, slots, 3);
+    ASSERT(2 == imap_getval(tree, slots[0]));
+    ASSERT(0 == slots[1]);
+    ASSERT(8 == imap_getval(tree, slots[2]));
+    pair = imap_iterate(tree, &iter, 1);
+    for (imap_u64_t x = 1; 8 >= x; x++)
+    {
+        ASSERT(x * 0x1111111111111111ull == pair.x);
+        pair = imap_iterate(tree, &iter, 0);
+    }
+    ASSERT(0 == pair.slot);
+    pair = imap_locate(tree, &iter, 0x3000000000000000ull);
+    ASSERT(0x3333333333333333ull == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(0x4444444444444444ull == pair.x);
+    pair = imap_locate_rev(tree, &iter, 0x3000000000000000ull);
+    ASSERT(0x2222222222222222ull == pair.x);
+    pair = imap_iterate_rev(tree, &iter, 0);
+    ASSERT(0x1111111111111111ull == pair.x);
+    pair = imap_iterate_rev(tree, &iter, 0);
+    ASSERT(0 == pair.slot);
+    pair = imap_locate_range(tree, &iter, 0x3000000000000000ull, 0x5000000000000000ull);
+    ASSERT(0x3333333333333333ull == pair.x);
+    pair = imap_iterate_range(tree, &iter, 0x5000000000000000ull);
+    ASSERT(0x4444444444444444ull == pair.x);
+    pair = imap_iterate_range(tree, &iter, 0x5000000000000000ull);
+    ASSERT(0 == pair.slot);
+
+    counts = imap_count_ensure(tree, 0);
+    ASSERT(0 != counts);
+    ASSERT(8 == imap_count_range(tree, counts, 0, ~0ull));
+    ASSERT(2 == imap_rank(tree, counts, 0x3333333333333333ull));
+    ASSERT(0x6666666666666666ull == imap_select(tree, counts, 5).x);
+    imap_count_free(counts);
+
+    dump = 0;
+    imap_dump(tree, test_concat_sprintf, &dump);
+#if !defined(IMAP_WIDE_SLOTS)
+    ASSERT(0 == strncmp(dump, "00000040: list 1111111111111111:1 2222222222222222:2 ", 53));
+#else
+    ASSERT(0 == strncmp(dump, "00000080: list 1111111111111111:1 2222222222222222:2 ", 53));
+#endif
+    free(dump);
+
+    // removal closes the gap and the cursor interface works on the list
+    imap_remove(tree, 0x4444444444444444ull);
+    ASSERT(0 == imap_lookup(tree, 0x4444444444444444ull));
+    imap_remove_range(tree, 0x5000000000000000ull, 0x6666666666666666ull);
+    ASSERT(5 == (tree->vecsl[imap__tree_root__] & imap__slot_pmask__));
+    cursor.stackp = 0;
+    ASSERT(3 == imap_getval(tree, imap_cursor_lookup(tree, &cursor, 0x3333333333333333ull)));
+    imap_cursor_remove(tree, &cursor, 0x3333333333333333ull);
+    ASSERT(0 == imap_cursor_lookup(tree, &cursor, 0x3333333333333333ull));
+    tree = imap_ensure_inline(tree, +1);
+    ASSERT(0 != tree);
+    slot = imap_cursor_assign(tree, &cursor, 0x3333333333333333ull);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0xfedcba9876543210ull);
+
+    // a map with more than 8 keys turns into a tree; boxed values stay where they are
+    for (imap_u64_t x = 9; 13 >= x; x++)
+    {
+        tree = imap_ensure_inline(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, x);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, x);
+    }
+    ASSERT(tree->vecsl[imap__tree_root__] & imap__slot_node__);
+    ASSERT(0xfedcba9876543210ull == imap_getval(tree, imap_lookup(tree, 0x3333333333333333ull)));
+    ASSERT(7 == imap_getval(tree, imap_lookup(tree, 0x7777777777777777ull)));
+    ASSERT(13 == imap_getval(tree, imap_lookup(tree, 13)));
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(9 == pair.x);
+
+    imap_free(tree);
+
+    imap_inline_dotest(time(0));
+}
+
+static void imap_forest_dotest(imap_u64_t seed)
+{
+    const unsigned T = 16, M = 20000;
+    imap_forest_t *forest;
+    imap_node_t *trees[16];
+    imap_slot_t ids[16], *slot, *slot2, sval;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u64_t x, y, nfree;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    // the trees of a forest are checked against trees that receive the same operations
+    forest = imap_forest_ensure(0, T);
+    ASSERT(0 != forest);
+    for (unsigned t = 0; T > t; t++)
+    {
+        ids[t] = imap_forest_create(forest);
+        ASSERT(0 != ids[t]);
+        trees[t] = imap_ensure(0, +1);
+        ASSERT(0 != trees[t]);
+    }
+    for (unsigned i = 0; M > i; i++)
+    {
+        unsigned t = test_rand() % T;
+        x = test_rand() & 0xfffff;
+        if (test_rand() % 4)
+        {
+            y = test_rand() & 1 ? test_rand() : test_rand() & 0xffff;
+            forest = imap_forest_ensure(forest, +1);
+            ASSERT(0 != forest);
+            slot = imap_forest_assign(forest, ids[t], x);
+            ASSERT(0 != slot);
+            imap_setval(forest, slot, y);
+            trees[t] = imap_ensure(trees[t], +1);
+            ASSERT(0 != trees[t]);
+            slot = imap_assign(trees[t], x);
+            ASSERT(0 != slot);
+            imap_setval(trees[t], slot, y);
+        }
+        else
+        {
+            imap_forest_remove(forest, ids[t], x);
+            imap_remove(trees[t], x);
+        }
+    }
+    for (unsigned t = 0; T > t; t++)
+    {
+        for (pair = imap_iterate(trees[t], &iter, 1); pair.slot; pair = imap_iterate(trees[t], &iter, 0))
+        {
+            slot = imap_forest_lookup(forest, ids[t], pair.x);
+            ASSERT(0 != slot);
+            ASSERT(imap_getval(trees[t], pair.slot) == imap_getval(forest, slot));
+        }
+        for (unsigned i = 0; 1000 > i; i++)
+        {
+            x = test_rand() & 0xfffff;
+            slot = imap_forest_lookup(forest, ids[t], x);
+            slot2 = imap_lookup(trees[t], x);
+            ASSERT((0 == slot) == (0 == slot2));
+        }
+        ASSERT(imap_forest_memsize(forest, ids[t]) < forest->vecsl[imap__tree_mark__]);
+    }
+    ASSERT(0 == forest->vecsl[imap__tree_root__]);
+
+    // destroyed trees return all of their memory to the free lists of the forest
+    for (unsigned t = 0; T > t; t++)
+    {
+        imap_forest_destroy(forest, ids[t]);
+        imap_free(trees[t]);
+    }
+    nfree = 0;
+    for (sval = forest->vecsl[imap__tree_nfre__]; sval; sval = *(imap_slot_t *)((imap_u8_t *)forest + sval))
+        nfree += sizeof(imap_node_t);
+    for (sval = imap__ext_get__(forest, imap__ext_cfre__); sval; sval = (imap_slot_t)forest->vec64[sval >> imap__slot_shift__])
+        nfree += sizeof(imap_u128_t);
+    for (sval = imap__ext_get__(forest, imap__ext_sfre__); sval; sval = (imap_slot_t)*imap__small__(forest, sval))
+        nfree += imap__small_size__;
+    for (sval = forest->vecsl[imap__tree_vfre__]; sval; sval = (imap_slot_t)forest->vec64[sval >> imap__slot_shift__])
+        if (sizeof(imap_node_t) <= (sval >> imap__slot_shift__) * sizeof(imap_u64_t))
+            nfree += sizeof(imap_u64_t);
+    // the header and the extension node of the sparse layout stay in use
+    ASSERT(nfree == forest->vecsl[imap__tree_mark__] - 2 * sizeof(imap_node_t));
+
+    imap_forest_free(forest);
+}
+
+static void imap_forest_test(void)
+{
+    imap_forest_t *forest;
+    imap_node_t header;
+    imap_slot_t id0, id1, *slot;
+
+    forest = imap_forest_ensure(0, +4);
+    ASSERT(0 != forest);
+    id0 = imap_forest_create(forest);
+    id1 = imap_forest_create(forest);
+    ASSERT(0 != id0 && 0 != id1 && id0 != id1);
+    ASSERT(sizeof(imap_u128_t) == imap_forest_memsize(forest, id0));
+
+    // the same key in two trees of a forest
+    slot = imap_forest_assign(forest, id0, 0xA0001000);
+    ASSERT(0 != slot);
+    imap_setval(forest, slot, 0x1000);
+    slot = imap_forest_assign(forest, id0, 0xA0001001);
+    ASSERT(0 != slot);
+    imap_setval(forest, slot, 0xfedcba9876543210ull);
+    slot = imap_forest_assign(forest, id1, 0xA0001000);
+    ASSERT(0 != slot);
+    imap_setval(forest, slot, 0x2000);
+    ASSERT(0x1000 == imap_getval(forest, imap_forest_lookup(forest, id0, 0xA0001000)));
+    ASSERT(0xfedcba9876543210ull == imap_getval(forest, imap_forest_lookup(forest, id0, 0xA0001001)));
+    ASSERT(0x2000 == imap_getval(forest, imap_forest_lookup(forest, id1, 0xA0001000)));
+    ASSERT(0 == imap_forest_lookup(forest, id1, 0xA0001001));
+    ASSERT(sizeof(imap_u128_t) + sizeof(imap_node_t) + sizeof(imap_u64_t) == imap_forest_memsize(forest, id0));
+
+    // lookups do not write to the forest, so readers of different trees may run concurrently
+    header = *forest;
+    ASSERT(0 != imap_forest_lookup(forest, id0, 0xA0001001));
+    ASSERT(0 != imap_forest_lookup(forest, id1, 0xA0001000));
+    ASSERT(0 == memcmp(&header, forest, sizeof header));
+    ASSERT(2 * sizeof(imap_u128_t) == imap_forest_memsize(forest, id1));
+
+    imap_forest_remove(forest, id0, 0xA0001000);
+    ASSERT(0 == imap_forest_lookup(forest, id0, 0xA0001000));
+    ASSERT(0x2000 == imap_getval(forest, imap_forest_lookup(forest, id1, 0xA0001000)));
+    imap_forest_destroy(forest, id0);
+    ASSERT(0x2000 == imap_getval(forest, imap_forest_lookup(forest, id1, 0xA0001000)));
+    id0 = imap_forest_create(forest);
+    ASSERT(0 == imap_forest_lookup(forest, id0, 0xA0001001));
+
+    imap_forest_free(forest);
+
+    imap_forest_dotest(time(0));
+}
+
+static void imap_prune_dotest(imap_u64_t seed, imap_u32_t budget)
+{
+    const unsigned N = 20000;
+    imap_node_t *tree = 0, *tree2 = 0;
+    imap_slot_t *slot;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+    imap_u32_t nnode, nsmal, ncell, nboxd, nnode2, nsmal2, ncell2, nboxd2;
+    imap_u64_t x, y;
+    unsigned nstep;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = test_rand() & (i & 1 ? 0xfffffull : 0xffffffffffffull);
+        y = test_rand() & 1 ? x : 0x8000000000000000ull | x;
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, x), y);
+        tree2 = imap_ensure(tree2, +1);
+        ASSERT(0 != tree2);
+        imap_setval(tree2, imap_assign(tree2, x), y);
+    }
+
+    // values deleted with imap_delval leave empty nodes and cells behind until the tree is pruned
+    test_srand(seed);
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = test_rand() & (i & 1 ? 0xfffffull : 0xffffffffffffull);
+        test_rand();
+        if (i % 4)
+        {
+            slot = imap_lookup(tree, x);
+            if (slot)
+                imap_delval(tree, slot);
+            imap_remove(tree2, x);
+        }
+    }
+    if (~(imap_u32_t)0 == budget)
+        imap_prune(tree);
+    else
+    {
+        x = 0;
+        nstep = 0;
+        do
+        {
+            x = imap_prune_step(tree, x, budget);
+            nstep++;
+        } while (x);
+        ASSERT(1 < nstep);
+    }
+
+    // a pruned tree has the same contents and the same shape as one whose values were removed
+    pair = imap_iterate(tree, &iter, 1);
+    pair2 = imap_iterate(tree2, &iter2, 1);
+    for (; pair.slot && pair2.slot; pair = imap_iterate(tree, &iter, 0), pair2 = imap_iterate(tree2, &iter2, 0))
+    {
+        ASSERT(pair.x == pair2.x);
+        ASSERT(imap_getval(tree, pair.slot) == imap_getval(tree2, pair2.slot));
+    }
+    ASSERT(!pair.slot && !pair2.slot);
+    nnode = nsmal = ncell = nboxd = 0;
+    imap__compact_count__(tree, tree->vecsl[imap__tree_root__], &nnode, &nsmal, &ncell, &nboxd);
+    nnode2 = nsmal2 = ncell2 = nboxd2 = 0;
+    imap__compact_count__(tree2, tree2->vecsl[imap__tree_root__], &nnode2, &nsmal2, &ncell2, &nboxd2);
+    ASSERT(nnode == nnode2);
+    ASSERT(nsmal == nsmal2);
+    ASSERT(ncell == ncell2);
+    ASSERT(nboxd == nboxd2);
+
+    imap_free(tree2);
+    imap_free(tree);
+}
+
+static void imap_prune_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    imap_pair_t pair;
+    imap_iter_t iter;
+
+    tree = imap_ensure(0, +3);
+    ASSERT(0 != tree);
+    tree = imap_setsparse(tree, 1);
+    ASSERT(0 != tree);
+    imap_setval(tree, imap_assign(tree, 0xA0001000), 0x1000);
+    imap_setval(tree, imap_assign(tree, 0xA0002000), 0x2000);
+    imap_setval(tree, imap_assign(tree, 0xA0002001), 0x2001);
+    imap_delval(tree, imap_lookup(tree, 0xA0002000));
+    imap_delval(tree, imap_lookup(tree, 0xA0002001));
+    ASSERT(imap__slot_issmall__(tree->vecsl[imap__tree_root__]));
+    imap_prune(tree);
+    ASSERT(imap__slot_iscell__(tree->vecsl[imap__tree_root__]));
+    ASSERT(0x1000 == imap_getval(tree, imap_lookup(tree, 0xA0001000)));
+    imap_delval(tree, imap_lookup(tree, 0xA0001000));
+    imap_prune(tree);
+    ASSERT(0 == (tree->vecsl[imap__tree_root__] & imap__slot_value__));
+    ASSERT(0 == imap_iterate(tree, &iter, 1).slot);
+    imap_free(tree);
+
+    // deleted values are dropped from a list
+    tree = imap_ensure_inline(0, +3);
+    ASSERT(0 != tree);
+    imap_setval(tree, imap_assign(tree, 1), 1);
+    imap_setval(tree, imap_assign(tree, 2), 2);
+    imap_setval(tree, imap_assign(tree, 3), 3);
+    slot = imap_lookup(tree, 2);
+    imap_delval(tree, slot);
+    ASSERT(imap__slot_islist__(tree->vecsl[imap__tree_root__]));
+    ASSERT(3 == (tree->vecsl[imap__tree_root__] & imap__slot_pmask__));
+    imap_prune(tree);
+    ASSERT(2 == (tree->vecsl[imap__tree_root__] & imap__slot_pmask__));
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(1 == pair.x);
+    pair = imap_iterate(tree, &iter, 0);
+    ASSERT(3 == pair.x);
+    imap_free(tree);
+
+    imap_prune_dotest(time(0), ~(imap_u32_t)0);
+    imap_prune_dotest(time(0), 1);
+    imap_prune_dotest(time(0), 7);
+}
+
+static void imap_clear_test(void)
+{
+    imap_node_t *tree, *tree2;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_u128_t y128;
+    imap_u64_t size;
+
+    tree = imap_ensure(0, +1000);
+    ASSERT(0 != tree);
+    // optional settings are kept in an extension node that a default tree does not have
+    ASSERT(0 == tree->vecsl[imap__tree_ext__]);
+    tree = imap_setgrowth(tree, imap_grow_half, 1 << 20);
+    ASSERT(0 != tree);
+    ASSERT(0 != tree->vecsl[imap__tree_ext__]);
+    for (unsigned i = 0; 1000 > i; i++)
+    {
+        slot = imap_assign(tree, i * 0x10001ull);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, i & 1 ? i : 0x8000000000000000ull | i);
+    }
+    size = tree->vecsl[imap__tree_size__];
+
+    // a cleared tree is empty but keeps its allocation and growth settings
+    imap_clear(tree);
+    ASSERT(0 == imap_lookup(tree, 0x10001));
+    pair = imap_iterate(tree, &iter, 1);
+    ASSERT(0 == pair.slot);
+    ASSERT(2 * sizeof(imap_node_t) == tree->vecsl[imap__tree_mark__]);
+    ASSERT(size == tree->vecsl[imap__tree_size__]);
+    ASSERT(imap_grow_half == imap__ext_get__(tree, imap__ext_grow__));
+    ASSERT(1 << 20 == imap__ext_get__(tree, imap__ext_budget__));
+    tree2 = imap_ensure(tree, +1000);
+    ASSERT(tree2 == tree);
+    for (unsigned i = 0; 1000 > i; i++)
+    {
+        slot = imap_assign(tree, i * 0x10003ull);
+        ASSERT(0 != slot);
+        imap_setval(tree, slot, 0x8000000000000000ull | i);
+    }
+    for (unsigned i = 0; 1000 > i; i++)
+    {
+        ASSERT((0x8000000000000000ull | i) == imap_getval(tree, imap_lookup(tree, i * 0x10003ull)));
+        if (i)
+            ASSERT(0 == imap_lookup(tree, i * 0x10001ull));
+    }
+    ASSERT(size == tree->vecsl[imap__tree_size__]);
+    imap_free(tree);
+
+    tree = imap_ensure128(0, +100);
+    ASSERT(0 != tree);
+    for (unsigned i = 0; 100 > i; i++)
+    {
+        slot = imap_assign(tree, i * 0x10001ull);
+        ASSERT(0 != slot);
+        y128.v[0] = i, y128.v[1] = ~(imap_u64_t)i;
+        imap_setval128(tree, slot, y128);
+    }
+    imap_clear128(tree);
+    for (unsigned i = 0; 100 > i; i++)
+    {
+        slot = imap_assign(tree, i);
+        ASSERT(0 != slot);
+        y128.v[0] = ~(imap_u64_t)i, y128.v[1] = i;
+        imap_setval128(tree, slot, y128);
+    }
+    for (unsigned i = 0; 100 > i; i++)
+    {
+        y128 = imap_getval128(tree, imap_lookup(tree, i));
+        ASSERT(~(imap_u64_t)i == y128.v[0] && i == y128.v[1]);
+    }
+    imap_free(tree);
+}
+
+static void imap_pool_test(void)
+{
+    imap_pool_t *pool;
+    imap_node_t *trees[6];
+    imap_slot_t *slot;
+    imap_iter_t iter;
+
+    pool = imap_pool_create(4, 100);
+    ASSERT(0 != pool);
+    ASSERT(4 == pool->count);
+
+    // trees checked out of a pool are empty and have room for n assignments
+    for (unsigned k = 0; 3 > k; k++)
+    {
+        for (unsigned t = 0; 6 > t; t++)
+        {
+            trees[t] = imap_pool_get(pool);
+            ASSERT(0 != trees[t]);
+            ASSERT(0 == imap_iterate(trees[t], &iter, 1).slot);
+            ASSERT(sizeof(imap_node_t) == trees[t]->vecsl[imap__tree_mark__]);
+            for (unsigned i = 0; 100 > i; i++)
+            {
+                slot = imap_assign(trees[t], (t + 1) * 0x1000 + i * 7);
+                ASSERT(0 != slot);
+                imap_setval(trees[t], slot, 0x8000000000000000ull | i);
+            }
+            for (unsigned i = 0; 100 > i; i++)
+                ASSERT((0x8000000000000000ull | i) == imap_getval(trees[t], imap_lookup(trees[t], (t + 1) * 0x1000 + i * 7)));
+        }
+        ASSERT(0 == pool->count);
+        for (unsigned t = 0; 6 > t; t++)
+            imap_pool_put(pool, trees[t]);
+        ASSERT(4 == pool->count);
+    }
+
+    imap_pool_free(pool);
+}
+
+static imap_u64_t imap_compact_step_account(imap_node_t *tree)
+{
+    imap_iter_t iter;
+    imap_pair_t pair;
+    imap_slot_t sval;
+    imap_u32_t nnode, nsmal, ncell, nboxd;
+    imap_u64_t nbyte;
+
+    // memory below the mark outside the header is either in use or on a free list
+    nnode = nsmal = ncell = nboxd = 0;
+    if (tree->vecsl[imap__tree_root__] & imap__slot_node__)
+        imap__compact_count__(tree, tree->vecsl[imap__tree_root__], &nnode, &nsmal, &ncell, &nboxd);
+    nbyte = nnode * sizeof(imap_node_t) + nsmal * imap__small_size__ + ncell * sizeof(imap_u128_t);
+    for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+        if (imap__slot_boxed__(*pair.slot) &&
+            sizeof(imap_node_t) <= (*pair.slot >> imap__slot_shift__) * sizeof(imap_u64_t))
+            nbyte += sizeof(imap_u64_t);
+    for (sval = tree->vecsl[imap__tree_nfre__]; sval; sval = *(imap_slot_t *)((imap_u8_t *)tree + sval))
+        nbyte += sizeof(imap_node_t);
+    for (sval = imap__ext_get__(tree, imap__ext_cfre__); sval; sval = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__])
+        nbyte += sizeof(imap_u128_t);
+    for (sval = imap__ext_get__(tree, imap__ext_sfre__); sval; sval = (imap_slot_t)*imap__small__(tree, sval))
+        nbyte += imap__small_size__;
+    for (sval = tree->vecsl[imap__tree_vfre__]; sval; sval = (imap_slot_t)tree->vec64[sval >> imap__slot_shift__])
+        if (sizeof(imap_node_t) <= (sval >> imap__slot_shift__) * sizeof(imap_u64_t))
+            nbyte += sizeof(imap_u64_t);
+    if (tree->vecsl[imap__tree_ext__])
+        nbyte += sizeof(imap_node_t);
+    return nbyte + sizeof(imap_node_t);
+}
+
+static void imap_compact_step_dotest(imap_u64_t seed, imap_u32_t budget, int mutate, int sparse)
+{
+    const unsigned N = 20000;
+    imap_node_t *tree = 0, *tree2 = 0;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+    imap_u64_t x, y, mark, last;
+    unsigned npass, nstep;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    if (sparse)
+    {
+        tree = imap_ensure(0, +1);
+        ASSERT(0 != tree);
+        tree = imap_setsparse(tree, 1);
+        ASSERT(0 != tree);
+        tree2 = imap_ensure(0, +1);
+        ASSERT(0 != tree2);
+        tree2 = imap_setsparse(tree2, 1);
+        ASSERT(0 != tree2);
+    }
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = test_rand() & (i & 1 ? 0xfffffull : 0xffffffffffffull);
+        y = test_rand() & 1 ? x : 0x8000000000000000ull | x;
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, x), y);
+        tree2 = imap_ensure(tree2, +1);
+        ASSERT(0 != tree2);
+        imap_setval(tree2, imap_assign(tree2, x), y);
+    }
+    test_srand(seed);
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = test_rand() & (i & 1 ? 0xfffffull : 0xffffffffffffull);
+        test_rand();
+        if (i % 4)
+        {
+            imap_remove(tree, x);
+            imap_remove(tree2, x);
+        }
+    }
+    ASSERT(imap_compact_step_account(tree) == tree->vecsl[imap__tree_mark__]);
+
+    // passes are run until one of them cannot lower the mark; mutations may happen between steps
+    mark = tree->vecsl[imap__tree_mark__];
+    for (npass = 0; 16 > npass; npass++)
+    {
+        last = tree->vecsl[imap__tree_mark__];
+        nstep = 0;
+        while (imap_compact_step(tree, budget))
+        {
+            nstep++;
+            if (mutate && 0 == nstep % 4)
+            {
+                x = test_rand() & (nstep & 1 ? 0xfffffull : 0xffffffffffffull);
+                y = test_rand() & 1 ? x : 0x8000000000000000ull | x;
+                if (test_rand() & 1)
+                {
+                    tree = imap_ensure(tree, +1);
+                    ASSERT(0 != tree);
+                    imap_setval(tree, imap_assign(tree, x), y);
+                    tree2 = imap_ensure(tree2, +1);
+                    ASSERT(0 != tree2);
+                    imap_setval(tree2, imap_assign(tree2, x), y);
+                }
+                else
+                {
+                    imap_remove(tree, x);
+                    imap_remove(tree2, x);
+                }
+            }
+        }
+        ASSERT(0 == imap__ext_get__(tree, imap__ext_cmpt__));
+        ASSERT(imap_compact_step_account(tree) == tree->vecsl[imap__tree_mark__]);
+        if (!mutate && last == tree->vecsl[imap__tree_mark__])
+            break;
+    }
+    if (!mutate)
+        ASSERT(mark / 2 > tree->vecsl[imap__tree_mark__]);
+
+    // the contents of the tree are not changed by compaction
+    pair = imap_iterate(tree, &iter, 1);
+    pair2 = imap_iterate(tree2, &iter2, 1);
+    for (; pair.slot && pair2.slot; pair = imap_iterate(tree, &iter, 0), pair2 = imap_iterate(tree2, &iter2, 0))
+    {
+        ASSERT(pair.x == pair2.x);
+        ASSERT(imap_getval(tree, pair.slot) == imap_getval(tree2, pair2.slot));
+    }
+    ASSERT(!pair.slot && !pair2.slot);
+
+    imap_free(tree2);
+    imap_free(tree);
+}
+
+static void imap_compact_step_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    imap_u128_t y128;
+    imap_u64_t mark;
+
+    // an inline map has nothing to compact
+    tree = imap_ensure_inline(0, +4);
+    ASSERT(0 != tree);
+    imap_setval(tree, imap_assign(tree, 1), 0x8000000000000001ull);
+    ASSERT(0 == imap_compact_step(tree, 1));
+    ASSERT(0x8000000000000001ull == imap_getval(tree, imap_lookup(tree, 1)));
+    imap_free(tree);
+
+    tree = 0;
+    for (unsigned i = 0; 10000 > i; i++)
+    {
+        tree = imap_ensure128(tree, +1);
+        ASSERT(0 != tree);
+        slot = imap_assign(tree, i * 0x10001ull);
+        ASSERT(0 != slot);
+        y128.v[0] = i;
+        y128.v[1] = ~(imap_u64_t)i;
+        imap_setval128(tree, slot, y128);
+    }
+    for (unsigned i = 0; 10000 > i; i++)
+        if (i % 8)
+            imap_remove(tree, i * 0x10001ull);
+    mark = tree->vecsl[imap__tree_mark__];
+    while (imap_compact_step128(tree, 64))
+        ;
+    ASSERT(mark > tree->vecsl[imap__tree_mark__]);
+    for (unsigned i = 0; 10000 > i; i++)
+    {
+        slot = imap_lookup(tree, i * 0x10001ull);
+        ASSERT((0 == i % 8) == (0 != slot));
+        if (slot)
+        {
+            y128 = imap_getval128(tree, slot);
+            ASSERT(i == y128.v[0] && ~(imap_u64_t)i == y128.v[1]);
+        }
+    }
+    imap_free(tree);
+
+    imap_compact_step_dotest(time(0), ~(imap_u32_t)0, 0, 0);
+    imap_compact_step_dotest(time(0), 1, 0, 0);
+    imap_compact_step_dotest(time(0), 16, 1, 0);
+    imap_compact_step_dotest(time(0), 1, 0, 1);
+    imap_compact_step_dotest(time(0), 16, 1, 1);
+}
+
+static void imap_compact_step_remove_dotest(imap_u64_t phase)
+{
+    const unsigned N = 2000;
+    imap_node_t *tree = 0;
+    imap_slot_t *slot;
+    imap_u64_t mark, cur;
+
+    tree = imap_ensure(0, +2);
+    ASSERT(0 != tree);
+    tree = imap_setsparse(tree, 1);
+    ASSERT(0 != tree);
+
+    // pairs of keys share a position 0 node; removing one key of a pair turns the node into a cell,
+    // which must not take memory past the mark (a tree whose mark equals its size has none there)
+    for (unsigned i = 0; 2 * N > i; i++)
+    {
+        tree = imap_ensure(tree, +2);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, 16 * i + 0), i);
+        imap_setval(tree, imap_assign(tree, 16 * i + 1), i);
+    }
+    // the older pairs are removed so that the newer pairs live in the gap of the pass
+    for (unsigned i = 0; N > i; i++)
+    {
+        imap_remove(tree, 16 * i + 0);
+        imap_remove(tree, 16 * i + 1);
+    }
+
+    // step the pass into the phase; keys assigned past the gap lead to the release phase
+    // and a removal in the gap with no free memory abandons the pass and leads to the drain phase
+    for (;;)
+    {
+        cur = imap__ext_get__(tree, imap__ext_cmpt__) ?
+            imap__cmpt__(tree)->vec64[imap__cmpt_limit__] & imap__cmpt_phase__ : 0;
+        if (phase == cur)
+            break;
+        if (imap__cmpt_sort__ == cur && imap__cmpt_release__ == phase)
+            for (unsigned i = 2 * N; 2 * N + 16 > i; i++)
+            {
+                tree = imap_ensure(tree, +1);
+                ASSERT(0 != tree);
+                imap_setval(tree, imap_assign(tree, 16 * i), i);
+            }
+        if (imap__cmpt_sort__ == cur && imap__cmpt_drain__ == phase)
+            imap_remove(tree, 16 * (2 * N - 1) + 1);
+        ASSERT(imap_compact_step(tree, 1));
+    }
+
+    // the newest pairs are at the top of the tree; they are removed first so that the free lists are empty
+    mark = tree->vecsl[imap__tree_mark__];
+    for (unsigned i = 2 * N; N < i; i--)
+    {
+        imap_remove(tree, 16 * (i - 1) + 1);
+        ASSERT(mark >= tree->vecsl[imap__tree_mark__]);
+    }
+    while (imap_compact_step(tree, 1))
+        ;
+    ASSERT(0 == imap__ext_get__(tree, imap__ext_cmpt__));
+    ASSERT(imap_compact_step_account(tree) == tree->vecsl[imap__tree_mark__]);
+    for (unsigned i = N; 2 * N > i; i++)
+    {
+        slot = imap_lookup(tree, 16 * i + 0);
+        ASSERT(0 != slot);
+        ASSERT(i == imap_getval(tree, slot));
+        ASSERT(0 == imap_lookup(tree, 16 * i + 1));
+    }
+
+    imap_free(tree);
+}
+
+static void imap_compact_step_remove_test(void)
+{
+    imap_compact_step_remove_dotest(imap__cmpt_measure__);
+    imap_compact_step_remove_dotest(imap__cmpt_sort__);
+    imap_compact_step_remove_dotest(imap__cmpt_evacuate__);
+    imap_compact_step_remove_dotest(imap__cmpt_release__);
+    imap_compact_step_remove_dotest(imap__cmpt_drain__);
+}
+
+static void imap_freeze_dotest(imap_u64_t seed, int wide, int sparse)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree = 0;
+    imap_frozen_t *frozen;
+    imap_slot_t *slot;
+    imap_iter_t iter;
+    imap_frozen_iter_t fiter;
+    imap_pair_t pair;
+    imap_frozen_pair_t fpair;
+    imap_u64_t x, y, mask;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    if (sparse)
+    {
+        tree = imap_ensure(0, +1);
+        ASSERT(0 != tree);
+        tree = imap_setsparse(tree, 1);
+        ASSERT(0 != tree);
+    }
+
+    // dense, clustered and sparse keys; some values are deleted and leave empty slots and cells behind
+    for (unsigned i = 0; N > i; i++)
+    {
+        mask = 0 == i % 3 ? 0xffffull : 1 == i % 3 ? 0xffffffull : ~0ull;
+        x = test_rand() & mask;
+        y = test_rand() & 1 ? test_rand() & 0xff : test_rand();
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, x), y);
+    }
+    for (unsigned i = 0; N / 8 > i; i++)
+    {
+        slot = imap_lookup(tree, test_rand() & 0xffffull);
+        if (slot)
+            imap_delval(tree, slot);
+    }
+
+    frozen = wide ? imap_freeze_wide(tree) : imap_freeze(tree);
+    ASSERT(0 != frozen);
+    ASSERT(imap_frozen_memsize(frozen) < tree->vecsl[imap__tree_mark__]);
+
+    fpair = imap_frozen_iterate(frozen, &fiter, 1);
+    for (pair = imap_iterate(tree, &iter, 1); pair.slot; pair = imap_iterate(tree, &iter, 0))
+    {
+        ASSERT(fpair.valid);
+        ASSERT(pair.x == fpair.x);
+        ASSERT(imap_getval(tree, pair.slot) == fpair.y);
+        ASSERT(imap_frozen_lookup(frozen, pair.x, &y));
+        ASSERT(imap_getval(tree, pair.slot) == y);
+        fpair = imap_frozen_iterate(frozen, &fiter, 0);
+    }
+    ASSERT(!fpair.valid);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        mask = 0 == i % 3 ? 0xffffull : 1 == i % 3 ? 0xffffffull : ~0ull;
+        x = test_rand() & mask;
+        slot = imap_lookup(tree, x);
+        ASSERT((0 != slot) == imap_frozen_lookup(frozen, x, &y));
+        pair = imap_locate(tree, &iter, x);
+        fpair = imap_frozen_locate(frozen, &fiter, x);
+        for (unsigned j = 0; 3 > j; j++)
+        {
+            ASSERT((0 != pair.slot) == fpair.valid);
+            if (!pair.slot)
+                break;
+            ASSERT(pair.x == fpair.x);
+            ASSERT(imap_getval(tree, pair.slot) == fpair.y);
+            pair = imap_iterate(tree, &iter, 0);
+            fpair = imap_frozen_iterate(frozen, &fiter, 0);
+        }
+    }
+
+    imap_frozen_free(frozen);
+    imap_free(tree);
+}
+
+static void imap_freeze_test(void)
+{
+    imap_node_t *tree;
+    imap_frozen_t *frozen;
+    imap_frozen_iter_t fiter;
+    imap_frozen_pair_t fpair;
+    imap_u64_t y;
+
+    tree = imap_ensure(0, +1);
+    ASSERT(0 != tree);
+    frozen = imap_freeze(tree);
+    ASSERT(0 != frozen);
+    ASSERT(!imap_frozen_lookup(frozen, 0, &y));
+    ASSERT(!imap_frozen_iterate(frozen, &fiter, 1).valid);
+    ASSERT(!imap_frozen_locate(frozen, &fiter, 0).valid);
+    imap_frozen_free(frozen);
+
+    // a single pair
+    imap_setval(tree, imap_assign(tree, 0xA0000056), 0x8000000000000056ull);
+    frozen = imap_freeze(tree);
+    ASSERT(0 != frozen);
+    ASSERT(imap_frozen_lookup(frozen, 0xA0000056, &y));
+    ASSERT(0x8000000000000056ull == y);
+    ASSERT(!imap_frozen_lookup(frozen, 0xA0000057, &y));
+    fpair = imap_frozen_locate(frozen, &fiter, 0xA0000000);
+    ASSERT(fpair.valid && 0xA0000056 == fpair.x && 0x8000000000000056ull == fpair.y);
+    ASSERT(!imap_frozen_iterate(frozen, &fiter, 0).valid);
+    ASSERT(!imap_frozen_locate(frozen, &fiter, 0xA0000057).valid);
+    imap_frozen_free(frozen);
+    imap_free(tree);
+
+    // an inline map
+    tree = imap_ensure_inline(0, +3);
+    ASSERT(0 != tree);
+    imap_setval(tree, imap_assign(tree, 3), 30);
+    imap_setval(tree, imap_assign(tree, 1), 10);
+    imap_setval(tree, imap_assign(tree, 0x100), 0x8000000000000000ull);
+    frozen = imap_freeze(tree);
+    ASSERT(0 != frozen);
+    fpair = imap_frozen_locate(frozen, &fiter, 2);
+    ASSERT(fpair.valid && 3 == fpair.x && 30 == fpair.y);
+    fpair = imap_frozen_iterate(frozen, &fiter, 0);
+    ASSERT(fpair.valid && 0x100 == fpair.x && 0x8000000000000000ull == fpair.y);
+    ASSERT(imap_frozen_lookup(frozen, 1, &y) && 10 == y);
+    imap_frozen_free(frozen);
+    imap_free(tree);
+
+    // densely packed keys take less than half the memory allocated for the tree
+    tree = 0;
+    for (unsigned i = 0; 100000 > i; i++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, i), i);
+    }
+    frozen = imap_freeze(tree);
+    ASSERT(0 != frozen);
+    ASSERT(2 * imap_frozen_memsize(frozen) < tree->vecsl[imap__tree_size__]);
+    for (unsigned i = 0; 100000 > i; i++)
+        ASSERT(imap_frozen_lookup(frozen, i, &y) && i == y);
+    imap_frozen_free(frozen);
+    imap_free(tree);
+
+    // wide nodes replace dense internal nodes and their children
+    tree = 0;
+    for (unsigned i = 0; 0x8000 > i; i++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, i * 2), i);
+    }
+    frozen = imap_freeze_wide(tree);
+    ASSERT(0 != frozen);
+    ASSERT(*(imap_u32_t *)imap__frozen_node__(frozen, imap__frozen_root__(frozen)) & imap__frozen_wide__);
+    for (unsigned i = 0; 0x8000 > i; i++)
+    {
+        ASSERT(imap_frozen_lookup(frozen, i * 2, &y) && i == y);
+        ASSERT(!imap_frozen_lookup(frozen, i * 2 + 1, &y));
+    }
+    ASSERT(!imap_frozen_lookup(frozen, 0x10000, &y));
+    fpair = imap_frozen_iterate(frozen, &fiter, 1);
+    for (unsigned i = 0; 0x8000 > i; i++)
+    {
+        ASSERT(fpair.valid && i * 2 == fpair.x && i == fpair.y);
+        fpair = imap_frozen_iterate(frozen, &fiter, 0);
+    }
+    ASSERT(!fpair.valid);
+    fpair = imap_frozen_locate(frozen, &fiter, 0x1233);
+    ASSERT(fpair.valid && 0x1234 == fpair.x && 0x91a == fpair.y);
+    ASSERT(!imap_frozen_locate(frozen, &fiter, 0xffff).valid);
+    imap_frozen_free(frozen);
+    imap_free(tree);
+
+    imap_freeze_dotest(time(0), 0, 0);
+    imap_freeze_dotest(time(0) + 1, 1, 0);
+    imap_freeze_dotest(time(0) + 2, 0, 1);
+    imap_freeze_dotest(time(0) + 3, 1, 1);
+}
+
+static void imap_jump_check(imap_node_t *tree)
+{
+    imap_slot_t jump = imap__ext_get__(tree, imap__ext_jump__);
+    imap_slot_t sval = tree->vecsl[imap__tree_root__];
+    imap_u64_t *jhdr;
+    imap_slot_t *entries;
+    imap_u32_t posn, levels;
+
+    // every entry must reference the full node a descent would reach after its digits, or be 0
+    ASSERT(0 != jump);
+    jhdr = imap__node__(tree, jump)->vec64;
+    entries = imap__jump_entries__(tree, jump);
+    if (1 == jhdr[imap__jump_prefix__])
+    {
+        // a table that is not in use may have missed a change between roots that are not full nodes
+        ASSERT((sval & (imap__slot_node__ | imap__slot_cell__)) != imap__slot_node__ ||
+            (jhdr[imap__jump_root__] == sval && 0 == imap__node_pos__(imap__node__(tree, sval & imap__slot_value__))));
+        return;
+    }
+    ASSERT(jhdr[imap__jump_root__] == sval);
+    posn = (imap_u32_t)jhdr[imap__jump_posn__];
+    levels = (imap_u32_t)jhdr[imap__jump_levels__];
+    ASSERT(posn == imap__node_pos__(imap__node__(tree, sval & imap__slot_value__)));
+    for (imap_u32_t level = 1; levels >= level; level++)
+        for (imap_u64_t i = 0; (1ull << (level << 2)) > i; i++)
+        {
+            imap_slot_t cval = sval;
+            for (imap_u32_t l = 1; level >= l && cval; l++)
+            {
+                cval = imap__node__(tree, cval & imap__slot_value__)->vecsl[(i >> ((level - l) << 2)) & 15];
+                if ((cval & (imap__slot_node__ | imap__slot_cell__)) != imap__slot_node__ ||
+                    imap__node_pos__(imap__node__(tree, cval & imap__slot_value__)) != posn - l)
+                    cval = 0;
+            }
+            ASSERT((cval & ~imap__slot_pmask__) == entries[imap__jump_base__(level) + i]);
+        }
+}
+
+static void imap_jump_compare(imap_node_t *tree, imap_node_t *tree2, imap_u64_t x)
+{
+    imap_slot_t *slot, *slot2;
+    imap_iter_t iter, iter2;
+    imap_pair_t pair, pair2;
+
+    slot = imap_lookup(tree, x);
+    slot2 = imap_lookup(tree2, x);
+    ASSERT(!slot == !slot2);
+    if (slot)
+        ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+    pair = imap_locate(tree, &iter, x);
+    pair2 = imap_locate(tree2, &iter2, x);
+    for (unsigned j = 0; 4 > j; j++)
+    {
+        ASSERT(!pair.slot == !pair2.slot);
+        if (!pair.slot)
+            break;
+        ASSERT(pair.x == pair2.x);
+        ASSERT(imap_getval(tree, pair.slot) == imap_getval(tree2, pair2.slot));
+        pair = imap_iterate(tree, &iter, 0);
+        pair2 = imap_iterate(tree2, &iter2, 0);
+    }
+}
+
+static void imap_jump_dotest(imap_u64_t seed, imap_u32_t depth)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree, *tree2;
+    imap_u64_t x, mask;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    // tree has a jump table, tree2 does not; both see the same operations
+    tree = imap_setjump(imap_ensure(0, +1), depth);
+    ASSERT(0 != tree);
+    tree2 = imap_ensure(0, +1);
+    ASSERT(0 != tree2);
+    imap_jump_check(tree);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        // dense 20-bit keys with a few keys elsewhere, which move the root up and down
+        mask = 0 == i % 1000 ? 0xffffffffffull : 0xfffffull;
+        x = test_rand() & mask;
+        switch (test_rand() % 8)
+        {
+        case 0:
+        case 1:
+            imap_remove(tree, x);
+            imap_remove(tree2, x);
+            if (0xfffffull < x)
+            {
+                imap_remove_range(tree, 0x100000ull, ~0ull);
+                imap_remove_range(tree2, 0x100000ull, ~0ull);
+            }
+            break;
+        case 2:
+            if (0 == i % 64)
+            {
+                imap_remove_range(tree, x, x + 0xfff);
+                imap_remove_range(tree2, x, x + 0xfff);
+                break;
+            }
+            /* fall through */
+        default:
+            tree = imap_ensure(tree, +1);
+            ASSERT(0 != tree);
+            tree2 = imap_ensure(tree2, +1);
+            ASSERT(0 != tree2);
+            imap_setval(tree, imap_assign(tree, x), x + 1);
+            imap_setval(tree2, imap_assign(tree2, x), x + 1);
+            break;
+        }
+        if (0 == i % 4096)
+            imap_jump_check(tree);
+        imap_jump_compare(tree, tree2, test_rand() & 0xfffffull);
+    }
+    imap_jump_check(tree);
+    ASSERT(1 != imap__node__(tree, imap__ext_get__(tree, imap__ext_jump__))->vec64[imap__jump_prefix__]);
+
+    // deleted values are pruned the same way
+    for (unsigned i = 0; N / 16 > i; i++)
+    {
+        x = test_rand() & 0xfffffull;
+        if (imap_lookup(tree, x))
+        {
+            imap_delval(tree, imap_lookup(tree, x));
+            imap_delval(tree2, imap_lookup(tree2, x));
+        }
+    }
+    imap_prune(tree);
+    imap_prune(tree2);
+    imap_jump_check(tree);
+
+    // compaction and relayout keep the table
+    tree = imap_compact(tree);
+    ASSERT(0 != tree);
+    ASSERT(0 != imap__ext_get__(tree, imap__ext_jump__));
+    imap_jump_check(tree);
+    tree = imap_relayout(tree, imap_layout_bfs);
+    ASSERT(0 != tree);
+    ASSERT(0 != imap__ext_get__(tree, imap__ext_jump__));
+    imap_jump_check(tree);
+    for (unsigned i = 0; N / 16 > i; i++)
+        imap_jump_compare(tree, tree2, test_rand() & 0xfffffull);
+
+    // the table can be resized and removed
+    tree = imap_setjump(tree, depth % imap__jump_maxdepth__ + 1);
+    ASSERT(0 != tree);
+    imap_jump_check(tree);
+    tree = imap_setjump(tree, 0);
+    ASSERT(0 != tree);
+    ASSERT(0 == imap__ext_get__(tree, imap__ext_jump__));
+    tree = imap_setjump(tree, depth);
+    ASSERT(0 != tree);
+    imap_jump_check(tree);
+
+    // a compaction pass drops the table
+    while (imap_compact_step(tree, 64))
+        ;
+    ASSERT(0 == imap__ext_get__(tree, imap__ext_jump__));
+    for (unsigned i = 0; N / 16 > i; i++)
+        imap_jump_compare(tree, tree2, test_rand() & 0xfffffull);
+
+    imap_free(tree2);
+    imap_free(tree);
+}
+
+static void imap_jump_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+
+    // a table on an inline map is not used until the map turns into a tree
+    tree = imap_setjump(imap_ensure_inline(0, +1), 2);
+    ASSERT(0 != tree);
+    imap_jump_check(tree);
+    for (imap_u64_t x = 0; 0x1000 > x; x++)
+    {
+        tree = imap_ensure_inline(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, x << 8), x);
+    }
+    imap_jump_check(tree);
+    ASSERT(1 != imap__node__(tree, imap__ext_get__(tree, imap__ext_jump__))->vec64[imap__jump_prefix__]);
+    for (imap_u64_t x = 0; 0x1000 > x; x++)
+    {
+        slot = imap_lookup(tree, x << 8);
+        ASSERT(0 != slot);
+        ASSERT(x == imap_getval(tree, slot));
+        ASSERT(0 == imap_lookup(tree, (x << 8) + 1));
+    }
+    for (imap_u64_t x = 0; 0x1000 > x; x++)
+        imap_remove(tree, x << 8);
+    imap_jump_check(tree);
+    ASSERT(0 == tree->vecsl[imap__tree_root__]);
+
+    // clearing drops the table
+    imap_clear(tree);
+    ASSERT(0 == imap__ext_get__(tree, imap__ext_jump__));
+    imap_free(tree);
+
+    for (imap_u32_t depth = 1; imap__jump_maxdepth__ >= depth; depth++)
+        imap_jump_dotest(time(0) + depth, depth);
+}
+
+static imap_u64_t imap_lcache_descend(imap_node_t *tree, imap_u64_t prfx)
+{
+    imap_slot_t *slot = &tree->vecsl[imap__tree_root__];
+    imap_slot_t sval;
+    imap_node_t *node;
+
+    // the mark of the position 0 node of prfx, as a descent finds it, or 0
+    for (;;)
+    {
+        sval = *slot;
+        if (!(sval & imap__slot_node__))
+            return 0;
+        if (sval & imap__slot_cell__)
+        {
+            if (!(sval & imap__slot_small__))
+                return 0;
+            slot = imap__small_slot__(tree, sval,
+                imap__xdir__(prfx, (imap_u32_t)(*imap__small__(tree, sval) & imap__prefix_pos__)));
+            if (!slot)
+                return 0;
+            continue;
+        }
+        node = imap__node__(tree, sval & imap__slot_value__);
+        if (0 == imap__node_pos__(node))
+            return imap__node_prefix__(node) == prfx ? sval & imap__slot_value__ : 0;
+        slot = &node->vecsl[imap__xdir__(prfx, imap__node_pos__(node))];
+    }
+}
+
+static void imap_lcache_check(imap_node_t *tree)
+{
+    imap_slot_t lcache = imap__ext_get__(tree, imap__ext_lcache__);
+    imap_u64_t *chdr, *entry;
+
+    // every entry must be empty or reference the live position 0 node of its key, in the entry of its key
+    ASSERT(0 != lcache);
+    chdr = imap__node__(tree, lcache)->vec64;
+    entry = (imap_u64_t *)((imap_u8_t *)tree + lcache + sizeof(imap_node_t));
+    for (imap_u64_t i = 0; chdr[imap__lcache_count__] > i; i++, entry += 2)
+    {
+        if (imap__lcache_empty__ == entry[0])
+        {
+            ASSERT(0 == entry[1]);
+            continue;
+        }
+        ASSERT(imap__lcache_entry__(tree, lcache, entry[0]) == entry);
+        ASSERT(0 != entry[1]);
+        ASSERT(imap_lcache_descend(tree, entry[0]) == entry[1]);
+    }
+}
+
+static void imap_lcache_dotest(imap_u64_t seed, imap_u32_t count)
+{
+    const unsigned N = 100000;
+    imap_node_t *tree, *tree2;
+    imap_slot_t *slot, *slot2;
+    imap_u64_t x, hits, misses, nhits, nmisses, nlookup = 0;
+
+    tlib_printf("seed=%llu ", (unsigned long long)seed);
+    test_srand(seed);
+
+    // tree has a leaf cache, tree2 does not; both see the same operations
+    tree = imap_setcache(imap_ensure(0, +1), count);
+    ASSERT(0 != tree);
+    tree2 = imap_ensure(0, +1);
+    ASSERT(0 != tree2);
+    imap_lcache_check(tree);
+
+    for (unsigned i = 0; N > i; i++)
+    {
+        // dense 16-bit keys, so that most keys share full position 0 nodes; the low bits of test_rand
+        // repeat too soon to choose keys and operations
+        x = (test_rand() >> 32) & 0xffffull;
+        switch ((test_rand() >> 32) % 8)
+        {
+        case 0:
+        case 1:
+            imap_remove(tree, x);
+            imap_remove(tree2, x);
+            break;
+        case 2:
+            if (0 == i % 64)
+            {
+                imap_remove_range(tree, x, x + 0xff);
+                imap_remove_range(tree2, x, x + 0xff);
+                break;
+            }
+            /* fall through */
+        default:
+            tree = imap_ensure(tree, +1);
+            ASSERT(0 != tree);
+            tree2 = imap_ensure(tree2, +1);
+            ASSERT(0 != tree2);
+            imap_setval(tree, imap_assign(tree, x), x + 1);
+            imap_setval(tree2, imap_assign(tree2, x), x + 1);
+            break;
+        }
+        if (0 == i % 4096)
+            imap_lcache_check(tree);
+        // skewed lookups: most go to a few hot prefixes, many fewer than the cache has entries
+        for (unsigned j = 0; 4 > j; j++, nlookup++)
+        {
+            x = test_rand() >> 32;
+            x = x % 4 ? (x >> 2) & (count - 1) : (x >> 2) & 0xffffull;
+            slot = imap_lookup(tree, x);
+            slot2 = imap_lookup(tree2, x);
+            ASSERT(!slot == !slot2);
+            if (slot)
+                ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+        }
+    }
+    imap_lcache_check(tree);
+    ASSERT(count == imap_cachestats(tree, &hits, &misses));
+    ASSERT(nlookup == hits + misses);
+
+    // once the hot keys are all present, their prefixes hit
+    for (x = 0; count > x; x++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        tree2 = imap_ensure(tree2, +1);
+        ASSERT(0 != tree2);
+        imap_setval(tree, imap_assign(tree, x), x + 1);
+        imap_setval(tree2, imap_assign(tree2, x), x + 1);
+    }
+    imap_cachestats(tree, &hits, &misses);
+    for (unsigned i = 0; N > i; i++)
+    {
+        x = test_rand() >> 32;
+        x = x % 4 ? (x >> 2) & (count - 1) : (x >> 2) & 0xffffull;
+        slot = imap_lookup(tree, x);
+        slot2 = imap_lookup(tree2, x);
+        ASSERT(!slot == !slot2);
+    }
+    nhits = hits;
+    nmisses = misses;
+    imap_cachestats(tree, &hits, &misses);
+    ASSERT(N == hits + misses - nhits - nmisses);
+    ASSERT(hits - nhits > misses - nmisses);
+
+    // deleted values are pruned the same way
+    for (unsigned i = 0; N / 16 > i; i++)
+    {
+        x = test_rand() & 0xffffull;
+        if (imap_lookup(tree, x))
+        {
+            imap_delval(tree, imap_lookup(tree, x));
+            imap_delval(tree2, imap_lookup(tree2, x));
+        }
+    }
+    imap_prune(tree);
+    imap_prune(tree2);
+    imap_lcache_check(tree);
+
+    // compaction and relayout keep an empty cache and its counters
+    tree = imap_compact(tree);
+    ASSERT(0 != tree);
+    ASSERT(count == imap_cachestats(tree, &hits, &misses));
+    ASSERT(nlookup <= hits + misses);
+    imap_lcache_check(tree);
+    tree = imap_relayout(tree, imap_layout_veb);
+    ASSERT(0 != tree);
+    ASSERT(count == imap_cachestats(tree, &hits, &misses));
+    imap_lcache_check(tree);
+    for (unsigned i = 0; N / 16 > i; i++)
+    {
+        x = test_rand() & 0xffffull;
+        slot = imap_lookup(tree, x);
+        slot2 = imap_lookup(tree2, x);
+        ASSERT(!slot == !slot2);
+        if (slot)
+            ASSERT(imap_getval(tree, slot) == imap_getval(tree2, slot2));
+    }
+    imap_lcache_check(tree);
+
+    // the cache can be resized and removed; a new cache starts counting anew
+    tree = imap_setcache(tree, count * 2);
+    ASSERT(0 != tree);
+    ASSERT(count * 2 == imap_cachestats(tree, &hits, &misses));
+    ASSERT(0 == hits && 0 == misses);
+    imap_lcache_check(tree);
+    tree = imap_setcache(tree, 0);
+    ASSERT(0 != tree);
+    ASSERT(0 == imap_cachestats(tree, &hits, &misses));
+    tree = imap_setcache(tree, count);
+    ASSERT(0 != tree);
+    imap_lcache_check(tree);
+
+    // a compaction pass drops the cache
+    while (imap_compact_step(tree, 64))
+        ;
+    ASSERT(0 == imap__ext_get__(tree, imap__ext_lcache__));
+
+    imap_free(tree2);
+    imap_free(tree);
+}
+
+static void imap_lcache_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    imap_u64_t hits, misses;
+
+    // sizes are rounded up to a power of 2 within limits
+    tree = imap_setcache(imap_ensure(0, +1), 1);
+    ASSERT(0 != tree);
+    ASSERT(imap__lcache_mincount__ == imap_cachestats(tree, &hits, &misses));
+    tree = imap_setcache(tree, 1000);
+    ASSERT(0 != tree);
+    ASSERT(1024 == imap_cachestats(tree, &hits, &misses));
+    tree = imap_setcache(tree, ~0u);
+    ASSERT(0 != tree);
+    ASSERT(imap__lcache_maxcount__ == imap_cachestats(tree, &hits, &misses));
+    imap_lcache_check(tree);
+
+    // a removed position 0 node leaves no entry behind, even when its memory is reused
+    for (imap_u64_t x = 0; 0x100 > x; x++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, x), x);
+    }
+    for (imap_u64_t x = 0; 0x100 > x; x++)
+        ASSERT(0 != imap_lookup(tree, x));
+    imap_lcache_check(tree);
+    imap_remove_range(tree, 0x40, 0x7f);
+    imap_lcache_check(tree);
+    for (imap_u64_t x = 0x1000; 0x1040 > x; x++)
+    {
+        tree = imap_ensure(tree, +1);
+        ASSERT(0 != tree);
+        imap_setval(tree, imap_assign(tree, x), x);
+    }
+    imap_lcache_check(tree);
+    for (imap_u64_t x = 0; 0x100 > x; x++)
+    {
+        slot = imap_lookup(tree, x);
+        ASSERT((0x40 <= x && x < 0x80) == !slot);
+        if (slot)
+            ASSERT(x == imap_getval(tree, slot));
+    }
+    imap_lcache_check(tree);
+
+    // clearing drops the cache
+    imap_clear(tree);
+    ASSERT(0 == imap__ext_get__(tree, imap__ext_lcache__));
+    imap_free(tree);
+
+    imap_lcache_dotest(time(0), 64);
+    imap_lcache_dotest(time(0) + 1, 4096);
+}
+
+static void imap_dump_test(void)
+{
+    imap_node_t *tree;
+    imap_slot_t *slot;
+    char *dump;
+
+    tree = 0;
+    tree = imap_ensure(tree, +1);
+    ASSERT(0 != tree);
+    dump = 0;
+    imap_dump(tree, test_concat_sprintf, &dump);
+    ASSERT(0 == dump);
+    free(dump);
+    imap_free(tree);
+
+    tree = 0;
+    tree = imap_ensure(tree, +5);
+    ASSERT(0 != tree);
+    slot = imap_assign(tree, 0xA0000056);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x56);
+    slot = imap_assign(tree, 0xA0000057);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x57);
+    slot = imap_assign(tree, 0xA0008009);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8009);
+    slot = imap_assign(tree, 0xA0008059);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8059);
+    slot = imap_assign(tree, 0xA0008069);
+    ASSERT(0 != slot);
+    imap_setval(tree, slot, 0x8069);
+    //
+    dump = 0;
+    imap_dump(tree, test_concat_sprintf, &dump);
+#if !defined(IMAP_WIDE_SLOTS)
+    ASSERT(0 == strcmp(dump, ""
+        "00000080: 00000000a0000000/3 0->*40 8->*100\n"
+        "00000040: 00000000a0000050/0 6->56 7->57\n"
+        "00000100: 00000000a0008000/1 0->*c0 5->*140 6->*180\n"
+        "000000c0: 00000000a0008000/0 9->8009\n"
+        "00000140: 00000000a0008050/0 9->8059\n"
+        "00000180: 00000000a0008060/0 9->8069\n"
+        ""));
+#else
+    ASSERT(0 == strcmp(dump, ""
+        "00000100: 00000000a0000000/3 0->*80 8->*200\n"
+        "00000080: 00000000a0000050/0 6->56 7->57\n"
+        "00000200: 00000000a0008000/1 0->*180 5->*280 6->*300\n"
+        "00000180: 00000000a0008000/0 9->8009\n"
+        "00000280: 00000000a0008050/0 9->8059\n"
+        "00000300: 00000000a0008060/0 9->8069\n"
         ""));
+#endif
     free(dump);
     //
     slot = imap_lookup(tree, 0xA0000056);
@@ -1422,6 +4764,32 @@ void imap_tests(void)
     TEST(imap_iterate_shuffle_test);
     TEST(imap_locate_test);
     TEST(imap_locate_random_test);
+    TEST(imap_locate_rev_test);
+    TEST(imap_scan_range_test);
+    TEST(imap_lookup_batch_test);
+    TEST(imap_build_sorted_test);
+    TEST(imap_apply_batch_test);
+    TEST(imap_cursor_test);
+    TEST(imap_remove_range_test);
+    TEST(imap_count_test);
+    TEST(imap_compact_test);
+    TEST(imap_relayout_test);
+    TEST(imap_ensure_grow_test);
+    TEST(imap_ensure_resv_test);
+    TEST(imap_growth_test);
+    TEST(imap_reserve_exact_test);
+    TEST(imap_sparse_leaf_test);
+    TEST(imap_small_node_test);
+    TEST(imap_inline_test);
+    TEST(imap_forest_test);
+    TEST(imap_prune_test);
+    TEST(imap_clear_test);
+    TEST(imap_pool_test);
+    TEST(imap_compact_step_test);
+    TEST(imap_compact_step_remove_test);
+    TEST(imap_freeze_test);
+    TEST(imap_jump_test);
+    TEST(imap_lcache_test);
     TEST(imap_dump_test);
 }
 